@@ -1,22 +1,161 @@
+#ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define NOMINMAX 
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#endif
 #include <iostream>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 #include <limits>
-
+#include <stdexcept>
+#include <cstdint>
+#include <cctype>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
+#else
+// Совместимость с WinSock API на POSIX-системах
+typedef int SOCKET;
+typedef sockaddr SOCKADDR;
+typedef unsigned long DWORD;
+struct WSADATA {};
+
+const SOCKET INVALID_SOCKET = -1;
+const int SOCKET_ERROR = -1;
+const int WSAETIMEDOUT = EAGAIN;
+
+#define MAKEWORD(a, b) ((a) | ((b) << 8))
+
+inline int WSAStartup(int, WSADATA*) { return 0; }
+inline int WSACleanup() { return 0; }
+inline int WSAGetLastError() { return errno; }
+inline int closesocket(SOCKET socket) { return close(socket); }
+inline int InetPtonA(int family, const char* address, void* destination) {
+    return inet_pton(family, address, destination);
+}
+#endif
 
 // Константы для настройки клиента
 const char* DEFAULT_SERVER_IP = "127.0.0.1";
 const int DEFAULT_PORT = 12345;
-const int BUFFER_SIZE = 4096;
+const int BUFFER_SIZE = 8192;
 const int RECV_TIMEOUT_MS = 30000;
+const int BOARD_SIZE = 10;
+const size_t MAX_PLAYER_NAME = 32;
+const std::string TEXT_TURN_PROMPT = "Enter coordinates to shoot (x y): ";
+
+// После обрыва соединения клиент возвращается в партию по токену; сервер
+// держит место игрока около 20 секунд (--resume-grace)
+const int RECONNECT_ATTEMPTS = 10;
+const int RECONNECT_DELAY_MS = 1000;
+
+// Компактный бинарный протокол BIN1 (см. NavalBattle_server.cpp).
+// Кадр: длина нагрузки (uint16, big-endian), код операции (uint8), нагрузка.
+namespace Protocol {
+    const std::string BINARY_HELLO = "PROTO BIN1\n";
+    const std::string BINARY_ACCEPTED = "PROTO BIN1 OK\n";
+    const std::string NAME_COMMAND = "NAME ";
+    const std::string COMPUTER_COMMAND = "PLAY COMPUTER\n";
+    const std::string WATCH_COMMAND = "WATCH";
+    const std::string RESUME_COMMAND = "RESUME ";
+    const std::string RESUME_TOKEN_LINE = "RESUME_TOKEN ";
+    const size_t FRAME_HEADER_SIZE = 3;
+    const size_t PACKED_BOARD_SIZE = BOARD_SIZE * BOARD_SIZE / 2;
+
+    enum Opcode {
+        OP_TEXT = 0x01,
+        OP_BOARD = 0x02,
+        OP_TURN = 0x03,
+        OP_RESULT = 0x04,
+        OP_GAME_OVER = 0x05,
+        OP_ERROR = 0x06,
+        OP_SNAPSHOT = 0x07,
+        OP_DELTA = 0x08,
+        OP_RESUME_TOKEN = 0x09,
+        OP_SHOT = 0x10,
+        OP_SYNC = 0x11
+    };
+
+    std::string frame(uint8_t opcode, const std::string& payload) {
+        std::string result;
+        result += static_cast<char>((payload.size() >> 8) & 0xFF);
+        result += static_cast<char>(payload.size() & 0xFF);
+        result += static_cast<char>(opcode);
+        result += payload;
+        return result;
+    }
+
+    const char* shotResultText(int result) {
+        switch (result) {
+        case 1: return "MISS";
+        case 2: return "MISS: Already attacked this position";
+        case 3: return "HIT";
+        case 4: return "HIT: Ship sunk!";
+        default: return "INVALID: Coordinates out of bounds";
+        }
+    }
+}
+
+// Поле, восстановленное из упакованного представления (4 бита на клетку)
+struct BoardView {
+    std::vector<int> cells;
+
+    BoardView() : cells(BOARD_SIZE * BOARD_SIZE, 0) {}
+
+    size_t unpack(const std::string& data, size_t offset) {
+        for (size_t i = 0; i < cells.size() && offset + i / 2 < data.size(); i++) {
+            uint8_t byte = static_cast<uint8_t>(data[offset + i / 2]);
+            cells[i] = (i % 2 == 0) ? (byte & 0x0F) : (byte >> 4);
+        }
+        return offset + Protocol::PACKED_BOARD_SIZE;
+    }
+
+    // Применяет список изменившихся клеток [число, (клетка, состояние)...]
+    size_t applyDelta(const std::string& data, size_t offset) {
+        if (offset >= data.size()) return offset;
+
+        size_t count = static_cast<uint8_t>(data[offset++]);
+        for (size_t i = 0; i < count && offset + 1 < data.size(); i++, offset += 2) {
+            size_t cell = static_cast<uint8_t>(data[offset]);
+            if (cell < cells.size()) {
+                cells[cell] = static_cast<uint8_t>(data[offset + 1]);
+            }
+        }
+        return offset;
+    }
+
+    std::string toString() const {
+        static const char SYMBOLS[] = { '.', 'S', 'X', 'O', '#' };
+        std::string result = "  0 1 2 3 4 5 6 7 8 9\n";
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            result += std::to_string(y) + ' ';
+            for (int x = 0; x < BOARD_SIZE; x++) {
+                int state = cells[y * BOARD_SIZE + x];
+                result += (state >= 0 && state <= 4) ? SYMBOLS[state] : '?';
+                result += ' ';
+            }
+            result += '\n';
+        }
+        return result;
+    }
+};
 
 // Вспомогательные функции для ввода данных
 namespace InputUtils {
@@ -96,6 +235,62 @@ namespace InputUtils {
             }
         }
     }
+
+    // Функция для получения имени игрока (по имени сервер ведет рейтинг)
+    std::string getPlayerName() {
+        while (true) {
+            std::string name = getTrimmedInput("Enter your name for rated games [anonymous]: ");
+
+            if (name.empty()) {
+                return name;
+            }
+
+            bool valid = name.size() <= MAX_PLAYER_NAME && std::all_of(name.begin(), name.end(),
+                [](unsigned char ch) { return std::isalnum(ch) || ch == '_' || ch == '-'; });
+            if (valid) {
+                return name;
+            }
+
+            std::cout << "Name must be up to " << MAX_PLAYER_NAME << " letters, digits, '_' or '-'\n";
+        }
+    }
+
+    // Функция для выбора режима зрителя: номер партии, "y" - главная партия
+    // сервера; возвращает команду WATCH или пустую строку, если клиент будет играть
+    std::string getWatchCommand() {
+        while (true) {
+            std::string answer = getTrimmedInput("Watch a game instead of playing? (game number, y for the featured game, n) [n]: ");
+
+            if (answer.empty() || answer == "n" || answer == "N") {
+                return "";
+            }
+            if (answer == "y" || answer == "Y") {
+                return Protocol::WATCH_COMMAND + "\n";
+            }
+            if (answer.size() <= 18 && std::all_of(answer.begin(), answer.end(),
+                [](unsigned char ch) { return std::isdigit(ch) != 0; })) {
+                return Protocol::WATCH_COMMAND + " " + answer + "\n";
+            }
+
+            std::cout << "Please enter a game number, y or n\n";
+        }
+    }
+
+    // Функция для выбора соперника: другой игрок или компьютер на сервере
+    bool getComputerOpponent() {
+        while (true) {
+            std::string answer = getTrimmedInput("Play against the computer? (y/n) [n]: ");
+
+            if (answer.empty() || answer == "n" || answer == "N") {
+                return false;
+            }
+            if (answer == "y" || answer == "Y") {
+                return true;
+            }
+
+            std::cout << "Please answer y or n\n";
+        }
+    }
 }
 
 // Класс для инициализации и очистки Winsock
@@ -174,29 +369,113 @@ bool safeSend(SOCKET socket, const std::string& data) {
     return true;
 }
 
-// Безопасный прием данных
-bool safeRecv(SOCKET socket, std::vector<char>& buffer, int& bytesReceived) {
-    bytesReceived = recv(socket, buffer.data(), static_cast<int>(buffer.size()) - 1, 0);
+// Буферизованное чтение потока от сервера. Данные копятся в кольцевом
+// буфере, пока не наберется целая строка или кадр, поэтому сообщения,
+// склеенные или разбитые TCP на сегменты, разбираются корректно.
+class StreamReader {
+public:
+    explicit StreamReader(SOCKET s)
+        : sock(s), data(BUFFER_SIZE), head(0), tail(0) {
+    }
 
-    if (bytesReceived == SOCKET_ERROR) {
-        int error = WSAGetLastError();
-        if (error == WSAETIMEDOUT) {
-            std::cerr << "Receive timeout\n";
+    size_t size() const { return tail - head; }
+
+    // Блокирующее чтение очередной порции данных в свободное место буфера
+    bool fill() {
+        size_t start = tail % data.size();
+        size_t space = std::min(data.size() - size(), data.size() - start);
+        if (space == 0) {
+            std::cerr << "Server message is too long\n";
+            return false;
         }
-        else {
-            std::cerr << "Receive failed: " << error << "\n";
+
+        int bytesReceived = recv(sock, data.data() + start, static_cast<int>(space), 0);
+
+        if (bytesReceived == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error == WSAETIMEDOUT) {
+                std::cerr << "Receive timeout\n";
+            }
+            else {
+                std::cerr << "Receive failed: " << error << "\n";
+            }
+            return false;
         }
-        return false;
+
+        if (bytesReceived == 0) {
+            std::cout << "Server disconnected gracefully\n";
+            return false;
+        }
+
+        tail += bytesReceived;
+        return true;
     }
 
-    if (bytesReceived == 0) {
-        std::cout << "Server disconnected gracefully\n";
+    // Извлекает завершенную строку без \r и \n
+    bool nextLine(std::string& line) {
+        for (size_t i = 0; i < size(); i++) {
+            if (at(i) == '\n') {
+                line = take(i);
+                consume(1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                return true;
+            }
+        }
         return false;
     }
 
-    buffer[bytesReceived] = '\0';
-    return true;
-}
+    // Извлекает завершенный кадр бинарного протокола
+    bool nextFrame(uint8_t& opcode, std::string& payload) {
+        if (size() < Protocol::FRAME_HEADER_SIZE) return false;
+
+        size_t length = (static_cast<uint8_t>(at(0)) << 8) | static_cast<uint8_t>(at(1));
+        if (size() < Protocol::FRAME_HEADER_SIZE + length) return false;
+
+        opcode = static_cast<uint8_t>(at(2));
+        consume(Protocol::FRAME_HEADER_SIZE);
+        payload = take(length);
+        return true;
+    }
+
+    // Непрочитанный остаток заканчивается строкой suffix (приглашение без перевода строки)
+    bool endsWith(const std::string& suffix) const {
+        if (size() < suffix.size()) return false;
+        for (size_t i = 0; i < suffix.size(); i++) {
+            if (at(size() - suffix.size() + i) != suffix[i]) return false;
+        }
+        return true;
+    }
+
+    std::string takeAll() {
+        return take(size());
+    }
+
+private:
+    SOCKET sock;
+    std::vector<char> data;
+    size_t head;
+    size_t tail;
+
+    char at(size_t offset) const {
+        return data[(head + offset) % data.size()];
+    }
+
+    void consume(size_t length) {
+        head += length;
+    }
+
+    std::string take(size_t length) {
+        std::string result;
+        result.reserve(length);
+        for (size_t i = 0; i < length; i++) {
+            result += at(i);
+        }
+        consume(length);
+        return result;
+    }
+};
 
 // Проверка формата хода
 bool validateMoveFormat(const std::string& move) {
@@ -218,14 +497,14 @@ bool validateMoveFormat(const std::string& move) {
 // Получение и валидация хода от пользователя
 std::string getValidatedMove() {
     while (true) {
-        std::string move = InputUtils::getTrimmedInput("\nEnter your move (x y) or 'quit' to exit: ");
+        std::string move = InputUtils::getTrimmedInput("\nEnter your move (x y), 'sync' to redraw boards or 'quit' to exit: ");
 
         if (move.empty()) {
             std::cout << "Empty input. Please enter coordinates.\n";
             continue;
         }
 
-        if (move == "quit" || move == "exit") {
+        if (move == "quit" || move == "exit" || move == "sync") {
             return move;
         }
 
@@ -258,25 +537,99 @@ bool handleYourTurn(SOCKET clientSocket, const std::string& message) {
     return true;
 }
 
-// Обработка хода противника
-bool handleOpponentTurn(SOCKET clientSocket, const std::string& message) {
-    std::cout << message;
+// Запрашивает ход и отправляет его кадром OP_SHOT. false - игрок решил выйти;
+// ошибка отправки клиента не завершает: обрыв заметит следующее чтение,
+// после чего клиент попробует вернуться в партию
+bool sendBinaryMove(SOCKET clientSocket) {
+    while (true) {
+        std::string move = getValidatedMove();
+        if (move == "quit" || move == "exit") {
+            return false;
+        }
 
-    std::vector<char> resultBuf(512);
-    int resultReceived;
+        // Запрос полного состояния полей; сервер ответит снимком и повторит ход
+        if (move == "sync") {
+            safeSend(clientSocket, Protocol::frame(Protocol::OP_SYNC, std::string()));
+            return true;
+        }
 
-    if (!safeRecv(clientSocket, resultBuf, resultReceived)) {
-        return false;
+        int x, y;
+        std::istringstream iss(move);
+        iss >> x >> y;
+        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+            std::cout << "Coordinates must be between 0 and " << BOARD_SIZE - 1 << ".\n";
+            continue;
+        }
+
+        std::string payload(1, static_cast<char>(y * BOARD_SIZE + x));
+        safeSend(clientSocket, Protocol::frame(Protocol::OP_SHOT, payload));
+        return true;
     }
+}
 
-    std::cout << "Result: " << resultBuf.data();
-    return true;
+// Обработка одного кадра бинарного протокола; false - завершить работу клиента
+bool handleFrame(SOCKET clientSocket, uint8_t opcode, const std::string& payload,
+    BoardView& ownBoard, BoardView& enemyView, std::string& resumeToken) {
+    switch (opcode) {
+    case Protocol::OP_TEXT:
+    case Protocol::OP_ERROR:
+        std::cout << payload;
+        return true;
+
+    case Protocol::OP_BOARD:
+        ownBoard.unpack(payload, 0);
+        std::cout << "Your ships have been placed automatically:\n" << ownBoard.toString() << "\n";
+        return true;
+
+    case Protocol::OP_SNAPSHOT:
+        enemyView.unpack(payload, ownBoard.unpack(payload, 0));
+        return true;
+
+    case Protocol::OP_DELTA:
+        enemyView.applyDelta(payload, ownBoard.applyDelta(payload, 0));
+        return true;
+
+    case Protocol::OP_RESUME_TOKEN:
+        resumeToken = payload;
+        return true;
+
+    case Protocol::OP_TURN: {
+        if (payload.empty()) return true;
+        bool yourTurn = payload[0] != 0;
+
+        std::cout << (yourTurn ? "YOUR_TURN\n" : "OPPONENT_TURN\n");
+        std::cout << "Your board:\n" << ownBoard.toString() << "\n";
+        std::cout << "Enemy view:\n" << enemyView.toString() << "\n";
+        if (!yourTurn) {
+            std::cout << "Waiting for opponent's move...\n";
+            return true;
+        }
+        return sendBinaryMove(clientSocket);
+    }
+
+    case Protocol::OP_RESULT:
+        if (payload.size() >= 3) {
+            int cell = static_cast<uint8_t>(payload[1]);
+            std::cout << (payload[0] ? "You" : "Opponent") << " shot at (" << cell % BOARD_SIZE << ","
+                << cell / BOARD_SIZE << ") - " << Protocol::shotResultText(payload[2]) << "\n";
+        }
+        return true;
+
+    case Protocol::OP_GAME_OVER:
+        if (!payload.empty()) {
+            std::cout << payload.substr(1);
+        }
+        return false;
+
+    default:
+        return true;
+    }
 }
 
 // Класс для соединения с сервером
 class ServerConnector {
 public:
-    static bool connectToServer(SocketRAII& clientSocket, const std::string& serverIP, int port) {
+    static bool connectToServer(SocketRAII& clientSocket, const std::string& serverIP, int port, bool verbose = true) {
         // Создаем сокет
         clientSocket = SocketRAII(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
         if (!clientSocket.isValid()) {
@@ -285,7 +638,11 @@ public:
         }
 
         // Устанавливаем таймаут приема данных
+#ifdef _WIN32
         DWORD timeout = RECV_TIMEOUT_MS;
+#else
+        timeval timeout{ RECV_TIMEOUT_MS / 1000, (RECV_TIMEOUT_MS % 1000) * 1000 };
+#endif
         if (setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO,
             reinterpret_cast<const char*>(&timeout), sizeof(timeout)) == SOCKET_ERROR) {
             std::cerr << "Warning: Failed to set socket timeout: " << WSAGetLastError() << "\n";
@@ -306,27 +663,438 @@ public:
             }
         }
 
-        std::cout << "Connecting to server " << serverIP << ":" << port << "...\n";
+        if (verbose) {
+            std::cout << "Connecting to server " << serverIP << ":" << port << "...\n";
+        }
 
         // Устанавливаем соединение
         if (connect(clientSocket, reinterpret_cast<SOCKADDR*>(&serverAddr), sizeof(serverAddr)) == SOCKET_ERROR) {
-            std::cerr << "Connect failed: " << WSAGetLastError() << "\n";
-            std::cerr << "Make sure the server is running on " << serverIP << ":" << port << "\n";
+            if (verbose) {
+                std::cerr << "Connect failed: " << WSAGetLastError() << "\n";
+                std::cerr << "Make sure the server is running on " << serverIP << ":" << port << "\n";
+            }
             return false;
         }
 
-        std::cout << "Connected to server successfully.\n";
+        if (verbose) {
+            std::cout << "Connected to server successfully.\n";
+        }
         return true;
     }
+
+    // Новое соединение с командой RESUME вместо оборвавшегося. Место игрока
+    // сервер держит недолго, поэтому попытки идут раз в RECONNECT_DELAY_MS
+    static bool resumeSession(SocketRAII& clientSocket, const std::string& serverIP, int port,
+        const std::string& resumeToken) {
+        for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++) {
+            std::cout << "\nConnection lost. Reconnecting (attempt " << attempt << " of " << RECONNECT_ATTEMPTS << ")...\n";
+            SocketRAII fresh;
+            if (connectToServer(fresh, serverIP, port, false) &&
+                safeSend(fresh, Protocol::RESUME_COMMAND + resumeToken + "\n" + Protocol::BINARY_HELLO)) {
+                clientSocket = std::move(fresh);
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY_MS));
+        }
+        std::cout << "Could not reconnect to the server.\n";
+        return false;
+    }
 };
 
-int main() {
+// Безголовый генератор нагрузки: множество ботов, играющих случайными
+// допустимыми ходами по бинарному протоколу. Все соединения обслуживаются
+// одним потоком через poll; в конце печатаются скорость подключений,
+// время ожидания соперника и время отклика на ход (перцентили).
+class LoadGenerator {
+public:
+    struct Options {
+        std::string serverIP;
+        int port;
+        int connections;
+        int gamesPerBot;
+        int connectBatch;
+        int durationSec;
+        bool vsComputer;
+
+        Options()
+            : serverIP(DEFAULT_SERVER_IP), port(DEFAULT_PORT), connections(1000), gamesPerBot(1),
+            connectBatch(64), durationSec(300), vsComputer(false) {
+        }
+
+        // Аргументы вида --connections=N; false при неизвестном или неверном аргументе
+        bool parse(int argc, char* argv[]) {
+            for (int i = 2; i < argc; i++) {
+                std::string arg = argv[i];
+                size_t equals = arg.find('=');
+                std::string key = arg.substr(0, equals);
+                std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+
+                if (key == "--host") {
+                    serverIP = value;
+                    continue;
+                }
+                if (arg == "--vs-computer") {
+                    vsComputer = true;
+                    continue;
+                }
+
+                int* target = key == "--port" ? &port :
+                    key == "--connections" ? &connections :
+                    key == "--games" ? &gamesPerBot :
+                    key == "--batch" ? &connectBatch :
+                    key == "--duration" ? &durationSec : nullptr;
+                if (!target) return false;
+
+                try {
+                    *target = std::stoi(value);
+                }
+                catch (const std::exception&) {
+                    return false;
+                }
+                if (*target <= 0) return false;
+            }
+            return true;
+        }
+
+        static void printUsage() {
+            std::cout << "Usage: NavalBattle_client --loadgen [options]\n";
+            std::cout << "  --host=IP          Server address (default " << DEFAULT_SERVER_IP << ")\n";
+            std::cout << "  --port=PORT        Server port (default " << DEFAULT_PORT << ")\n";
+            std::cout << "  --connections=N    Concurrent bots (default 1000)\n";
+            std::cout << "  --games=N          Games per bot, reconnecting between games (default 1)\n";
+            std::cout << "  --batch=N          New connections per loop iteration (default 64)\n";
+            std::cout << "  --duration=SEC     Stop after this many seconds (default 300)\n";
+            std::cout << "  --vs-computer      Each bot plays against the server's computer opponent\n";
+        }
+    };
+
+    explicit LoadGenerator(const Options& loadOptions)
+        : options(loadOptions), bots(loadOptions.connections), nextToConnect(0),
+        connected(0), failedConnects(0), gamesFinished(0), gamesAborted(0), phaseConnects(0) {
+    }
+
+    int run() {
+        raiseDescriptorLimit();
+
+        std::cout << "Load test: " << options.connections << " bots x " << options.gamesPerBot
+            << " games against " << options.serverIP << ":" << options.port << "\n";
+
+        started = Clock::now();
+        Clock::time_point deadline = started + std::chrono::seconds(options.durationSec);
+
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        while (Clock::now() < deadline) {
+            connectBatch();
+
+            fds.clear();
+            owners.clear();
+            for (size_t i = 0; i < bots.size(); i++) {
+                Bot& bot = bots[i];
+                if (!bot.socket.isValid()) continue;
+
+                pollfd entry{};
+                entry.fd = bot.socket;
+                entry.events = POLLIN | (bot.output.empty() ? 0 : POLLOUT);
+                fds.push_back(entry);
+                owners.push_back(i);
+            }
+
+            if (fds.empty() && nextToConnect >= bots.size()) break;
+
+            // Пока подключаются новые боты, poll не должен их задерживать
+            int timeout = nextToConnect < bots.size() ? 0 : 100;
+            int ready = pollSockets(fds.data(), fds.size(), timeout);
+            if (ready < 0) {
+                std::cerr << "poll failed: " << WSAGetLastError() << "\n";
+                break;
+            }
+
+            for (size_t i = 0; i < fds.size() && ready > 0; i++) {
+                if (!fds[i].revents) continue;
+                ready--;
+
+                Bot& bot = bots[owners[i]];
+                bool alive = true;
+                if (fds[i].revents & POLLOUT) alive = flush(bot);
+                if (alive && (fds[i].revents & (POLLIN | POLLERR | POLLHUP))) alive = receive(bot);
+                if (!alive) finishBot(bot, false);
+            }
+        }
+
+        printReport(std::chrono::duration<double>(Clock::now() - started).count());
+        return 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Bot {
+        SocketRAII socket;
+        std::string input;
+        std::string output;
+        bool binary;
+        bool matched;
+        bool awaitingTurn;
+        int gamesLeft;
+        std::vector<uint8_t> shots;
+        size_t nextShot;
+        Clock::time_point connectStarted;
+        Clock::time_point shotSent;
+
+        Bot() : binary(false), matched(false), awaitingTurn(false), gamesLeft(0), nextShot(0) {}
+    };
+
+    Options options;
+    std::vector<Bot> bots;
+    size_t nextToConnect;
+    size_t connected;
+    size_t failedConnects;
+    size_t gamesFinished;
+    size_t gamesAborted;
+    size_t phaseConnects;
+    Clock::time_point started;
+    Clock::time_point connectPhaseEnd;
+    std::vector<uint32_t> matchMicros;
+    std::vector<uint32_t> turnMicros;
+    std::mt19937 random{ std::random_device{}() };
+
+    static int pollSockets(pollfd* fds, size_t count, int timeoutMs) {
+#ifdef _WIN32
+        return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs);
+#else
+        return poll(fds, static_cast<nfds_t>(count), timeoutMs);
+#endif
+    }
+
+    static bool setNonBlocking(SOCKET socket) {
+#ifdef _WIN32
+        u_long mode = 1;
+        return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+        int flags = fcntl(socket, F_GETFL, 0);
+        return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+#endif
+    }
+
+    static bool isWouldBlock(int error) {
+#ifdef _WIN32
+        return error == WSAEWOULDBLOCK;
+#else
+        return error == EWOULDBLOCK || error == EAGAIN;
+#endif
+    }
+
+    static uint32_t microsSince(Clock::time_point start) {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    }
+
+    // Каждому боту нужен дескриптор; стандартного лимита (1024) на тысячи ботов не хватает
+    static void raiseDescriptorLimit() {
+#ifndef _WIN32
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+#endif
+    }
+
+    // Подключает очередную порцию ботов через ServerConnector
+    void connectBatch() {
+        for (int i = 0; i < options.connectBatch && nextToConnect < bots.size(); i++) {
+            Bot& bot = bots[nextToConnect++];
+            bot.gamesLeft = options.gamesPerBot;
+            if (!startGame(bot)) {
+                failedConnects++;
+            }
+            if (nextToConnect == bots.size()) {
+                connectPhaseEnd = Clock::now();
+                phaseConnects = connected;
+            }
+        }
+    }
+
+    bool startGame(Bot& bot) {
+        bot.connectStarted = Clock::now();
+        if (!ServerConnector::connectToServer(bot.socket, options.serverIP, options.port, false) ||
+            !setNonBlocking(bot.socket)) {
+            bot.socket.close();
+            return false;
+        }
+        connected++;
+
+        bot.input.clear();
+        bot.output = options.vsComputer ? Protocol::COMPUTER_COMMAND + Protocol::BINARY_HELLO : Protocol::BINARY_HELLO;
+        bot.binary = false;
+        bot.matched = false;
+        bot.awaitingTurn = false;
+        bot.shots.resize(BOARD_SIZE * BOARD_SIZE);
+        for (size_t cell = 0; cell < bot.shots.size(); cell++) {
+            bot.shots[cell] = static_cast<uint8_t>(cell);
+        }
+        std::shuffle(bot.shots.begin(), bot.shots.end(), random);
+        bot.nextShot = 0;
+        return flush(bot);
+    }
+
+    // Партия бота закончилась; при необходимости он подключается к следующей
+    void finishBot(Bot& bot, bool completed) {
+        bot.socket.close();
+        if (completed) gamesFinished++;
+        else gamesAborted++;
+
+        if (--bot.gamesLeft > 0 && !startGame(bot)) {
+            failedConnects++;
+        }
+    }
+
+    bool flush(Bot& bot) {
+        while (!bot.output.empty()) {
+            int sent = send(bot.socket, bot.output.data(), static_cast<int>(bot.output.size()), 0);
+            if (sent == SOCKET_ERROR) {
+                return isWouldBlock(WSAGetLastError());
+            }
+            bot.output.erase(0, sent);
+        }
+        return true;
+    }
+
+    bool receive(Bot& bot) {
+        // Сервер закрывает соединение сразу после итогов партии, поэтому
+        // полученные вместе с закрытием данные все равно разбираются
+        char buffer[BUFFER_SIZE];
+        bool closed = false;
+        while (true) {
+            int received = recv(bot.socket, buffer, sizeof(buffer), 0);
+            if (received == 0) {
+                closed = true;
+                break;
+            }
+            if (received == SOCKET_ERROR) {
+                if (isWouldBlock(WSAGetLastError())) break;
+                return false;
+            }
+            bot.input.append(buffer, received);
+        }
+
+        size_t offset = 0;
+        if (!bot.binary) {
+            // До подтверждения сервер говорит текстом; приветствие пропускаем
+            size_t end;
+            while (!bot.binary && (end = bot.input.find('\n', offset)) != std::string::npos) {
+                bot.binary = bot.input.compare(offset, end + 1 - offset, Protocol::BINARY_ACCEPTED) == 0;
+                offset = end + 1;
+            }
+        }
+
+        bool alive = true;
+        while (bot.binary && bot.input.size() - offset >= Protocol::FRAME_HEADER_SIZE) {
+            size_t length = (static_cast<uint8_t>(bot.input[offset]) << 8) | static_cast<uint8_t>(bot.input[offset + 1]);
+            if (bot.input.size() - offset < Protocol::FRAME_HEADER_SIZE + length) break;
+
+            uint8_t opcode = static_cast<uint8_t>(bot.input[offset + 2]);
+            const char* payload = bot.input.data() + offset + Protocol::FRAME_HEADER_SIZE;
+            offset += Protocol::FRAME_HEADER_SIZE + length;
+
+            if (opcode == Protocol::OP_GAME_OVER) {
+                bot.input.clear();
+                finishBot(bot, length > 0 && payload[0] != 2);
+                return true;
+            }
+            alive = handleFrame(bot, opcode, payload, length);
+            if (!alive) break;
+        }
+
+        bot.input.erase(0, offset);
+        return alive && !closed && flush(bot);
+    }
+
+    bool handleFrame(Bot& bot, uint8_t opcode, const char* payload, size_t length) {
+        switch (opcode) {
+        case Protocol::OP_BOARD:
+            if (!bot.matched) {
+                bot.matched = true;
+                matchMicros.push_back(microsSince(bot.connectStarted));
+            }
+            return true;
+
+        // Время отклика - от отправки выстрела до кадра OP_TURN, которым сервер
+        // завершает обработку хода (результат и изменения полей приходят раньше)
+        case Protocol::OP_TURN:
+            if (bot.awaitingTurn) {
+                bot.awaitingTurn = false;
+                turnMicros.push_back(microsSince(bot.shotSent));
+            }
+            if (length < 1 || !payload[0]) return true;
+            if (bot.nextShot >= bot.shots.size()) return false;
+
+            bot.output += Protocol::frame(Protocol::OP_SHOT, std::string(1, static_cast<char>(bot.shots[bot.nextShot++])));
+            bot.shotSent = Clock::now();
+            bot.awaitingTurn = true;
+            return true;
+
+        default:
+            return true;
+        }
+    }
+
+    static uint32_t percentile(std::vector<uint32_t>& samples, double p) {
+        if (samples.empty()) return 0;
+        size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+        std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank];
+    }
+
+    void printReport(double seconds) {
+        double connectSeconds = std::chrono::duration<double>(connectPhaseEnd - started).count();
+
+        std::cout << "\n=== Load test results ===\n";
+        std::cout << "Connections: " << connected << " (failed " << failedConnects << "), initial "
+            << phaseConnects << " in " << connectSeconds * 1000 << " ms: "
+            << static_cast<long long>(phaseConnects / std::max(connectSeconds, 1e-3)) << " connects/sec\n";
+        std::cout << "Games: " << gamesFinished << " finished, " << gamesAborted << " aborted in "
+            << seconds << " s (" << gamesFinished / std::max(seconds, 1e-3) / (options.vsComputer ? 1 : 2)
+            << " games/sec)\n";
+        std::cout << "Time to match (ms): p50 " << percentile(matchMicros, 50) / 1000.0
+            << ", p99 " << percentile(matchMicros, 99) / 1000.0
+            << ", p999 " << percentile(matchMicros, 99.9) / 1000.0
+            << " (" << matchMicros.size() << " samples)\n";
+        std::cout << "Turn round trip (us): p50 " << percentile(turnMicros, 50)
+            << ", p99 " << percentile(turnMicros, 99)
+            << ", p999 " << percentile(turnMicros, 99.9)
+            << " (" << turnMicros.size() << " samples)\n";
+        std::cout << "=========================\n";
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--loadgen") {
+        LoadGenerator::Options options;
+        if (!options.parse(argc, argv)) {
+            LoadGenerator::Options::printUsage();
+            return 1;
+        }
+
+        try {
+            WSAInitializer wsaInit;
+            return LoadGenerator(options).run();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Fatal error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
     try {
         std::cout << "=== Sea Battle Client ===\n\n";
 
         // Получаем параметры подключения от пользователя
         std::string serverIP = InputUtils::getServerIP();
         int serverPort = InputUtils::getServerPort();
+        std::string playerName = InputUtils::getPlayerName();
+        std::string watchCommand = InputUtils::getWatchCommand();
+        bool computerOpponent = watchCommand.empty() && InputUtils::getComputerOpponent();
 
         std::cout << "\nConnecting to " << serverIP << ":" << serverPort << "...\n";
 
@@ -344,35 +1112,86 @@ int main() {
             return 1;
         }
 
-        // Основной цикл работы клиента
-        std::vector<char> buffer(BUFFER_SIZE);
-        bool running = true;
+        if (!playerName.empty() && !safeSend(clientSocket, Protocol::NAME_COMMAND + playerName + "\n")) {
+            std::cout << "\nFailed to send player name.\n";
+        }
 
-        while (running) {
-            int bytesReceived;
+        if (computerOpponent && !safeSend(clientSocket, Protocol::COMPUTER_COMMAND)) {
+            std::cout << "\nFailed to request a computer opponent.\n";
+        }
 
-            if (!safeRecv(clientSocket, buffer, bytesReceived)) {
-                break;
+        // Запрашиваем бинарный протокол; до подтверждения сервер говорит текстом,
+        // поэтому со старым сервером клиент продолжит работать по текстовому протоколу.
+        // Зрители всегда получают текст
+        if (!watchCommand.empty()) {
+            if (!safeSend(clientSocket, watchCommand)) {
+                std::cout << "\nFailed to send watch request.\n";
             }
+        }
+        else if (!safeSend(clientSocket, Protocol::BINARY_HELLO)) {
+            std::cout << "\nFailed to send protocol request.\n";
+        }
+
+        // Основной цикл работы клиента
+        StreamReader reader(clientSocket);
+        bool running = true;
+        bool binaryProtocol = false;
+        BoardView ownBoard;
+        BoardView enemyView;
 
-            std::string message(buffer.data());
+        // Токен для возвращения в партию; resuming - клиент переподключился,
+        // и приветствие нового соединения не показывается
+        std::string resumeToken;
+        bool resuming = false;
 
-            if (message.find("YOUR_TURN") != std::string::npos) {
-                if (!handleYourTurn(clientSocket, message)) {
-                    running = false;
+        while (running) {
+            if (binaryProtocol) {
+                uint8_t opcode;
+                std::string payload;
+                if (reader.nextFrame(opcode, payload)) {
+                    running = handleFrame(clientSocket, opcode, payload, ownBoard, enemyView, resumeToken);
+                    continue;
                 }
             }
-            else if (message.find("OPPONENT_TURN") != std::string::npos) {
-                if (!handleOpponentTurn(clientSocket, message)) {
-                    running = false;
+            else {
+                std::string line;
+                if (reader.nextLine(line)) {
+                    // Все, что пришло после подтверждения, - уже кадры
+                    if (line + "\n" == Protocol::BINARY_ACCEPTED) {
+                        binaryProtocol = true;
+                        continue;
+                    }
+                    if (line.compare(0, Protocol::RESUME_TOKEN_LINE.size(), Protocol::RESUME_TOKEN_LINE) == 0) {
+                        resumeToken = line.substr(Protocol::RESUME_TOKEN_LINE.size());
+                        continue;
+                    }
+                    if (resuming) continue;
+
+                    std::cout << line << "\n";
+                    if (line.compare(0, 9, "GAME_OVER") == 0) {
+                        running = false;
+                    }
+                    continue;
+                }
+
+                // Приглашение сделать ход приходит без перевода строки
+                if (reader.endsWith(TEXT_TURN_PROMPT)) {
+                    if (!handleYourTurn(clientSocket, reader.takeAll())) {
+                        running = false;
+                    }
+                    continue;
                 }
             }
-            else if (message.find("GAME_OVER") != std::string::npos) {
-                std::cout << message;
-                running = false;
-            }
-            else {
-                std::cout << message;
+
+            if (!reader.fill()) {
+                // Соединение оборвалось посреди партии: новое соединение занимает
+                // место игрока, и сервер присылает оба поля и текущий ход
+                if (resumeToken.empty() || !ServerConnector::resumeSession(clientSocket, serverIP, serverPort, resumeToken)) {
+                    break;
+                }
+                reader = StreamReader(clientSocket);
+                binaryProtocol = false;
+                resuming = true;
             }
         }
 
@@ -1,8 +1,33 @@
+#ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #define NOMINMAX 
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
 #include <iostream>
 #include <cstdlib>
 #include <string>
@@ -12,14 +37,87 @@
 #include <functional>
 #include <random>
 #include <limits>
-#include <queue>
 #include <map>
+#include <deque>
+#include <set>
+#include <unordered_map>
 #include <atomic>
 #include <chrono>
 #include <mutex>
-
+#include <condition_variable>
+#include <future>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cmath>
+#include <memory>
+#include <new>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
 
+const int SEND_FLAGS = 0;
+#else
+// Совместимость с WinSock API на POSIX-системах
+typedef int SOCKET;
+typedef sockaddr SOCKADDR;
+struct WSADATA {};
+
+const SOCKET INVALID_SOCKET = -1;
+const int SOCKET_ERROR = -1;
+const int SD_BOTH = SHUT_RDWR;
+const int WSAEWOULDBLOCK = EWOULDBLOCK;
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+#define MAKEWORD(a, b) ((a) | ((b) << 8))
+
+inline int WSAStartup(int, WSADATA*) { return 0; }
+inline int WSACleanup() { return 0; }
+inline int WSAGetLastError() { return errno; }
+inline int closesocket(SOCKET socket) { return close(socket); }
+#endif
+
+// Перевод сокета в неблокирующий режим
+bool setNonBlocking(SOCKET socket) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Операция не может быть выполнена без блокировки - нужно дождаться готовности сокета
+bool isWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+}
+
+// Системный вызов прерван сигналом и может быть повторен
+bool isInterrupted(int error) {
+#ifdef _WIN32
+    return error == WSAEINTR;
+#else
+    return error == EINTR;
+#endif
+}
+
 // Вспомогательные функции для ввода данных
 namespace InputUtils {
     std::string getTrimmedInput(const std::string& prompt = "") {
@@ -75,798 +173,7477 @@ namespace InputUtils {
     }
 }
 
-// Константы игры
-const int BOARD_SIZE = 10;
-const int SHIP_SIZES[] = { 4, 3, 3, 2, 2, 2, 1, 1, 1, 1 };
-const int NUM_SHIPS = 10;
+// Константы игры (размеры поля и флота - см. GameRules)
 const int BUFFER_SIZE = 256;
 const int MAX_PLAYER_NAME = 32;
 
-bool safeSend(SOCKET socket, const std::string& data);
-void safeCloseSocket(SOCKET& socket);
-bool safeRecv(SOCKET socket, std::string& data, int maxSize);
-
-// Состояния клетки на игровом поле
-enum CellState {
-    EMPTY = 0,
-    SHIP = 1,
-    HIT = 2,
-    MISS = 3,
-    SUNK = 4
-};
-
-// Структура корабля
-struct Ship {
-    int size;
-    int hits;
-    bool horizontal;
-    int x, y;
-
-    bool isSunk() const { return hits >= size; }
-};
-
-// Класс игрока
-class Player {
+// Константы цикла событий
+const size_t INPUT_BUFFER_SIZE = 4096;
+const size_t OUTPUT_CHUNK_SIZE = 4096 - sizeof(size_t);
+const size_t OUTPUT_POOL_CHUNKS = 1024;           // свободных блоков на поток
+const size_t OUTPUT_HIGH_WATER_BYTES = 64 * 1024;  // выше - ввод клиента не читается
+const size_t OUTPUT_LIMIT_BYTES = 256 * 1024;      // выше - клиент отключается
+const int MAX_POLL_EVENTS = 256;
+const int POLL_TIMEOUT_MS = 100;
+const int TURN_TIMEOUT_MS = 30000;
+const int SETUP_TIMEOUT_MS = 10000;
+const int QUEUE_TIMEOUT_MS = 300000;
+const int CLOSE_LINGER_MS = 5000;
+const int NEGOTIATION_TIMEOUT_MS = 250;
+
+// Игрок, потерявший соединение во время партии, может вернуться в нее по токену
+// в течение RESUME_GRACE_MS; до тех пор его место в партии не освобождается
+const int RESUME_GRACE_MS = 20000;
+const size_t MAX_RESUME_TOKEN = 40;
+
+// Константы рейтинга и матчмейкинга
+const int DEFAULT_RATING = 1200;
+const int ELO_K_FACTOR = 32;
+const int RATING_BUCKET_WIDTH = 25;
+const int RATING_BUCKETS = 128;
+const int MATCH_WINDOW_BUCKETS = 2;
+const int MATCH_WINDOW_WIDEN_MS = 500;
+const int MATCH_RECHECK_PER_TICK = 32;
+
+// Зрители: отправка их очередей идет после игроков и не больше
+// SPECTATOR_FLUSHES_PER_TICK соединений за итерацию, остальные ждут следующей
+const size_t SPECTATOR_FLUSHES_PER_TICK = 256;
+
+// Шарды сервера: у каждого свой цикл событий, игроки и очередь ожидания.
+// Игрок, которому за MATCH_STEAL_AFTER_MS не нашлось соперника в своем шарде,
+// переходит в шард с меньшим номером, где тоже кто-то ждет
+const int MAX_SHARDS = 64;
+const int MATCH_STEAL_AFTER_MS = 50;
+
+// Константы журнала партий
+const char* const DEFAULT_JOURNAL_DIR = "journal";
+const size_t JOURNAL_FLUSH_BYTES = 64 * 1024;
+const int JOURNAL_FLUSH_INTERVAL_MS = 1000;
+const uint64_t JOURNAL_SEGMENT_BYTES = 64ULL * 1024 * 1024;
+
+// Контрольная точка идущих партий: файл по умолчанию и период записи
+const char* const DEFAULT_CHECKPOINT_FILE = "checkpoint.nbc";
+const int CHECKPOINT_INTERVAL_MS = 5000;
+
+// Партий каждой пары ботов в турнире по умолчанию (--tournament, /tournament)
+const uint64_t DEFAULT_TOURNAMENT_GAMES = 10000;
+
+// Файл выгрузки трассировки по умолчанию (команда /trace)
+const char* const DEFAULT_TRACE_FILE = "trace.json";
+
+// Обертка над механизмом ожидания готовности сокетов.
+// На Linux используется epoll в edge-triggered режиме, на остальных
+// платформах - WSAPoll/poll (level-triggered). Обработчики в обоих случаях
+// читают и пишут до WSAEWOULDBLOCK, поэтому работают с любым вариантом.
+class Poller {
 public:
-    SOCKET socket;
-    std::vector<std::vector<CellState>> board;
-    std::vector<std::vector<CellState>> enemyView;
-    std::vector<Ship> ships;
-    bool ready;
-    std::string name;
-    bool connected;
-    int playerId;
-    sockaddr_in clientAddr;
+    struct Event {
+        void* token;
+        bool readable;
+        bool writable;
+        bool error;
+    };
+
+    Poller() {
+#ifdef __linux__
+        epollFd = -1;
+#endif
+    }
 
-    Player(SOCKET sock, const sockaddr_in& addr, int id)
-        : socket(sock), ready(false), connected(true), playerId(id), clientAddr(addr) {
-        board.resize(BOARD_SIZE, std::vector<CellState>(BOARD_SIZE, EMPTY));
-        enemyView.resize(BOARD_SIZE, std::vector<CellState>(BOARD_SIZE, EMPTY));
-        name = "Player " + std::to_string(id);
+    ~Poller() {
+        close();
     }
 
-    ~Player() {
-        disconnect();
+    bool open() {
+#ifdef __linux__
+        epollFd = epoll_create1(0);
+        return epollFd != -1;
+#else
+        return true;
+#endif
     }
 
-    void disconnect() {
-        if (connected) {
-            connected = false;
-            safeCloseSocket(socket);
+    void close() {
+#ifdef __linux__
+        if (epollFd != -1) {
+            ::close(epollFd);
+            epollFd = -1;
         }
+#else
+        fds.clear();
+        tokens.clear();
+        indexBySocket.clear();
+#endif
     }
 
-    std::string getIPAddress() const {
-        char ipStr[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, INET_ADDRSTRLEN);
-        return std::string(ipStr);
+    // Регистрирует сокет; token возвращается в событиях этого сокета
+    bool add(SOCKET socket, void* token, bool edgeTriggered = true) {
+#ifdef __linux__
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        if (edgeTriggered) {
+            ev.events |= EPOLLOUT | EPOLLET;
+        }
+        ev.data.ptr = token;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &ev) == 0;
+#else
+        (void)edgeTriggered;
+        pollfd pfd{};
+        pfd.fd = socket;
+        pfd.events = POLLIN;
+        indexBySocket[socket] = fds.size();
+        fds.push_back(pfd);
+        tokens.push_back(token);
+        return true;
+#endif
     }
 
-    int getPort() const {
-        return ntohs(clientAddr.sin_port);
+    void remove(SOCKET socket) {
+#ifdef __linux__
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
+#else
+        auto it = indexBySocket.find(socket);
+        if (it == indexBySocket.end()) return;
+
+        size_t index = it->second;
+        size_t last = fds.size() - 1;
+        if (index != last) {
+            fds[index] = fds[last];
+            tokens[index] = tokens[last];
+            indexBySocket[fds[index].fd] = index;
+        }
+        fds.pop_back();
+        tokens.pop_back();
+        indexBySocket.erase(it);
+#endif
     }
 
-    bool placeShip(int size, int x, int y, bool horizontal) {
-        if (horizontal) {
-            if (x + size > BOARD_SIZE) return false;
-            for (int i = 0; i < size; i++) {
-                if (board[y][x + i] != EMPTY) return false;
-                for (int dy = -1; dy <= 1; dy++) {
-                    for (int dx = -1; dx <= 1; dx++) {
-                        int nx = x + i + dx;
-                        int ny = y + dy;
-                        if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE &&
-                            board[ny][nx] == SHIP) return false;
-                    }
-                }
-            }
-        }
-        else {
-            if (y + size > BOARD_SIZE) return false;
-            for (int i = 0; i < size; i++) {
-                if (board[y + i][x] != EMPTY) return false;
-                for (int dy = -1; dy <= 1; dy++) {
-                    for (int dx = -1; dx <= 1; dx++) {
-                        int nx = x + dx;
-                        int ny = y + i + dy;
-                        if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE &&
-                            board[ny][nx] == SHIP) return false;
-                    }
-                }
-            }
-        }
+    // Включает ожидание готовности к записи. Для edge-triggered epoll сокет
+    // подписан на EPOLLOUT с момента регистрации, поэтому вызов ничего не делает.
+    void setWriteInterest(SOCKET socket, bool enabled) {
+#ifdef __linux__
+        (void)socket;
+        (void)enabled;
+#else
+        auto it = indexBySocket.find(socket);
+        if (it == indexBySocket.end()) return;
+
+        short& events = fds[it->second].events;
+        events = enabled ? (events | POLLOUT) : (events & ~POLLOUT);
+#endif
+    }
 
-        Ship ship{ size, 0, horizontal, x, y };
-        ships.push_back(ship);
+    int wait(std::vector<Event>& events, int timeoutMs) {
+        events.clear();
+#ifdef __linux__
+        epoll_event ready[MAX_POLL_EVENTS];
+        int count = epoll_wait(epollFd, ready, MAX_POLL_EVENTS, timeoutMs);
+        if (count < 0) {
+            return isInterrupted(errno) ? 0 : -1;
+        }
 
-        if (horizontal) {
-            for (int i = 0; i < size; i++) {
-                board[y][x + i] = SHIP;
-            }
+        for (int i = 0; i < count; i++) {
+            Event ev;
+            ev.token = ready[i].data.ptr;
+            ev.readable = (ready[i].events & (EPOLLIN | EPOLLRDHUP)) != 0;
+            ev.writable = (ready[i].events & EPOLLOUT) != 0;
+            ev.error = (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+            events.push_back(ev);
         }
-        else {
-            for (int i = 0; i < size; i++) {
-                board[y + i][x] = SHIP;
-            }
+        return count;
+#else
+        if (fds.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            return 0;
         }
 
-        return true;
-    }
+#ifdef _WIN32
+        int count = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeoutMs);
+#else
+        int count = ::poll(fds.data(), fds.size(), timeoutMs);
+#endif
+        if (count == SOCKET_ERROR) {
+            return isInterrupted(WSAGetLastError()) ? 0 : -1;
+        }
 
-    void autoPlaceShips() {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, BOARD_SIZE - 1);
-        std::uniform_int_distribution<> dis_bool(0, 1);
+        for (size_t i = 0; i < fds.size() && static_cast<int>(events.size()) < count; i++) {
+            if (fds[i].revents == 0) continue;
 
-        for (int i = 0; i < NUM_SHIPS; i++) {
-            int size = SHIP_SIZES[i];
-            bool placed = false;
-            int attempts = 0;
-            const int MAX_ATTEMPTS = 100;
+            Event ev;
+            ev.token = tokens[i];
+            ev.readable = (fds[i].revents & POLLIN) != 0;
+            ev.writable = (fds[i].revents & POLLOUT) != 0;
+            ev.error = (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+            events.push_back(ev);
+        }
+        return static_cast<int>(events.size());
+#endif
+    }
 
-            while (!placed && attempts < MAX_ATTEMPTS) {
-                int x = dis(gen);
-                int y = dis(gen);
-                bool horizontal = dis_bool(gen) == 1;
+    Poller(const Poller&) = delete;
+    Poller& operator=(const Poller&) = delete;
 
-                placed = placeShip(size, x, y, horizontal);
-                attempts++;
-            }
+private:
+#ifdef __linux__
+    int epollFd;
+#else
+    std::vector<pollfd> fds;
+    std::vector<void*> tokens;
+    std::unordered_map<SOCKET, size_t> indexBySocket;
+#endif
+};
 
-            if (!placed) {
-                board = std::vector<std::vector<CellState>>(BOARD_SIZE, std::vector<CellState>(BOARD_SIZE, EMPTY));
-                ships.clear();
-                i = -1;
-            }
-        }
+// Неблокирующая очередь "много производителей - один потребитель" (алгоритм Вьюкова).
+// Производители из любых потоков добавляют элементы одной атомарной операцией,
+// забирает их только поток цикла событий.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : stub(new Node()), head(stub), tail(stub) {
     }
 
-    bool allShipsSunk() {
-        for (const auto& ship : ships) {
-            if (!ship.isSunk()) return false;
+    ~MpscQueue() {
+        T value;
+        while (pop(value)) {
         }
+        delete tail;
+    }
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Вызывается только потребителем
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
         return true;
     }
 
-    void markMissesAroundSunkShip(const Ship& ship, Player* opponent) {
-        if (ship.horizontal) {
-            for (int i = -1; i <= ship.size; i++) {
-                for (int dy = -1; dy <= 1; dy++) {
-                    int nx = ship.x + i;
-                    int ny = ship.y + dy;
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
 
-                    if (i >= 0 && i < ship.size && dy == 0) continue;
+private:
+    struct Node {
+        std::atomic<Node*> next;
+        T value;
 
-                    if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE) {
-                        if (board[ny][nx] == EMPTY) {
-                            board[ny][nx] = MISS;
-                            opponent->enemyView[ny][nx] = MISS;
-                        }
-                    }
-                }
-            }
-        }
-        else {
-            for (int i = -1; i <= ship.size; i++) {
-                for (int dx = -1; dx <= 1; dx++) {
-                    int nx = ship.x + dx;
-                    int ny = ship.y + i;
+        Node() : next(nullptr), value() {}
+    };
 
-                    if (i >= 0 && i < ship.size && dx == 0) continue;
+    Node* stub;
+    std::atomic<Node*> head;
+    Node* tail;
+};
 
-                    if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE) {
-                        if (board[ny][nx] == EMPTY) {
-                            board[ny][nx] = MISS;
-                            opponent->enemyView[ny][nx] = MISS;
-                        }
-                    }
-                }
-            }
+// Пробуждение цикла событий из другого потока: eventfd на Linux,
+// UDP-сокет, отправляющий датаграммы самому себе, на остальных платформах
+class EventWaker {
+public:
+    EventWaker() : fd(INVALID_SOCKET), pending(false) {
+    }
+
+    ~EventWaker() {
+        close();
+    }
+
+    bool open() {
+#ifdef __linux__
+        fd = eventfd(0, EFD_NONBLOCK);
+        return fd != INVALID_SOCKET;
+#else
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET) return false;
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t addrSize = sizeof(addr);
+        if (bind(fd, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            getsockname(fd, (SOCKADDR*)&addr, &addrSize) == SOCKET_ERROR ||
+            connect(fd, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            !setNonBlocking(fd)) {
+            close();
+            return false;
         }
+        return true;
+#endif
     }
 
-    std::string getBoardString(bool showShips = true) {
-        std::string result = "  0 1 2 3 4 5 6 7 8 9\n";
-        for (int y = 0; y < BOARD_SIZE; y++) {
-            result += std::to_string(y) + ' ';
-            for (int x = 0; x < BOARD_SIZE; x++) {
-                char symbol = '.';
-                if (board[y][x] == HIT) symbol = 'X';
-                else if (board[y][x] == MISS) symbol = 'O';
-                else if (board[y][x] == SUNK) symbol = '#';
-                else if (showShips && board[y][x] == SHIP) symbol = 'S';
-                result += symbol;
-                result += ' ';
-            }
-            result += '\n';
+    void close() {
+        if (fd != INVALID_SOCKET) {
+#ifdef __linux__
+            ::close(fd);
+#else
+            closesocket(fd);
+#endif
+            fd = INVALID_SOCKET;
         }
-        return result;
     }
 
-    std::string getEnemyViewString() {
-        std::string result = "  0 1 2 3 4 5 6 7 8 9\n";
-        for (int y = 0; y < BOARD_SIZE; y++) {
-            result += std::to_string(y) + ' ';
-            for (int x = 0; x < BOARD_SIZE; x++) {
-                char symbol = '.';
-                if (enemyView[y][x] == HIT) symbol = 'X';
-                else if (enemyView[y][x] == MISS) symbol = 'O';
-                else if (enemyView[y][x] == SUNK) symbol = '#';
-                result += symbol;
-                result += ' ';
-            }
-            result += '\n';
+    SOCKET handle() const { return fd; }
+
+    // Повторные вызовы до drain() не порождают лишних системных вызовов
+    void wake() {
+        if (pending.exchange(true, std::memory_order_acq_rel)) return;
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+#else
+        char byte = 1;
+        send(fd, &byte, 1, 0);
+#endif
+    }
+
+    void drain() {
+        pending.store(false, std::memory_order_release);
+#ifdef __linux__
+        uint64_t value;
+        while (read(fd, &value, sizeof(value)) > 0) {
         }
-        return result;
+#else
+        char buffer[64];
+        while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+        }
+#endif
     }
+
+    EventWaker(const EventWaker&) = delete;
+    EventWaker& operator=(const EventWaker&) = delete;
+
+private:
+    SOCKET fd;
+    std::atomic<bool> pending;
 };
 
-// Класс игры
-class Game {
+// Переносимые битовые операции над 64-битными словами
+inline int bitCount64(uint64_t value) {
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(value));
+#else
+    return __builtin_popcountll(value);
+#endif
+}
+
+inline int lowestBit64(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+inline int highestBit64(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Снимок гистограммы: обычные числа, которые можно складывать и разбирать
+struct HistogramSnapshot;
+
+// Гистограмма в стиле HDR: значения до 2^SUB_BUCKET_BITS хранятся точно,
+// дальше на каждую степень двойки приходится 2^SUB_BUCKET_BITS корзин
+// (относительная погрешность не больше 1/32). Пишет один поток обычными
+// load/store без атомарных RMW-операций, читать можно из любого.
+class LatencyHistogram {
 public:
-    Player* player1;
-    Player* player2;
-    bool gameStarted;
-    bool gameOver;
-    Player* currentPlayer;
-    std::atomic<bool> active;
+    static const int SUB_BUCKET_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
 
-    Game(Player* p1, Player* p2)
-        : player1(p1), player2(p2), gameStarted(false), gameOver(false),
-        currentPlayer(p1), active(true) {
+    LatencyHistogram() : total(0), sum(0) {
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            buckets[i] = 0;
+        }
     }
 
-    ~Game() {
-        endGame("Game terminated");
+    void record(uint64_t value) {
+        std::atomic<uint64_t>& bucket = buckets[bucketFor(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
 
-    bool bothReady() {
-        return player1->ready && player2->ready && player1->connected && player2->connected;
-    }
+    void addTo(HistogramSnapshot& snapshot) const;
 
-    void switchTurn() {
-        currentPlayer = (currentPlayer == player1) ? player2 : player1;
+    static int bucketFor(uint64_t value) {
+        if (value < static_cast<uint64_t>(SUB_BUCKETS)) return static_cast<int>(value);
+
+        int magnitude = highestBit64(value);
+        int sub = static_cast<int>((value >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+        return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
     }
 
-    Player* getOpponent() {
-        return (currentPlayer == player1) ? player2 : player1;
+    static uint64_t upperBound(int bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+
+        int level = bucket / SUB_BUCKETS;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        int shift = level - 1;
+        uint64_t next = (SUB_BUCKETS + sub + 1) << shift;
+        return next == 0 ? ~0ULL : next - 1;
     }
 
-    std::string processShot(int x, int y) {
-        Player* opponent = getOpponent();
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+};
 
-        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
-            return "INVALID: Coordinates out of bounds\n";
+struct HistogramSnapshot {
+    uint64_t buckets[LatencyHistogram::BUCKET_COUNT];
+    uint64_t total;
+    uint64_t sum;
+
+    HistogramSnapshot() : total(0), sum(0) {
+        for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+            buckets[i] = 0;
         }
+    }
 
-        std::string result;
-        if (opponent->board[y][x] == SHIP) {
-            opponent->board[y][x] = HIT;
-            currentPlayer->enemyView[y][x] = HIT;
+    // Верхняя граница корзины, в которую попадает перцентиль p (0..100)
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
 
-            for (auto& ship : opponent->ships) {
-                bool shipHit = false;
-                if (ship.horizontal) {
-                    for (int i = 0; i < ship.size; i++) {
-                        if (ship.x + i == x && ship.y == y) {
-                            ship.hits++;
-                            shipHit = true;
-                            break;
-                        }
-                    }
-                }
-                else {
-                    for (int i = 0; i < ship.size; i++) {
-                        if (ship.x == x && ship.y + i == y) {
-                            ship.hits++;
-                            shipHit = true;
-                            break;
-                        }
-                    }
-                }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(total * p / 100.0)));
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return LatencyHistogram::upperBound(i);
+            }
+        }
+        return LatencyHistogram::upperBound(LatencyHistogram::BUCKET_COUNT - 1);
+    }
 
-                if (shipHit && ship.isSunk()) {
-                    if (ship.horizontal) {
-                        for (int i = 0; i < ship.size; i++) {
-                            opponent->board[ship.y][ship.x + i] = SUNK;
-                            currentPlayer->enemyView[ship.y][ship.x + i] = SUNK;
-                        }
-                    }
-                    else {
-                        for (int i = 0; i < ship.size; i++) {
-                            opponent->board[ship.y + i][ship.x] = SUNK;
-                            currentPlayer->enemyView[ship.y + i][ship.x] = SUNK;
-                        }
-                    }
+    // Сколько значений не больше limit (с точностью до корзины)
+    uint64_t countAtMost(uint64_t limit) const {
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKET_COUNT && LatencyHistogram::upperBound(i) <= limit; i++) {
+            seen += buckets[i];
+        }
+        return seen;
+    }
+};
 
-                    opponent->markMissesAroundSunkShip(ship, currentPlayer);
+void LatencyHistogram::addTo(HistogramSnapshot& snapshot) const {
+    // Читатель не останавливает писателя, поэтому total берется первым:
+    // сумма корзин может оказаться чуть больше, но не меньше total
+    uint64_t count = total.load(std::memory_order_acquire);
+    snapshot.total += count;
+    snapshot.sum += sum.load(std::memory_order_relaxed);
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        snapshot.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+    }
+}
 
-                    result = "HIT: Ship sunk!\n";
-                    break;
-                }
-                else if (shipHit) {
-                    result = "HIT\n";
-                    break;
-                }
+// Метрики сервера. Каждый поток пишет в свой блок счетчиков и гистограмм,
+// а /stats и HTTP-эндпоинт Prometheus складывают блоки всех потоков,
+// не останавливая их и не беря блокировок игр или очереди.
+// Блок создается при первом обращении потока; когда поток завершается, блок
+// со всеми значениями достается следующему новому потоку, поэтому пулы
+// /tournament и /analyze не расходуют новые блоки на каждом запуске.
+namespace Metrics {
+    enum Counter {
+        BYTES_SENT,
+        BYTES_RECEIVED,
+        SHOTS,
+        GAMES_STARTED,
+        SEND_CALLS,                 // системные вызовы отправки, приема и ожидания событий
+        RECV_CALLS,
+        POLL_CALLS,
+        DISCONNECT_CLOSED,          // клиент закрыл соединение или ошибка приема
+        DISCONNECT_SEND_FAILED,
+        DISCONNECT_PROTOCOL_ERROR,  // неверный кадр или переполнение входного буфера
+        DISCONNECT_QUEUE_TIMEOUT,
+        DISCONNECT_SETUP_TIMEOUT,
+        DISCONNECT_TURN_TIMEOUT,
+        DISCONNECT_SLOW_CONSUMER,   // клиент не читает, и очередь отправки переполнилась
+        SESSIONS_SUSPENDED,         // игрок потерял соединение, место в партии ждет его
+        SESSIONS_RESUMED,           // игрок вернулся в партию по токену
+        SESSIONS_EXPIRED,           // игрок не вернулся за RESUME_GRACE_MS
+        HEAP_ALLOCATIONS,           // вызовы operator new и выделенные ими байты
+        HEAP_BYTES,
+        COUNTER_COUNT
+    };
+
+    // Все гистограммы - в наносекундах
+    enum Histogram {
+        TURN_PROCESSING,  // обработка хода: выстрел и рассылка результата
+        MATCH_WAIT,       // от подключения до начала игры
+        GAME_SETUP,       // от создания игры до первого хода
+        HISTOGRAM_COUNT
+    };
+
+    const int MAX_THREADS = 256;
+
+    struct ThreadBlock {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        LatencyHistogram histograms[HISTOGRAM_COUNT];
+
+        ThreadBlock() {
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                counters[i] = 0;
             }
         }
-        else {
-            if (opponent->board[y][x] == EMPTY) {
-                opponent->board[y][x] = MISS;
-                currentPlayer->enemyView[y][x] = MISS;
-                result = "MISS\n";
+    };
+
+    std::atomic<ThreadBlock*> blocks[MAX_THREADS];
+    std::atomic<int> blockCount(0);
+
+    // Блоки завершившихся потоков ждут здесь следующий новый поток и
+    // переходят к нему вместе с накопленными значениями
+    std::mutex slotsMutex;
+    int freeSlots[MAX_THREADS];
+    int freeCount = 0;
+
+    // Общий блок под мьютексом: для потоков сверх MAX_THREADS одновременно
+    // живущих и для выделений, которые случаются уже после возврата блока
+    std::mutex sharedMutex;
+    std::atomic<ThreadBlock*> sharedBlock(nullptr);
+
+    thread_local ThreadBlock* threadBlock = nullptr;
+    thread_local bool threadShared = false;
+
+    // Блок выделяется мимо operator new: тот сам считает выделения в этом блоке
+    inline ThreadBlock* newBlock() {
+        void* memory = std::malloc(sizeof(ThreadBlock));
+        if (!memory) std::abort();
+        return new (memory) ThreadBlock();
+    }
+
+    // Возвращает блок в свободные, когда поток завершается
+    struct SlotOwner {
+        int index;
+
+        SlotOwner() : index(-1) {}
+
+        ~SlotOwner() {
+            threadBlock = nullptr;
+            threadShared = true;
+            if (index < 0) return;
+
+            std::lock_guard<std::mutex> lock(slotsMutex);
+            freeSlots[freeCount++] = index;
+        }
+    };
+
+    inline ThreadBlock* claimBlock() {
+        int index = -1;
+        ThreadBlock* block = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(slotsMutex);
+            if (freeCount > 0) {
+                index = freeSlots[--freeCount];
+                block = blocks[index].load(std::memory_order_relaxed);
             }
-            else {
-                result = "MISS: Already attacked this position\n";
+            else if (blockCount.load(std::memory_order_relaxed) < MAX_THREADS) {
+                index = blockCount.load(std::memory_order_relaxed);
+                block = newBlock();
+                blocks[index].store(block, std::memory_order_release);
+                blockCount.store(index + 1, std::memory_order_release);
             }
         }
-
-        if (opponent->allShipsSunk()) {
-            gameOver = true;
+        if (!block) {
+            threadShared = true;
+            return nullptr;
         }
 
-        return result;
+        // Блок назначается до первого обращения к owner: регистрация его
+        // деструктора может сама выделить память и прийти сюда же
+        threadBlock = block;
+        static thread_local SlotOwner owner;
+        owner.index = index;
+        return block;
     }
 
-    bool checkConnections() {
-        if (!player1->connected || !player2->connected) {
-            gameOver = true;
-            return false;
+    // Блок текущего потока или nullptr, если поток пишет в общий блок
+    inline ThreadBlock* local() {
+        ThreadBlock* block = threadBlock;
+        if (!block && !threadShared) {
+            block = claimBlock();
         }
-        return true;
+        return block;
     }
 
-    void endGame(const std::string& reason) {
-        if (!active) return;
+    template <typename Update>
+    void updateShared(Update update) {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        ThreadBlock* block = sharedBlock.load(std::memory_order_relaxed);
+        if (!block) {
+            block = newBlock();
+            sharedBlock.store(block, std::memory_order_release);
+        }
+        update(*block);
+    }
 
-        active = false;
-        gameOver = true;
+    inline void increment(std::atomic<uint64_t>& cell, uint64_t value) {
+        cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
 
-        if (player1->connected) {
-            safeSend(player1->socket, "GAME_OVER: " + reason + "\n");
+    inline void add(Counter counter, uint64_t value = 1) {
+        ThreadBlock* block = local();
+        if (block) {
+            increment(block->counters[counter], value);
         }
-        if (player2->connected) {
-            safeSend(player2->socket, "GAME_OVER: " + reason + "\n");
+        else {
+            updateShared([&](ThreadBlock& shared) { increment(shared.counters[counter], value); });
         }
     }
-};
 
-// Безопасные функции для работы с сокетами
-bool safeSend(SOCKET socket, const std::string& data) {
-    if (socket == INVALID_SOCKET) return false;
+    // Значение счетчика только в блоке текущего потока (0 для общего блока).
+    // Блок мог достаться от завершившегося потока, поэтому смысл имеет
+    // только разность двух значений
+    inline uint64_t localValue(Counter counter) {
+        ThreadBlock* block = local();
+        return block ? block->counters[counter].load(std::memory_order_relaxed) : 0;
+    }
 
-    const char* buffer = data.c_str();
-    int totalSent = 0;
-    int length = (int)data.length();
+    inline void record(Histogram histogram, uint64_t nanoseconds) {
+        ThreadBlock* block = local();
+        if (block) {
+            block->histograms[histogram].record(nanoseconds);
+        }
+        else {
+            updateShared([&](ThreadBlock& shared) { shared.histograms[histogram].record(nanoseconds); });
+        }
+    }
 
-    while (totalSent < length) {
-        int sent = send(socket, buffer + totalSent, length - totalSent, 0);
-        if (sent == SOCKET_ERROR) {
+    inline uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    struct Snapshot {
+        uint64_t counters[COUNTER_COUNT];
+        HistogramSnapshot histograms[HISTOGRAM_COUNT];
+
+        Snapshot() {
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                counters[i] = 0;
+            }
+        }
+    };
+
+    // Сумма блоков всех потоков. Снимок большой, поэтому заполняется по ссылке
+    inline void addBlock(Snapshot& snapshot, const ThreadBlock& block) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            snapshot.counters[i] += block.counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < HISTOGRAM_COUNT; i++) {
+            block.histograms[i].addTo(snapshot.histograms[i]);
+        }
+    }
+
+    inline void collect(Snapshot& snapshot) {
+        int count = blockCount.load(std::memory_order_acquire);
+        for (int b = 0; b < count; b++) {
+            addBlock(snapshot, *blocks[b].load(std::memory_order_acquire));
+        }
+        if (ThreadBlock* shared = sharedBlock.load(std::memory_order_acquire)) {
+            addBlock(snapshot, *shared);
+        }
+    }
+
+    // Имена для экспорта; порядок совпадает с перечислениями
+    const char* const DISCONNECT_REASONS[] = {
+        "closed", "send_failed", "protocol_error", "queue_timeout", "setup_timeout", "turn_timeout", "slow_consumer"
+    };
+    const char* const SESSION_EVENTS[] = { "suspended", "resumed", "expired" };
+    const char* const HISTOGRAM_NAMES[] = { "turn_processing", "match_wait", "game_setup" };
+    const char* const HISTOGRAM_HELP[] = {
+        "Time to apply a shot and send its results.",
+        "Time from connecting to the start of a game.",
+        "Time from creating a game to its first turn."
+    };
+    const double BUCKET_BOUNDS_SECONDS[] = {
+        1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60, 300
+    };
+
+    inline void appendMetric(std::string& out, const char* name, const char* type, const char* help, uint64_t value) {
+        out += std::string("# HELP ") + name + " " + help + "\n";
+        out += std::string("# TYPE ") + name + " " + type + "\n";
+        out += std::string(name) + " " + std::to_string(value) + "\n";
+    }
+
+    // Счетчики и гистограммы снимка в текстовом формате Prometheus
+    inline void appendPrometheus(std::string& out, const Snapshot& snapshot) {
+        appendMetric(out, "navalbattle_bytes_sent_total", "counter", "Bytes written to client sockets.",
+            snapshot.counters[BYTES_SENT]);
+        appendMetric(out, "navalbattle_bytes_received_total", "counter", "Bytes read from client sockets.",
+            snapshot.counters[BYTES_RECEIVED]);
+        appendMetric(out, "navalbattle_shots_total", "counter", "Shots fired.", snapshot.counters[SHOTS]);
+        appendMetric(out, "navalbattle_games_started_total", "counter", "Games started.",
+            snapshot.counters[GAMES_STARTED]);
+
+        out += "# HELP navalbattle_syscalls_total Socket send, receive and event wait system calls.\n";
+        out += "# TYPE navalbattle_syscalls_total counter\n";
+        out += "navalbattle_syscalls_total{call=\"send\"} " + std::to_string(snapshot.counters[SEND_CALLS]) + "\n";
+        out += "navalbattle_syscalls_total{call=\"recv\"} " + std::to_string(snapshot.counters[RECV_CALLS]) + "\n";
+        out += "navalbattle_syscalls_total{call=\"poll\"} " + std::to_string(snapshot.counters[POLL_CALLS]) + "\n";
+
+        out += "# HELP navalbattle_disconnects_total Connections dropped or games cut short, by reason.\n";
+        out += "# TYPE navalbattle_disconnects_total counter\n";
+        for (int i = DISCONNECT_CLOSED; i <= DISCONNECT_SLOW_CONSUMER; i++) {
+            out += std::string("navalbattle_disconnects_total{reason=\"") + DISCONNECT_REASONS[i - DISCONNECT_CLOSED] +
+                "\"} " + std::to_string(snapshot.counters[i]) + "\n";
+        }
+
+        out += "# HELP navalbattle_sessions_total Games interrupted by a lost connection and their outcome.\n";
+        out += "# TYPE navalbattle_sessions_total counter\n";
+        for (int i = SESSIONS_SUSPENDED; i <= SESSIONS_EXPIRED; i++) {
+            out += std::string("navalbattle_sessions_total{event=\"") + SESSION_EVENTS[i - SESSIONS_SUSPENDED] +
+                "\"} " + std::to_string(snapshot.counters[i]) + "\n";
+        }
+
+        char number[32];
+        for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+            const HistogramSnapshot& histogram = snapshot.histograms[h];
+            std::string name = std::string("navalbattle_") + HISTOGRAM_NAMES[h] + "_seconds";
+            out += "# HELP " + name + " " + HISTOGRAM_HELP[h] + "\n";
+            out += "# TYPE " + name + " histogram\n";
+            for (double bound : BUCKET_BOUNDS_SECONDS) {
+                std::snprintf(number, sizeof(number), "%g", bound);
+                out += name + "_bucket{le=\"" + number + "\"} " +
+                    std::to_string(histogram.countAtMost(static_cast<uint64_t>(bound * 1e9))) + "\n";
+            }
+            out += name + "_bucket{le=\"+Inf\"} " + std::to_string(histogram.total) + "\n";
+            std::snprintf(number, sizeof(number), "%.9g", histogram.sum / 1e9);
+            out += name + "_sum " + number + "\n";
+            out += name + "_count " + std::to_string(histogram.total) + "\n";
+        }
+    }
+}
+
+// Трассировка горячих путей: интервалы Trace::Span пишутся в кольцевой буфер
+// своего потока и выгружаются командой /trace в формате Chrome trace JSON
+// (about://tracing, ui.perfetto.dev). По умолчанию трассировка вырезается при
+// компиляции - Span становится пустым объектом; включается сборкой с
+// -DNAVALBATTLE_TRACE=1
+#ifndef NAVALBATTLE_TRACE
+#define NAVALBATTLE_TRACE 0
+#endif
+
+namespace Trace {
+    constexpr bool ENABLED = NAVALBATTLE_TRACE != 0;
+
+    const int MAX_THREADS = 256;
+    const uint64_t BUFFER_EVENTS = 1 << 15;  // последние события каждого потока
+
+    // Поля атомарные, чтобы /trace мог читать буфер, пока поток его дописывает
+    struct Event {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> duration;
+    };
+
+    struct ThreadBuffer {
+        Event events[BUFFER_EVENTS];
+        std::atomic<uint64_t> head;  // число записанных событий за все время
+        std::atomic<const char*> threadName;
+        int threadId;
+
+        explicit ThreadBuffer(int id) : head(0), threadName(nullptr), threadId(id) {
+        }
+    };
+
+    std::atomic<ThreadBuffer*> buffers[MAX_THREADS];
+    std::atomic<int> bufferCount(0);
+
+    inline uint64_t steadyNanoseconds() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Метка времени интервала. На x86 это счетчик тактов: он в несколько раз
+    // дешевле steady_clock, а в наносекунды переводится при выгрузке
+    inline uint64_t now() {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || \
+    (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+        return __rdtsc();
+#else
+        return steadyNanoseconds();
+#endif
+    }
+
+    // Точка отсчета для перевода меток now() в наносекунды
+    const uint64_t originTicks = now();
+    const uint64_t originNanoseconds = steadyNanoseconds();
+
+    // Буфер текущего потока; потоки сверх MAX_THREADS не трассируются
+    inline ThreadBuffer* local() {
+        static thread_local ThreadBuffer* buffer = nullptr;
+        static thread_local bool registered = false;
+        if (!registered) {
+            registered = true;
+            int index = bufferCount.fetch_add(1);
+            if (index < MAX_THREADS) {
+                buffer = new ThreadBuffer(index + 1);
+                buffers[index].store(buffer, std::memory_order_release);
+            }
+        }
+        return buffer;
+    }
+
+    // Имя потока в выгрузке; name должен жить до конца программы
+    inline void nameThread(const char* name) {
+        if (!ENABLED) return;
+        ThreadBuffer* buffer = local();
+        if (buffer) buffer->threadName.store(name, std::memory_order_relaxed);
+    }
+
+    inline void record(const char* name, uint64_t start, uint64_t end) {
+        ThreadBuffer* buffer = local();
+        if (!buffer) return;
+        uint64_t head = buffer->head.load(std::memory_order_relaxed);
+        Event& event = buffer->events[head & (BUFFER_EVENTS - 1)];
+        event.name.store(name, std::memory_order_relaxed);
+        event.start.store(start, std::memory_order_relaxed);
+        event.duration.store(end - start, std::memory_order_relaxed);
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    // Интервал от создания до конца области видимости; name - строковый литерал
+    template <bool Enabled>
+    class BasicSpan {
+    public:
+        explicit BasicSpan(const char* spanName) : name(spanName), start(now()) {
+        }
+
+        ~BasicSpan() {
+            record(name, start, now());
+        }
+
+    private:
+        const char* name;
+        uint64_t start;
+
+        BasicSpan(const BasicSpan&) = delete;
+        BasicSpan& operator=(const BasicSpan&) = delete;
+    };
+
+    template <>
+    class BasicSpan<false> {
+    public:
+        explicit BasicSpan(const char*) {
+        }
+    };
+
+    typedef BasicSpan<ENABLED> Span;
+
+    // Записывает события всех потоков в файл Chrome trace JSON и возвращает их число
+    // или -1 при ошибке. События, которые поток успел перезаписать во время
+    // копирования, отбрасываются
+    inline long long writeChromeTrace(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) return -1;
+
+        struct Copied {
+            const char* name;
+            uint64_t start;
+            uint64_t duration;
+            int threadId;
+        };
+        std::vector<Copied> events;
+        std::string threadNames;
+        char line[256];
+
+        int count = std::min(bufferCount.load(), MAX_THREADS);
+        for (int i = 0; i < count; i++) {
+            ThreadBuffer* buffer = buffers[i].load(std::memory_order_acquire);
+            if (!buffer) continue;
+
+            const char* threadName = buffer->threadName.load(std::memory_order_relaxed);
+            std::snprintf(line, sizeof(line),
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                threadNames.empty() ? "" : ",\n",
+                buffer->threadId, threadName ? threadName : "thread");
+            threadNames += line;
+
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t first = head > BUFFER_EVENTS ? head - BUFFER_EVENTS : 0;
+            size_t copiedFrom = events.size();
+            for (uint64_t j = first; j < head; j++) {
+                const Event& event = buffer->events[j & (BUFFER_EVENTS - 1)];
+                events.push_back({ event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                    event.duration.load(std::memory_order_relaxed), buffer->threadId });
+            }
+
+            // Слот следующего события мог быть перезаписан наполовину, поэтому +1
+            uint64_t overwritten = buffer->head.load(std::memory_order_acquire) + 1;
+            overwritten = overwritten > BUFFER_EVENTS ? overwritten - BUFFER_EVENTS : 0;
+            if (overwritten > first) {
+                size_t lost = static_cast<size_t>(std::min(overwritten, head) - first);
+                events.erase(events.begin() + copiedFrom, events.begin() + copiedFrom + lost);
+            }
+        }
+
+        uint64_t origin = std::numeric_limits<uint64_t>::max();
+        for (const Copied& event : events) {
+            origin = std::min(origin, event.start);
+        }
+        uint64_t elapsedTicks = now() - originTicks;
+        double nanosecondsPerTick = elapsedTicks > 0
+            ? static_cast<double>(steadyNanoseconds() - originNanoseconds) / elapsedTicks : 1.0;
+
+        std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+        std::fputs(threadNames.c_str(), file);
+        for (size_t i = 0; i < events.size(); i++) {
+            const Copied& event = events[i];
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"server\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                event.name, (event.start - origin) * nanosecondsPerTick / 1000.0,
+                event.duration * nanosecondsPerTick / 1000.0, event.threadId);
+        }
+        std::fputs("\n]}\n", file);
+
+        bool ok = std::fclose(file) == 0;
+        return ok ? static_cast<long long>(events.size()) : -1;
+    }
+}
+
+// Учет обращений к куче: глобальные operator new/delete заменены счетчиками,
+// чтобы в статистике сервера было видно, сколько выделений приходится на игру
+// Выделения памяти считаются в блоке метрик своего потока, без общих
+// атомарных счетчиков; /stats и /metrics складывают блоки (см. Metrics)
+void* operator new(std::size_t size) {
+    Metrics::add(Metrics::HEAP_ALLOCATIONS);
+    Metrics::add(Metrics::HEAP_BYTES, size);
+    void* memory = std::malloc(size ? size : 1);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+// Без noinline GCC после встраивания видит free() для памяти из operator new
+// и выдает ложное предупреждение -Wmismatched-new-delete
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// Устойчивая ссылка на объект в SlotMap. Поколение слота увеличивается при
+// каждом удалении, поэтому ссылка на удаленный объект не может указать на новый.
+struct SlotHandle {
+    uint32_t index;
+    uint32_t generation;
+
+    SlotHandle() : index(0), generation(0) {}
+    SlotHandle(uint32_t slotIndex, uint32_t slotGeneration) : index(slotIndex), generation(slotGeneration) {}
+
+    bool valid() const { return generation != 0; }
+    bool operator==(const SlotHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const SlotHandle& other) const { return !(*this == other); }
+};
+
+// Пул объектов с поколенческими ссылками. Объекты живут в блоках по CHUNK_SIZE
+// слотов и не перемещаются; освобожденные слоты переиспользуются через список
+// свободных. Вставка, удаление и разыменование ссылки - O(1), обход живых
+// объектов - по плотному массиву указателей.
+template <typename T>
+class SlotMap {
+public:
+    static const uint32_t CHUNK_SIZE = 256;
+
+    typedef typename std::vector<T*>::const_iterator const_iterator;
+
+    SlotMap() : slotCount(0), freeHead(NO_SLOT) {
+    }
+
+    ~SlotMap() {
+        clear();
+    }
+
+    template <typename... Args>
+    SlotHandle emplace(Args&&... args) {
+        uint32_t index;
+        if (freeHead != NO_SLOT) {
+            index = freeHead;
+        }
+        else {
+            if (slotCount % CHUNK_SIZE == 0) {
+                chunks.emplace_back(new Slot[CHUNK_SIZE]);
+            }
+            index = slotCount;
+        }
+
+        Slot& slot = slotAt(index);
+        new (&slot.storage) T(std::forward<Args>(args)...);
+
+        if (index == freeHead) freeHead = slot.nextFree;
+        else slotCount++;
+
+        slot.live = true;
+        slot.denseIndex = static_cast<uint32_t>(dense.size());
+        dense.push_back(object(slot));
+        denseSlots.push_back(index);
+        return SlotHandle(index, slot.generation);
+    }
+
+    T* get(SlotHandle handle) const {
+        if (handle.index >= slotCount) return nullptr;
+
+        Slot& slot = slotAt(handle.index);
+        return slot.live && slot.generation == handle.generation ? object(slot) : nullptr;
+    }
+
+    bool erase(SlotHandle handle) {
+        T* item = get(handle);
+        if (!item) return false;
+
+        Slot& slot = slotAt(handle.index);
+        item->~T();
+
+        // Последний элемент плотного массива занимает место удаленного
+        uint32_t last = denseSlots.back();
+        dense[slot.denseIndex] = dense.back();
+        denseSlots[slot.denseIndex] = last;
+        slotAt(last).denseIndex = slot.denseIndex;
+        dense.pop_back();
+        denseSlots.pop_back();
+
+        slot.live = false;
+        if (++slot.generation == 0) slot.generation = 1;
+        slot.nextFree = freeHead;
+        freeHead = handle.index;
+        return true;
+    }
+
+    void clear() {
+        while (!dense.empty()) {
+            uint32_t index = denseSlots.back();
+            erase(SlotHandle(index, slotAt(index).generation));
+        }
+    }
+
+    size_t size() const { return dense.size(); }
+    bool empty() const { return dense.empty(); }
+    size_t capacity() const { return chunks.size() * CHUNK_SIZE; }
+    size_t reservedBytes() const { return capacity() * sizeof(Slot); }
+
+    const_iterator begin() const { return dense.begin(); }
+    const_iterator end() const { return dense.end(); }
+
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+private:
+    static const uint32_t NO_SLOT = 0xFFFFFFFFu;
+
+    struct Slot {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        uint32_t generation;
+        uint32_t denseIndex;
+        uint32_t nextFree;
+        bool live;
+
+        Slot() : generation(1), denseIndex(0), nextFree(NO_SLOT), live(false) {}
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    std::vector<T*> dense;
+    std::vector<uint32_t> denseSlots;
+    uint32_t slotCount;
+    uint32_t freeHead;
+
+    Slot& slotAt(uint32_t index) const {
+        return chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+    }
+
+    static T* object(Slot& slot) {
+        return reinterpret_cast<T*>(&slot.storage);
+    }
+};
+
+// Кольцевой буфер входящих данных соединения фиксированного размера
+// (степень двойки). recv пишет прямо в свободное место буфера, а строки и
+// кадры разбираются на месте и затем отбрасываются через consume без копирования.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacityPow2)
+        : data(capacityPow2), mask(capacityPow2 - 1), head(0), tail(0) {
+    }
+
+    size_t size() const { return tail - head; }
+    bool empty() const { return tail == head; }
+    size_t capacity() const { return data.size(); }
+    size_t freeSpace() const { return capacity() - size(); }
+
+    // Байт со смещением offset от начала непрочитанных данных
+    char at(size_t offset) const {
+        return data[(head + offset) & mask];
+    }
+
+    // Непрерывный участок свободного места, в который можно читать из сокета
+    char* writeSpan(size_t& length) {
+        size_t start = tail & mask;
+        length = std::min(freeSpace(), capacity() - start);
+        return data.data() + start;
+    }
+
+    void commit(size_t length) { tail += length; }
+    void consume(size_t length) { head += std::min(length, size()); }
+
+    // Позиция первого вхождения символа или npos
+    size_t find(char symbol) const {
+        size_t start = head & mask;
+        size_t firstLength = std::min(size(), capacity() - start);
+        const void* found = memchr(data.data() + start, symbol, firstLength);
+        if (found) {
+            return static_cast<const char*>(found) - (data.data() + start);
+        }
+
+        found = memchr(data.data(), symbol, size() - firstLength);
+        if (found) {
+            return firstLength + (static_cast<const char*>(found) - data.data());
+        }
+        return npos;
+    }
+
+    bool startsWith(const std::string& prefix) const {
+        size_t length = std::min(prefix.size(), size());
+        for (size_t i = 0; i < length; i++) {
+            if (at(i) != prefix[i]) return false;
+        }
+        return true;
+    }
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+private:
+    std::vector<char> data;
+    size_t mask;
+    size_t head;
+    size_t tail;
+};
+
+// Неизменяемое сообщение для рассылки многим соединениям (зрителям партии):
+// сериализуется один раз, очереди получателей держат на него ссылки
+typedef std::shared_ptr<const std::string> SharedMessage;
+
+// Очередь исходящих данных соединения: цепочка блоков по OUTPUT_CHUNK_SIZE байт.
+// Сообщения копируются в хвостовой блок, а в сокет накопленная очередь уходит
+// одним вызовом sendmsg/WSASend со списком блоков (см. sendGathered).
+// Освобожденные блоки возвращаются в пул потока, поэтому в установившемся
+// режиме очередь не обращается к куче. Общие сообщения (SharedMessage)
+// не копируются: в цепочку встает ссылка на них.
+class OutputQueue {
+public:
+    static const int MAX_GATHER = 16;
+
+    OutputQueue() : bytes(0), headOffset(0) {
+    }
+
+    ~OutputQueue() {
+        clear();
+    }
+
+    size_t size() const { return bytes; }
+    bool empty() const { return bytes == 0; }
+
+    void append(const char* data, size_t length) {
+        while (length > 0) {
+            if (segments.empty() || !segments.back().chunk || segments.back().chunk->used == OUTPUT_CHUNK_SIZE) {
+                segments.push_back(Segment(acquireChunk()));
+            }
+            Chunk* tail = segments.back().chunk;
+            size_t part = std::min(length, OUTPUT_CHUNK_SIZE - tail->used);
+            std::memcpy(tail->data + tail->used, data, part);
+            tail->used += part;
+            bytes += part;
+            data += part;
+            length -= part;
+        }
+    }
+
+    void append(const std::string& data) {
+        append(data.data(), data.size());
+    }
+
+    void append(const SharedMessage& message) {
+        if (message->empty()) return;
+        segments.push_back(Segment(message));
+        bytes += message->size();
+    }
+
+    // Начала и длины первых (не более maxParts) непрерывных частей очереди
+    int gather(const char** parts, size_t* lengths, int maxParts) const {
+        int count = 0;
+        for (size_t i = 0; i < segments.size() && count < maxParts; i++) {
+            size_t begin = i == 0 ? headOffset : 0;
+            parts[count] = segments[i].data() + begin;
+            lengths[count] = segments[i].size() - begin;
+            count++;
+        }
+        return count;
+    }
+
+    void consume(size_t length) {
+        bytes -= length;
+        while (length > 0) {
+            const Segment& head = segments.front();
+            size_t part = std::min(length, head.size() - headOffset);
+            headOffset += part;
+            length -= part;
+            if (headOffset == head.size()) {
+                release(segments.front());
+                segments.erase(segments.begin());
+                headOffset = 0;
+            }
+        }
+    }
+
+    std::string toString() const {
+        std::string result;
+        result.reserve(bytes);
+        for (size_t i = 0; i < segments.size(); i++) {
+            size_t begin = i == 0 ? headOffset : 0;
+            result.append(segments[i].data() + begin, segments[i].size() - begin);
+        }
+        return result;
+    }
+
+    void clear() {
+        for (auto& segment : segments) {
+            release(segment);
+        }
+        segments.clear();
+        bytes = 0;
+        headOffset = 0;
+    }
+
+    OutputQueue(const OutputQueue&) = delete;
+    OutputQueue& operator=(const OutputQueue&) = delete;
+
+private:
+    struct Chunk {
+        size_t used;
+        char data[OUTPUT_CHUNK_SIZE];
+    };
+
+    // Часть очереди: собственный блок или ссылка на общее сообщение
+    struct Segment {
+        Chunk* chunk;
+        SharedMessage message;
+
+        explicit Segment(Chunk* ownChunk) : chunk(ownChunk) {}
+        explicit Segment(const SharedMessage& sharedMessage) : chunk(nullptr), message(sharedMessage) {}
+
+        const char* data() const { return chunk ? chunk->data : message->data(); }
+        size_t size() const { return chunk ? chunk->used : message->size(); }
+    };
+
+    // Свободные блоки потока; сверх OUTPUT_POOL_CHUNKS блоки возвращаются в кучу
+    struct ChunkPool {
+        std::vector<Chunk*> free;
+
+        ~ChunkPool() {
+            for (auto chunk : free) delete chunk;
+        }
+    };
+
+    static ChunkPool& pool() {
+        static thread_local ChunkPool chunkPool;
+        return chunkPool;
+    }
+
+    static Chunk* acquireChunk() {
+        ChunkPool& chunkPool = pool();
+        Chunk* chunk;
+        if (chunkPool.free.empty()) {
+            chunk = new Chunk;
+        }
+        else {
+            chunk = chunkPool.free.back();
+            chunkPool.free.pop_back();
+        }
+        chunk->used = 0;
+        return chunk;
+    }
+
+    static void release(Segment& segment) {
+        if (!segment.chunk) {
+            segment.message.reset();
+            return;
+        }
+        ChunkPool& chunkPool = pool();
+        if (chunkPool.free.size() < OUTPUT_POOL_CHUNKS) {
+            chunkPool.free.push_back(segment.chunk);
+        }
+        else {
+            delete segment.chunk;
+        }
+        segment.chunk = nullptr;
+    }
+
+    std::vector<Segment> segments;
+    size_t bytes;
+    size_t headOffset;  // уже отправленная часть первого сегмента
+};
+
+class Game;
+class Player;
+
+// Фрагмент исходящего сообщения. Сообщение из нескольких фрагментов ставится
+// в очередь отправки без склейки во временную строку
+struct OutputPart {
+    const char* data;
+    size_t length;
+
+    OutputPart(const char* text) : data(text), length(std::strlen(text)) {}
+    OutputPart(const char* text, size_t size) : data(text), length(size) {}
+    OutputPart(const std::string& text) : data(text.data()), length(text.size()) {}
+};
+
+bool safeSend(Player* player, const std::string& data);
+bool safeSend(Player* player, const OutputPart* parts, int count);
+bool flushOutput(Player* player);
+bool sendGameOver(Player* player, int outcome, const std::string& message);
+bool sendBoardSnapshot(Player* player);
+void safeCloseSocket(SOCKET& socket);
+
+// Состояния клетки на игровом поле
+enum CellState {
+    EMPTY = 0,
+    SHIP = 1,
+    HIT = 2,
+    MISS = 3,
+    SUNK = 4
+};
+
+const int CELL_STATE_COUNT = 5;
+
+// Вычисления над параметрами варианта игры при компиляции (constexpr C++11 -
+// одно выражение, поэтому через рекурсию)
+constexpr int maxOf(int value) {
+    return value;
+}
+
+template <typename... Rest>
+constexpr int maxOf(int first, int second, Rest... rest) {
+    return maxOf(first > second ? first : second, rest...);
+}
+
+constexpr int sumOf() {
+    return 0;
+}
+
+template <typename... Rest>
+constexpr int sumOf(int first, Rest... rest) {
+    return first + sumOf(rest...);
+}
+
+constexpr bool nonIncreasing(int) {
+    return true;
+}
+
+template <typename... Rest>
+constexpr bool nonIncreasing(int first, int second, Rest... rest) {
+    return first >= second && nonIncreasing(second, rest...);
+}
+
+constexpr int countOf(int) {
+    return 0;
+}
+
+template <typename... Rest>
+constexpr int countOf(int value, int first, Rest... rest) {
+    return (first == value ? 1 : 0) + countOf(value, rest...);
+}
+
+constexpr int nthOf(int) {
+    return 0;
+}
+
+template <typename... Rest>
+constexpr int nthOf(int index, int first, Rest... rest) {
+    return index == 0 ? first : nthOf(index - 1, rest...);
+}
+
+// Проверка, что расстановка флота от больших кораблей к меньшим не заходит в
+// тупик. Кандидаты для корабля длины length - горизонтальные позиции в каждой
+// rowStep-й строке с началом в каждом step-м столбце. Ореол поставленного
+// корабля size - прямоугольник 3 x (size + 2) - задевает не больше haloHits
+// кандидатов; если все поставленные ранее корабли вместе задевают меньше
+// кандидатов, чем их есть, свободная позиция найдется при любой их расстановке
+constexpr int ceilDiv(int value, int divisor) {
+    return (value + divisor - 1) / divisor;
+}
+
+constexpr int haloHits(int size, int length, int rowStep, int step) {
+    return maxOf(ceilDiv(3, rowStep) * ceilDiv(size + 1 + length, step),
+        ceilDiv(size + 2, rowStep) * ceilDiv(2 + length, step));
+}
+
+constexpr int haloHitsOfFirst(int, int, int, int) {
+    return 0;
+}
+
+template <typename... Rest>
+constexpr int haloHitsOfFirst(int count, int length, int rowStep, int step, int first, Rest... rest) {
+    return count == 0 ? 0 : haloHits(first, length, rowStep, step) + haloHitsOfFirst(count - 1, length, rowStep, step, rest...);
+}
+
+template <typename... Fleet>
+constexpr bool placeableWithStep(int boardSize, int index, int rowStep, int step, Fleet... fleet) {
+    return step <= boardSize &&
+        (haloHitsOfFirst(index, nthOf(index, fleet...), rowStep, step, fleet...) <
+            ((boardSize - 1) / rowStep + 1) * ((boardSize - nthOf(index, fleet...)) / step + 1) ||
+        placeableWithStep(boardSize, index, rowStep, step + 1, fleet...));
+}
+
+template <typename... Fleet>
+constexpr bool placeable(int boardSize, int index, int rowStep, Fleet... fleet) {
+    return rowStep <= boardSize &&
+        (placeableWithStep(boardSize, index, rowStep, 1, fleet...) || placeable(boardSize, index, rowStep + 1, fleet...));
+}
+
+template <typename... Fleet>
+constexpr bool noDeadEnds(int boardSize, int index, Fleet... fleet) {
+    return index == static_cast<int>(sizeof...(Fleet)) ||
+        (placeable(boardSize, index, 1, fleet...) && noDeadEnds(boardSize, index + 1, fleet...));
+}
+
+// Список 0, 1, ..., N - 1 для построения таблиц раскрытием пакета параметров
+template <int... I>
+struct IndexList {};
+
+template <int N, int... I>
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+
+template <int... I>
+struct MakeIndexList<0, I...> {
+    typedef IndexList<I...> Type;
+};
+
+// GCC оценивает размер функции до развертки циклов и считает циклы по словам
+// маски слишком крупными для встраивания; после развертки это одна-две инструкции
+#if defined(_MSC_VER)
+#define BITBOARD_INLINE __forceinline
+#elif defined(__GNUC__)
+#define BITBOARD_INLINE inline __attribute__((always_inline))
+#else
+#define BITBOARD_INLINE inline
+#endif
+
+// Маска клеток поля SIZE x SIZE: клетке (x, y) соответствует бит y * SIZE + x.
+// Число слов известно при компиляции, поэтому циклы по словам разворачиваются
+// полностью: поле 10x10 занимает два слова, 15x15 - четыре. Слово по
+// вычисляемому номеру не берется (a[i] с переменным i уводит маску из регистров
+// в память): нужное слово выбирается сравнением с каждым номером, без переходов
+template <int SIZE>
+struct BasicBitboard {
+    static const int CELLS = SIZE * SIZE;
+    static const int WORDS = (CELLS + 63) / 64;
+
+    uint64_t words[WORDS];
+
+    constexpr BasicBitboard() : words() {}
+
+    // Слова маски, начиная с младшего; недостающие - нулевые
+    template <typename... Rest>
+    constexpr explicit BasicBitboard(uint64_t first, Rest... rest) : words{ first, static_cast<uint64_t>(rest)... } {}
+
+    static constexpr BasicBitboard full() {
+        return fromWords(typename MakeIndexList<WORDS>::Type());
+    }
+
+    BITBOARD_INLINE static BasicBitboard bit(int index) {
+        BasicBitboard result;
+        for (int i = 0; i < WORDS; i++) {
+            result.words[i] = static_cast<uint64_t>(i == (index >> 6)) << (index & 63);
+        }
+        return result;
+    }
+
+    BITBOARD_INLINE static BasicBitboard cell(int x, int y) {
+        return bit(y * SIZE + x);
+    }
+
+    BITBOARD_INLINE bool test(int index) const {
+        uint64_t word = 0;
+        for (int i = 0; i < WORDS; i++) {
+            word |= words[i] & (0 - static_cast<uint64_t>(i == (index >> 6)));
+        }
+        return ((word >> (index & 63)) & 1) != 0;
+    }
+
+    BITBOARD_INLINE bool any() const {
+        uint64_t bits = 0;
+        for (int i = 0; i < WORDS; i++) bits |= words[i];
+        return bits != 0;
+    }
+
+    BITBOARD_INLINE bool none() const { return !any(); }
+
+    BITBOARD_INLINE int count() const {
+        int total = 0;
+        for (int i = 0; i < WORDS; i++) total += bitCount64(words[i]);
+        return total;
+    }
+
+    BITBOARD_INLINE int lowest() const {
+        for (int i = 0; i < WORDS - 1; i++) {
+            if (words[i]) return i * 64 + lowestBit64(words[i]);
+        }
+        return (WORDS - 1) * 64 + lowestBit64(words[WORDS - 1]);
+    }
+
+    // Снимает младший установленный бит и возвращает его индекс
+    BITBOARD_INLINE int popLowest() {
+        for (int i = 0; i < WORDS - 1; i++) {
+            if (words[i]) {
+                int index = i * 64 + lowestBit64(words[i]);
+                words[i] &= words[i] - 1;
+                return index;
+            }
+        }
+        int index = (WORDS - 1) * 64 + lowestBit64(words[WORDS - 1]);
+        words[WORDS - 1] &= words[WORDS - 1] - 1;
+        return index;
+    }
+
+    // Индекс n-го (с нуля) установленного бита
+    BITBOARD_INLINE int select(int n) const {
+        for (int i = 0; i < WORDS - 1; i++) {
+            int wordCount = bitCount64(words[i]);
+            if (n < wordCount) return i * 64 + selectInWord(words[i], n);
+            n -= wordCount;
+        }
+        return (WORDS - 1) * 64 + selectInWord(words[WORDS - 1], n);
+    }
+
+    BITBOARD_INLINE BasicBitboard operator&(const BasicBitboard& other) const {
+        BasicBitboard result;
+        for (int i = 0; i < WORDS; i++) result.words[i] = words[i] & other.words[i];
+        return result;
+    }
+
+    BITBOARD_INLINE BasicBitboard operator|(const BasicBitboard& other) const {
+        BasicBitboard result;
+        for (int i = 0; i < WORDS; i++) result.words[i] = words[i] | other.words[i];
+        return result;
+    }
+
+    BITBOARD_INLINE BasicBitboard operator^(const BasicBitboard& other) const {
+        BasicBitboard result;
+        for (int i = 0; i < WORDS; i++) result.words[i] = words[i] ^ other.words[i];
+        return result;
+    }
+
+    BITBOARD_INLINE BasicBitboard operator~() const {
+        BasicBitboard result = full();
+        for (int i = 0; i < WORDS; i++) result.words[i] &= ~words[i];
+        return result;
+    }
+
+    BITBOARD_INLINE BasicBitboard& operator&=(const BasicBitboard& other) {
+        for (int i = 0; i < WORDS; i++) words[i] &= other.words[i];
+        return *this;
+    }
+
+    BITBOARD_INLINE BasicBitboard& operator|=(const BasicBitboard& other) {
+        for (int i = 0; i < WORDS; i++) words[i] |= other.words[i];
+        return *this;
+    }
+
+    BITBOARD_INLINE BasicBitboard& operator^=(const BasicBitboard& other) {
+        for (int i = 0; i < WORDS; i++) words[i] ^= other.words[i];
+        return *this;
+    }
+
+    BITBOARD_INLINE bool operator==(const BasicBitboard& other) const {
+        uint64_t difference = 0;
+        for (int i = 0; i < WORDS; i++) difference |= words[i] ^ other.words[i];
+        return difference == 0;
+    }
+
+    BITBOARD_INLINE bool operator!=(const BasicBitboard& other) const { return !(*this == other); }
+
+    // Сдвиг на 0 (первая клетка корабля в циклах по его клеткам) возвращает маску
+    // как есть; сдвиг на целые слова (n >= 64) бывает только на больших полях и
+    // идет отдельной функцией; остальное - сдвиг каждого слова с переносом из
+    // соседнего. Перенос (w >> 1) >> (63 - shift) при shift = 0 дает 0 без сдвига на 64
+    BITBOARD_INLINE BasicBitboard operator<<(int n) const {
+        if (n == 0) return *this;
+        BasicBitboard source = n < 64 ? *this : shiftWordsUp(n >> 6);
+        int shift = n & 63;
+        BasicBitboard result;
+        result.words[0] = source.words[0] << shift;
+        for (int i = 1; i < WORDS; i++) {
+            result.words[i] = (source.words[i] << shift) | ((source.words[i - 1] >> 1) >> (63 - shift));
+        }
+        return result & full();
+    }
+
+    BITBOARD_INLINE BasicBitboard operator>>(int n) const {
+        if (n == 0) return *this;
+        BasicBitboard source = n < 64 ? *this : shiftWordsDown(n >> 6);
+        int shift = n & 63;
+        BasicBitboard result;
+        for (int i = 0; i < WORDS - 1; i++) {
+            result.words[i] = (source.words[i] >> shift) | ((source.words[i + 1] << 1) << (63 - shift));
+        }
+        result.words[WORDS - 1] = source.words[WORDS - 1] >> shift;
+        return result;
+    }
+
+    // Слово word маски клеток [first, last]; пустой диапазон - 0
+    static constexpr uint64_t rangeWord(int first, int last, int word) {
+        return last < word * 64 || first > word * 64 + 63 || first > last ? 0 :
+            bitsBetween(first < word * 64 ? 0 : first - word * 64, last > word * 64 + 63 ? 63 : last - word * 64);
+    }
+
+    // Слово word маски прямоугольника [x0, x1] x [y0, y1]
+    static constexpr uint64_t rectangleWord(int x0, int x1, int y0, int y1, int word) {
+        return y0 > y1 ? 0 : rangeWord(y0 * SIZE + x0, y0 * SIZE + x1, word) | rectangleWord(x0, x1, y0 + 1, y1, word);
+    }
+
+    template <int... W>
+    static constexpr BasicBitboard rectangle(int x0, int x1, int y0, int y1, IndexList<W...>) {
+        return BasicBitboard(rectangleWord(x0, x1, y0, y1, W)...);
+    }
+
+    static constexpr BasicBitboard rectangle(int x0, int x1, int y0, int y1) {
+        return rectangle(x0, x1, y0, y1, typename MakeIndexList<WORDS>::Type());
+    }
+
+private:
+    BasicBitboard shiftWordsUp(int offset) const {
+        BasicBitboard result;
+        for (int i = offset; i < WORDS; i++) result.words[i] = words[i - offset];
+        return result;
+    }
+
+    BasicBitboard shiftWordsDown(int offset) const {
+        BasicBitboard result;
+        for (int i = 0; i + offset < WORDS; i++) result.words[i] = words[i + offset];
+        return result;
+    }
+
+    BITBOARD_INLINE static int selectInWord(uint64_t word, int n) {
+        for (; n > 0; n--) {
+            word &= word - 1;
+        }
+        return lowestBit64(word);
+    }
+
+    static constexpr uint64_t bitsBetween(int low, int high) {
+        return (high == 63 ? ~0ULL : (1ULL << (high + 1)) - 1) & ~((1ULL << low) - 1);
+    }
+
+    template <int... W>
+    static constexpr BasicBitboard fromWords(IndexList<W...>) {
+        return BasicBitboard(rangeWord(0, CELLS - 1, W)...);
+    }
+};
+
+// Вариант игры: поле SIZE x SIZE и флот FLEET (размеры кораблей от большего
+// к меньшему). Движок (BasicSide и все, на чем она построена) - шаблоны над
+// вариантом, так что размеры полей, циклы по кораблям и таблицы масок известны
+// при компиляции
+template <int SIZE, int... FLEET>
+struct GameRules {
+    static const int BOARD_SIZE = SIZE;
+    static const int BOARD_CELLS = SIZE * SIZE;
+    static const int NUM_SHIPS = sizeof...(FLEET);
+    static const int MAX_SHIP_SIZE = maxOf(FLEET...);
+    static const int FLEET_CELLS = sumOf(FLEET...);
+    static constexpr int SHIP_SIZES[NUM_SHIPS] = { FLEET... };
+
+    typedef BasicBitboard<SIZE> Bitboard;
+
+    // Число кораблей каждого размера
+    static constexpr int shipsOfSize(int size) {
+        return countOf(size, FLEET...);
+    }
+
+    // Номер клетки хранится в журнале и в протоколе одним байтом
+    static_assert(SIZE >= 2 && SIZE <= 16, "board must be 2x2 to 16x16");
+    static_assert(FLEET_CELLS < BOARD_CELLS / 2, "fleet does not fit the board");
+    static_assert(MAX_SHIP_SIZE <= SIZE, "ship longer than the board");
+    static_assert(nonIncreasing(FLEET...), "ships are placed from the largest down");
+    // На этом держится BasicSide::autoPlaceShips: место для очередного корабля есть всегда
+    static_assert(noDeadEnds(SIZE, 0, FLEET...), "random placement of this fleet can reach a dead end");
+    // Клетку накрывают не больше 2 * FLEET_CELLS расстановок флота (см. BitSlicedCounter)
+    static_assert(2 * FLEET_CELLS < 256, "fleet too large for the shot planner counters");
+};
+
+template <int SIZE, int... FLEET>
+constexpr int GameRules<SIZE, FLEET...>::SHIP_SIZES[];
+
+// Классический вариант 10x10 - единственный в сетевой игре: клиент, протокол
+// и журнал рассчитаны на него. Блиц 8x8 и большое поле 15x15 играют боты турнира
+typedef GameRules<10, 4, 3, 3, 2, 2, 2, 1, 1, 1, 1> ClassicRules;
+typedef GameRules<8, 3, 2, 2, 1, 1, 1> BlitzRules;
+typedef GameRules<15, 5, 4, 4, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 1> LargeRules;
+
+const int BOARD_SIZE = ClassicRules::BOARD_SIZE;
+const int BOARD_CELLS = ClassicRules::BOARD_CELLS;
+const int NUM_SHIPS = ClassicRules::NUM_SHIPS;
+const int MAX_SHIP_SIZE = ClassicRules::MAX_SHIP_SIZE;
+const int* const SHIP_SIZES = ClassicRules::SHIP_SIZES;
+
+typedef ClassicRules::Bitboard Bitboard;
+
+// Предвычисленные маски корабля: сам корабль и корабль вместе с ореолом
+// из соседних клеток. Индекс: размер, ориентация (1 - горизонтально), клетка начала.
+template <typename Rules>
+struct BasicShipMask {
+    typename Rules::Bitboard body;
+    typename Rules::Bitboard halo;
+    bool fits;
+};
+
+// Построение таблицы масок при компиляции. Корабль и ореол - прямоугольники,
+// а клетки начала, с которых корабль помещается на поле, - прямоугольник
+// у левого верхнего угла
+template <typename Rules>
+struct ShipMaskLayout {
+    typedef typename Rules::Bitboard Bitboard;
+    typedef BasicShipMask<Rules> ShipMask;
+
+    static const int SIZE = Rules::BOARD_SIZE;
+
+    struct Row {
+        ShipMask cells[Rules::BOARD_CELLS];
+    };
+
+    struct Orientations {
+        Row masks[2];
+        Bitboard starts[2];
+    };
+
+    struct Table {
+        Orientations sizes[Rules::MAX_SHIP_SIZE + 1];
+    };
+
+    static constexpr Table build() {
+        return build(typename MakeIndexList<Rules::MAX_SHIP_SIZE + 1>::Type());
+    }
+
+private:
+    typedef typename MakeIndexList<Rules::BOARD_CELLS>::Type Cells;
+
+    static constexpr int lastX(int size, int horizontal, int x) { return x + (horizontal ? size - 1 : 0); }
+    static constexpr int lastY(int size, int horizontal, int y) { return y + (horizontal ? 0 : size - 1); }
+    static constexpr int low(int value) { return value > 0 ? value : 0; }
+    static constexpr int high(int value) { return value < SIZE - 1 ? value : SIZE - 1; }
+
+    static constexpr bool fits(int size, int horizontal, int x, int y) {
+        return size > 0 && lastX(size, horizontal, x) < SIZE && lastY(size, horizontal, y) < SIZE;
+    }
+
+    static constexpr ShipMask mask(int size, int horizontal, int x, int y) {
+        return !fits(size, horizontal, x, y) ? ShipMask{ Bitboard(), Bitboard(), false } : ShipMask{
+            Bitboard::rectangle(x, lastX(size, horizontal, x), y, lastY(size, horizontal, y)),
+            Bitboard::rectangle(low(x - 1), high(lastX(size, horizontal, x) + 1),
+                low(y - 1), high(lastY(size, horizontal, y) + 1)),
+            true };
+    }
+
+    static constexpr Bitboard starts(int size, int horizontal) {
+        return size == 0 ? Bitboard() : Bitboard::rectangle(0, SIZE - 1 - (horizontal ? size - 1 : 0),
+            0, SIZE - 1 - (horizontal ? 0 : size - 1));
+    }
+
+    template <int... C>
+    static constexpr Row row(int size, int horizontal, IndexList<C...>) {
+        return Row{ { mask(size, horizontal, C % SIZE, C / SIZE)... } };
+    }
+
+    template <int... S>
+    static constexpr Table build(IndexList<S...>) {
+        return Table{ { Orientations{ { row(S, 0, Cells()), row(S, 1, Cells()) },
+            { starts(S, 0), starts(S, 1) } }... } };
+    }
+};
+
+template <typename Rules>
+class BasicShipMaskTable {
+public:
+    typedef typename Rules::Bitboard Bitboard;
+    typedef BasicShipMask<Rules> ShipMask;
+
+    static const ShipMask& get(int size, bool horizontal, int x, int y) {
+        return TABLE.sizes[size].masks[horizontal ? 1 : 0].cells[y * Rules::BOARD_SIZE + x];
+    }
+
+    static const ShipMask& get(int size, bool horizontal, int cell) {
+        return TABLE.sizes[size].masks[horizontal ? 1 : 0].cells[cell];
+    }
+
+    // Клетки, с которых корабль помещается на поле целиком
+    static const Bitboard& starts(int size, bool horizontal) {
+        return TABLE.sizes[size].starts[horizontal ? 1 : 0];
+    }
+
+    // Клетки начала, с которых корабль size помещается в свободные (не blocked) клетки
+    static Bitboard legalStarts(int size, bool horizontal, const Bitboard& blocked) {
+        Bitboard free = ~blocked;
+        Bitboard result = starts(size, horizontal);
+        int step = horizontal ? 1 : Rules::BOARD_SIZE;
+        for (int i = 0; i < size; i++) {
+            result &= free >> (i * step);
+        }
+        return result;
+    }
+
+private:
+    // Таблица лежит в секции данных программы: ни построения при запуске,
+    // ни проверки инициализации при обращении
+    static constexpr typename ShipMaskLayout<Rules>::Table TABLE = ShipMaskLayout<Rules>::build();
+};
+
+template <typename Rules>
+constexpr typename ShipMaskLayout<Rules>::Table BasicShipMaskTable<Rules>::TABLE;
+
+typedef BasicShipMask<ClassicRules> ShipMask;
+typedef BasicShipMaskTable<ClassicRules> ShipMaskTable;
+
+// Быстрый генератор псевдослучайных чисел (xorshift128+), свой в каждом потоке
+class FastRandom {
+public:
+    explicit FastRandom(uint64_t seed) {
+        reseed(seed);
+    }
+
+    static FastRandom& local() {
+        static thread_local FastRandom generator(std::random_device{}() * 0x9E3779B97F4A7C15ULL ^
+            static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+        return generator;
+    }
+
+    void reseed(uint64_t seed) {
+        state[0] = splitMix(seed);
+        state[1] = splitMix(seed);
+    }
+
+    uint64_t next() {
+        uint64_t s1 = state[0];
+        const uint64_t s0 = state[1];
+        state[0] = s0;
+        s1 ^= s1 << 23;
+        state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+        return state[1] + s0;
+    }
+
+    // Равномерное число из [0, bound)
+    uint32_t below(uint32_t bound) {
+        return static_cast<uint32_t>(((next() >> 32) * bound) >> 32);
+    }
+
+private:
+    uint64_t state[2];
+
+    static uint64_t splitMix(uint64_t& x) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// Игровое поле: по одной битовой маске на каждое непустое состояние клетки
+template <typename Rules>
+struct BasicBoardMasks {
+    typedef typename Rules::Bitboard Bitboard;
+
+    Bitboard cells[CELL_STATE_COUNT];
+
+    Bitboard& operator[](CellState state) { return cells[state]; }
+    const Bitboard& operator[](CellState state) const { return cells[state]; }
+
+    BITBOARD_INLINE Bitboard occupied() const {
+        return cells[SHIP] | cells[HIT] | cells[MISS] | cells[SUNK];
+    }
+
+    BITBOARD_INLINE Bitboard empty() const {
+        return ~occupied();
+    }
+
+    CellState at(int x, int y) const {
+        int index = y * Rules::BOARD_SIZE + x;
+        if (cells[SHIP].test(index)) return SHIP;
+        if (cells[HIT].test(index)) return HIT;
+        if (cells[MISS].test(index)) return MISS;
+        if (cells[SUNK].test(index)) return SUNK;
+        return EMPTY;
+    }
+
+    void clear() {
+        for (int i = 0; i < CELL_STATE_COUNT; i++) {
+            cells[i] = Bitboard();
+        }
+    }
+};
+
+typedef BasicBoardMasks<ClassicRules> BoardMasks;
+
+// Поле в текстовом протоколе. Текст лежит в буфере фиксированного размера
+// и хранит разметку (номера строк и столбцов, пробелы) с первого кадра;
+// следующий кадр переписывает только символы клеток, изменившихся с прошлого
+// раза, так что отрисовка хода не обращается к куче и не трогает остальные строки
+template <typename Rules>
+class BasicBoardText {
+public:
+    typedef typename Rules::Bitboard Bitboard;
+
+    static const int SIZE = Rules::BOARD_SIZE;
+
+    // Подписи строк - одна цифра
+    static_assert(SIZE <= 10, "row labels are single digits");
+
+    static const size_t HEADER_LENGTH = 2 + 2 * SIZE;
+    static const size_t ROW_LENGTH = 3 + 2 * SIZE;
+    static const size_t LENGTH = HEADER_LENGTH + ROW_LENGTH * SIZE;
+
+    explicit BasicBoardText(bool showShips) : symbols(CELL_SYMBOLS[showShips ? 1 : 0]) {
+        char* out = text;
+        *out++ = ' ';
+        for (int x = 0; x < SIZE; x++) {
+            *out++ = ' ';
+            *out++ = static_cast<char>('0' + x);
+        }
+        *out++ = '\n';
+        for (int y = 0; y < SIZE; y++) {
+            *out++ = static_cast<char>('0' + y);
+            *out++ = ' ';
+            for (int x = 0; x < SIZE; x++) {
+                *out++ = symbols[EMPTY];
+                *out++ = ' ';
+            }
+            *out++ = '\n';
+        }
+        rendered.clear();
+    }
+
+    // Приводит текст к состоянию поля и возвращает число перерисованных клеток
+    int update(const BasicBoardMasks<Rules>& board) {
+        Bitboard changed;
+        for (int state = SHIP; state < CELL_STATE_COUNT; state++) {
+            changed |= board.cells[state] ^ rendered.cells[state];
+        }
+        int redrawn = draw(changed & board.empty(), symbols[EMPTY]);
+        for (int state = SHIP; state < CELL_STATE_COUNT; state++) {
+            redrawn += draw(changed & board.cells[state], symbols[state]);
+        }
+        rendered = board;
+        return redrawn;
+    }
+
+    const char* data() const { return text; }
+    size_t size() const { return LENGTH; }
+
+private:
+    int draw(Bitboard cells, char symbol) {
+        int drawn = 0;
+        while (cells.any()) {
+            int cell = cells.popLowest();
+            // y * ROW_LENGTH + 2 * x, выраженное через номер клетки y * SIZE + x
+            text[HEADER_LENGTH + 2 + 2 * cell + (ROW_LENGTH - 2 * SIZE) * (cell / SIZE)] = symbol;
+            drawn++;
+        }
+        return drawn;
+    }
+
+    // Символы клеток по CellState; корабли скрыты на поле соперника
+    static constexpr char CELL_SYMBOLS[2][CELL_STATE_COUNT] = {
+        { '.', '.', 'X', 'O', '#' },
+        { '.', 'S', 'X', 'O', '#' }
+    };
+
+    const char* symbols;
+    BasicBoardMasks<Rules> rendered;
+    char text[LENGTH];
+};
+
+template <typename Rules>
+constexpr char BasicBoardText<Rules>::CELL_SYMBOLS[2][CELL_STATE_COUNT];
+
+typedef BasicBoardText<ClassicRules> BoardText;
+
+// Структура корабля
+template <typename Rules>
+struct BasicShip {
+    int size;
+    int hits;
+    bool horizontal;
+    int x, y;
+    typename Rules::Bitboard body;
+    typename Rules::Bitboard halo;
+
+    bool isSunk() const { return hits >= size; }
+};
+
+typedef BasicShip<ClassicRules> Ship;
+
+// Счетчики сразу для всех клеток поля: бит i плоскости k - это k-й разряд
+// счетчика клетки i. Прибавление маски - поразрядное сложение с переносом,
+// поэтому за одну операцию над маской увеличиваются счетчики всех клеток
+template <typename Bitboard>
+struct BitSlicedCounter {
+    static const int PLANES = 8;
+    Bitboard planes[PLANES];
+
+    void add(Bitboard carry) {
+        for (int i = 0; i < PLANES && carry.any(); i++) {
+            Bitboard next = planes[i] & carry;
+            planes[i] ^= carry;
+            carry = next;
+        }
+    }
+
+    // Клетки из candidates с наибольшим значением счетчика
+    Bitboard maxima(Bitboard candidates) const {
+        for (int i = PLANES - 1; i >= 0; i--) {
+            Bitboard higher = candidates & planes[i];
+            if (higher.any()) candidates = higher;
+        }
+        return candidates;
+    }
+};
+
+// Выбор выстрела компьютерного соперника по плотности вероятности: для каждой
+// клетки считается, сколько допустимых расстановок еще не потопленных кораблей
+// ее накрывают. Пока подбитых кораблей нет (поиск), учитываются все расстановки,
+// после попадания (добивание) - только проходящие через подбитые клетки.
+// Расстановки одного корабля перебираются целыми масками клеток начала,
+// так что ход стоит несколько десятков операций над Bitboard.
+template <typename Rules>
+class BasicShotPlanner {
+public:
+    typedef typename Rules::Bitboard Bitboard;
+    typedef BasicShipMaskTable<Rules> ShipMaskTable;
+
+    static const int SIZE = Rules::BOARD_SIZE;
+    static const int MAX_SHIP_SIZE = Rules::MAX_SHIP_SIZE;
+
+    static int chooseShot(const BasicBoardMasks<Rules>& view, FastRandom& random) {
+        int remaining[MAX_SHIP_SIZE + 1];
+        remainingShips(view[SUNK], remaining);
+
+        const Bitboard& hits = view[HIT];
+        Bitboard blocked = view[MISS] | view[SUNK];
+        BitSlicedCounter<Bitboard> density;
+
+        for (int size = 1; size <= MAX_SHIP_SIZE; size++) {
+            if (remaining[size] == 0) continue;
+
+            for (int orientation = 0; orientation < (size > 1 ? 2 : 1); orientation++) {
+                bool horizontal = orientation == 0;
+                Bitboard starts = ShipMaskTable::legalStarts(size, horizontal, blocked);
+                if (hits.any()) {
+                    starts = startsThroughHits(size, horizontal, starts, hits);
+                }
+                if (starts.none()) continue;
+
+                int step = horizontal ? 1 : SIZE;
+                for (int i = 0; i < size; i++) {
+                    Bitboard covered = starts << (i * step);
+                    for (int n = 0; n < remaining[size]; n++) {
+                        density.add(covered);
+                    }
+                }
+            }
+        }
+
+        // Если расстановок не нашлось, maxima вернет все неоткрытые клетки
+        Bitboard best = density.maxima(view.empty());
+        return best.select(static_cast<int>(random.below(static_cast<uint32_t>(best.count()))));
+    }
+
+private:
+    // Корабли не соприкасаются, поэтому первая по индексу клетка каждой
+    // связной группы потопленных клеток - начало одного корабля
+    static void remainingShips(Bitboard sunk, int remaining[]) {
+        for (int size = 0; size <= MAX_SHIP_SIZE; size++) remaining[size] = Rules::shipsOfSize(size);
+
+        while (sunk.any()) {
+            int cell = sunk.lowest();
+            int x = cell % SIZE;
+            int y = cell / SIZE;
+            bool horizontal = x + 1 < SIZE && sunk.test(cell + 1);
+            int step = horizontal ? 1 : SIZE;
+            int size = 0;
+            while ((horizontal ? x : y) + size < SIZE && sunk.test(cell + size * step)) {
+                sunk ^= Bitboard::bit(cell + size * step);
+                size++;
+            }
+            if (size <= MAX_SHIP_SIZE && remaining[size] > 0) remaining[size]--;
+        }
+    }
+
+    // Расстановки, которые накрывают хотя бы одну подбитую клетку и не касаются
+    // остальных: подбитая клетка рядом с кораблем может принадлежать только ему
+    static Bitboard startsThroughHits(int size, bool horizontal, const Bitboard& starts, const Bitboard& hits) {
+        int step = horizontal ? 1 : SIZE;
+        Bitboard through;
+        for (int i = 0; i < size; i++) {
+            through |= hits >> (i * step);
+        }
+
+        Bitboard result;
+        Bitboard candidates = starts & through;
+        while (candidates.any()) {
+            int cell = candidates.popLowest();
+            const BasicShipMask<Rules>& mask = ShipMaskTable::get(size, horizontal, cell);
+            if ((mask.halo & ~mask.body & hits).none()) {
+                result |= Bitboard::bit(cell);
+            }
+        }
+        return result;
+    }
+};
+
+typedef BasicShotPlanner<ClassicRules> ShotPlanner;
+
+class TimerWheel;
+
+// Таймер, встраиваемый в объект-владелец. kind и owner разбирает тот,
+// кто обрабатывает срабатывания; при разрушении таймер снимается с колеса.
+struct TimerNode {
+    TimerNode* prev;
+    TimerNode* next;
+    uint64_t deadline;
+    int kind;
+    void* owner;
+    TimerWheel* wheel;
+    int slot;
+
+    explicit TimerNode(void* timerOwner = nullptr)
+        : prev(nullptr), next(nullptr), deadline(0), kind(0), owner(timerOwner), wheel(nullptr), slot(-1) {
+    }
+
+    ~TimerNode();
+
+    bool scheduled() const { return wheel != nullptr; }
+
+    TimerNode(const TimerNode&) = delete;
+    TimerNode& operator=(const TimerNode&) = delete;
+};
+
+// Иерархическое колесо таймеров: TIMER_LEVELS уровней по 64 слота, шаг TICK_MS.
+// Уровень 0 покрывает ближайшие 64 тика, каждый следующий - в 64 раза больше;
+// таймеры верхних уровней переносятся вниз, когда колесо доходит до их слота.
+// Постановка и отмена - O(1), за тик обрабатывается только один слот уровня 0,
+// так что стоимость тика не зависит от числа взведенных таймеров.
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int TICK_MS = 10;
+    static const int TIMER_LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    explicit TimerWheel(Clock::time_point startTime = Clock::now())
+        : start(startTime), currentTick(0), count(0) {
+        for (int level = 0; level < TIMER_LEVELS; level++) {
+            occupancy[level] = 0;
+            for (int i = 0; i < SLOTS; i++) {
+                slots[level][i] = tails[level][i] = nullptr;
+            }
+        }
+    }
+
+    ~TimerWheel() {
+        for (int level = 0; level < TIMER_LEVELS; level++) {
+            for (int i = 0; i < SLOTS; i++) {
+                while (slots[level][i]) {
+                    cancel(slots[level][i]);
+                }
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+
+    // (Пере)взводит таймер; срок округляется вверх до тика, но не раньше следующего
+    void schedule(TimerNode* node, Clock::time_point when, int kind) {
+        cancel(node);
+
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(when - start).count();
+        uint64_t tick = ms <= 0 ? 0 : static_cast<uint64_t>((ms + TICK_MS - 1) / TICK_MS);
+        node->deadline = std::max(tick, currentTick + 1);
+        node->kind = kind;
+        node->wheel = this;
+        count++;
+        insert(node);
+    }
+
+    void schedule(TimerNode* node, int delayMs, int kind) {
+        schedule(node, Clock::now() + std::chrono::milliseconds(delayMs), kind);
+    }
+
+    void cancel(TimerNode* node) {
+        if (node->wheel != this) return;
+
+        unlink(node);
+        node->wheel = nullptr;
+        count--;
+    }
+
+    // Продвигает колесо до момента now и вызывает fire(TimerNode*) для истекших таймеров.
+    // Перед вызовом таймер уже снят, поэтому обработчик может взвести его снова.
+    template <typename Fire>
+    void advance(Clock::time_point now, Fire fire) {
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        uint64_t target = ms <= 0 ? 0 : static_cast<uint64_t>(ms / TICK_MS);
+
+        while (currentTick < target) {
+            currentTick++;
+
+            for (int level = TIMER_LEVELS - 1; level > 0; level--) {
+                if ((currentTick & ((1ULL << (SLOT_BITS * level)) - 1)) == 0) {
+                    cascade(level, static_cast<int>((currentTick >> (SLOT_BITS * level)) & (SLOTS - 1)));
+                }
+            }
+
+            int index = static_cast<int>(currentTick & (SLOTS - 1));
+            while (TimerNode* node = slots[0][index]) {
+                cancel(node);
+                fire(node);
+            }
+        }
+    }
+
+    // Сколько миллисекунд можно спать до ближайшего срабатывания или переноса, не больше limit
+    int millisecondsUntilNext(Clock::time_point now, int limit) const {
+        if (count == 0) return limit;
+
+        uint64_t ticks;
+        if (occupancy[0]) {
+            int from = static_cast<int>((currentTick + 1) & (SLOTS - 1));
+            uint64_t rotated = (occupancy[0] >> from) | (from ? occupancy[0] << (SLOTS - from) : 0);
+            ticks = 1 + lowestBit64(rotated);
+        }
+        else {
+            ticks = SLOTS - (currentTick & (SLOTS - 1));
+        }
+
+        Clock::time_point when = start + std::chrono::milliseconds((currentTick + ticks) * TICK_MS);
+        long long left = std::chrono::duration_cast<std::chrono::milliseconds>(when - now).count();
+        return static_cast<int>(std::max<long long>(0, std::min<long long>(left, limit)));
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+private:
+    Clock::time_point start;
+    uint64_t currentTick;
+    size_t count;
+    TimerNode* slots[TIMER_LEVELS][SLOTS];
+    TimerNode* tails[TIMER_LEVELS][SLOTS];
+    uint64_t occupancy[TIMER_LEVELS];
+
+    // Уровень выбирается так, чтобы слот таймера был пройден колесом ровно
+    // в тот оборот, на который приходится срок; слишком далекие сроки ждут
+    // на верхнем уровне и переносятся повторно
+    void insert(TimerNode* node) {
+        int level = TIMER_LEVELS - 1;
+        uint64_t unit = (currentTick >> (SLOT_BITS * level)) + SLOTS;
+        if (node->deadline - currentTick < static_cast<uint64_t>(SLOTS)) {
+            level = 0;
+            unit = node->deadline;
+        }
+        else {
+            for (int candidate = 1; candidate < TIMER_LEVELS; candidate++) {
+                uint64_t deadlineUnit = node->deadline >> (SLOT_BITS * candidate);
+                if (deadlineUnit - (currentTick >> (SLOT_BITS * candidate)) <= static_cast<uint64_t>(SLOTS)) {
+                    level = candidate;
+                    unit = deadlineUnit;
+                    break;
+                }
+            }
+        }
+
+        // Таймеры одного слота срабатывают в порядке постановки
+        int index = static_cast<int>(unit & (SLOTS - 1));
+        node->slot = level * SLOTS + index;
+        node->next = nullptr;
+        node->prev = tails[level][index];
+        if (node->prev) node->prev->next = node;
+        else slots[level][index] = node;
+        tails[level][index] = node;
+        occupancy[level] |= 1ULL << index;
+    }
+
+    void unlink(TimerNode* node) {
+        int level = node->slot / SLOTS;
+        int index = node->slot % SLOTS;
+        if (node->prev) node->prev->next = node->next;
+        else slots[level][index] = node->next;
+        if (node->next) node->next->prev = node->prev;
+        else tails[level][index] = node->prev;
+        if (!slots[level][index]) occupancy[level] &= ~(1ULL << index);
+        node->prev = node->next = nullptr;
+        node->slot = -1;
+    }
+
+    void cascade(int level, int index) {
+        TimerNode* node = slots[level][index];
+        slots[level][index] = tails[level][index] = nullptr;
+        occupancy[level] &= ~(1ULL << index);
+
+        while (node) {
+            TimerNode* next = node->next;
+            insert(node);
+            node = next;
+        }
+    }
+};
+
+// std::chrono::milliseconds(TICK_MS) берет константу по ссылке
+const int TimerWheel::TICK_MS;
+
+inline TimerNode::~TimerNode() {
+    if (wheel) wheel->cancel(this);
+}
+
+// Заявка игрока в очереди матчмейкинга. Хранится внутри игрока, поэтому
+// постановка в очередь и удаление из нее не выделяют память.
+struct MatchTicket {
+    void* owner;
+    int rating;
+    int bucket;
+    bool queued;
+    std::chrono::steady_clock::time_point queuedAt;
+    MatchTicket* bucketPrev;
+    MatchTicket* bucketNext;
+    MatchTicket* agePrev;
+    MatchTicket* ageNext;
+
+    explicit MatchTicket(void* ticketOwner = nullptr)
+        : owner(ticketOwner), rating(DEFAULT_RATING), bucket(0), queued(false),
+        bucketPrev(nullptr), bucketNext(nullptr), agePrev(nullptr), ageNext(nullptr) {
+    }
+};
+
+// Очередь ожидающих игроков, проиндексированная по рейтингу.
+// Рейтинги разбиты на RATING_BUCKETS корзин по RATING_BUCKET_WIDTH очков,
+// каждая корзина - FIFO-список заявок, а непустые корзины отмечены в 128-битной
+// маске. Поиск ближайшей непустой корзины - пара операций над словами маски,
+// постановка и удаление - O(1), независимо от длины очереди.
+class RatingQueue {
+public:
+    RatingQueue() : oldest(nullptr), newest(nullptr), count(0) {
+        occupancy[0] = occupancy[1] = 0;
+        for (int i = 0; i < RATING_BUCKETS; i++) {
+            heads[i] = tails[i] = nullptr;
+        }
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Дольше всех ожидающая заявка; дальше по цепочке ageNext
+    MatchTicket* front() const { return oldest; }
+
+    static int bucketOf(int rating) {
+        return std::max(0, std::min(rating / RATING_BUCKET_WIDTH, RATING_BUCKETS - 1));
+    }
+
+    // Окно поиска (в корзинах по обе стороны) расширяется со временем ожидания
+    static int windowFor(const MatchTicket& ticket, std::chrono::steady_clock::time_point now) {
+        long long waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - ticket.queuedAt).count();
+        return static_cast<int>(std::min<long long>(MATCH_WINDOW_BUCKETS + waited / MATCH_WINDOW_WIDEN_MS, RATING_BUCKETS));
+    }
+
+    void push(MatchTicket* ticket, std::chrono::steady_clock::time_point now) {
+        ticket->bucket = bucketOf(ticket->rating);
+        ticket->queuedAt = now;
+        ticket->queued = true;
+
+        int bucket = ticket->bucket;
+        ticket->bucketPrev = tails[bucket];
+        ticket->bucketNext = nullptr;
+        if (tails[bucket]) tails[bucket]->bucketNext = ticket;
+        else heads[bucket] = ticket;
+        tails[bucket] = ticket;
+        occupancy[bucket >> 6] |= 1ULL << (bucket & 63);
+
+        ticket->agePrev = newest;
+        ticket->ageNext = nullptr;
+        if (newest) newest->ageNext = ticket;
+        else oldest = ticket;
+        newest = ticket;
+        count++;
+    }
+
+    void remove(MatchTicket* ticket) {
+        if (!ticket->queued) return;
+
+        int bucket = ticket->bucket;
+        if (ticket->bucketPrev) ticket->bucketPrev->bucketNext = ticket->bucketNext;
+        else heads[bucket] = ticket->bucketNext;
+        if (ticket->bucketNext) ticket->bucketNext->bucketPrev = ticket->bucketPrev;
+        else tails[bucket] = ticket->bucketPrev;
+        if (!heads[bucket]) occupancy[bucket >> 6] &= ~(1ULL << (bucket & 63));
+
+        if (ticket->agePrev) ticket->agePrev->ageNext = ticket->ageNext;
+        else oldest = ticket->ageNext;
+        if (ticket->ageNext) ticket->ageNext->agePrev = ticket->agePrev;
+        else newest = ticket->agePrev;
+
+        ticket->bucketPrev = ticket->bucketNext = ticket->agePrev = ticket->ageNext = nullptr;
+        ticket->queued = false;
+        count--;
+    }
+
+    // Соперник из ближайшей по рейтингу непустой корзины не дальше window корзин.
+    // Внутри корзины выбирается дольше всех ожидающий. Сама заявка (если она
+    // в очереди) соперником не считается.
+    MatchTicket* findOpponent(const MatchTicket* ticket, int window) const {
+        int center = bucketOf(ticket->rating);
+        MatchTicket* same = heads[center];
+        if (same == ticket) same = ticket->bucketNext;
+        if (same) return same;
+
+        int up = nextOccupied(center + 1);
+        int down = prevOccupied(center - 1);
+        if (up >= 0 && up - center > window) up = -1;
+        if (down >= 0 && center - down > window) down = -1;
+
+        if (up < 0 && down < 0) return nullptr;
+        if (up < 0) return heads[down];
+        if (down < 0) return heads[up];
+        if (up - center != center - down) {
+            return up - center < center - down ? heads[up] : heads[down];
+        }
+        return heads[up]->queuedAt <= heads[down]->queuedAt ? heads[up] : heads[down];
+    }
+
+    RatingQueue(const RatingQueue&) = delete;
+    RatingQueue& operator=(const RatingQueue&) = delete;
+
+private:
+    MatchTicket* heads[RATING_BUCKETS];
+    MatchTicket* tails[RATING_BUCKETS];
+    uint64_t occupancy[2];
+    MatchTicket* oldest;
+    MatchTicket* newest;
+    size_t count;
+
+    // Первая непустая корзина с номером >= from, либо -1
+    int nextOccupied(int from) const {
+        if (from >= RATING_BUCKETS) return -1;
+        for (int word = from >> 6; word < 2; word++) {
+            uint64_t bits = occupancy[word];
+            if (word == from >> 6) bits &= ~0ULL << (from & 63);
+            if (bits) return word * 64 + lowestBit64(bits);
+        }
+        return -1;
+    }
+
+    // Последняя непустая корзина с номером <= from, либо -1
+    int prevOccupied(int from) const {
+        if (from < 0) return -1;
+        for (int word = from >> 6; word >= 0; word--) {
+            uint64_t bits = occupancy[word];
+            if (word == from >> 6 && (from & 63) != 63) bits &= (2ULL << (from & 63)) - 1;
+            if (bits) return word * 64 + highestBit64(bits);
+        }
+        return -1;
+    }
+};
+
+// Новые рейтинги по формуле Эло; возвращает изменение рейтинга победителя
+inline int eloDelta(int winnerRating, int loserRating) {
+    double expected = 1.0 / (1.0 + std::pow(10.0, (loserRating - winnerRating) / 400.0));
+    return std::max(1, static_cast<int>(std::lround(ELO_K_FACTOR * (1.0 - expected))));
+}
+
+// Результат выстрела
+enum ShotResult {
+    SHOT_INVALID = 0,
+    SHOT_MISS = 1,
+    SHOT_REPEAT = 2,
+    SHOT_HIT = 3,
+    SHOT_SUNK = 4
+};
+
+// Сторона в партии без сетевой части: свое поле с кораблями и то, что
+// известно о поле соперника. На ней построены и игроки сервера, и партии
+// ботов турнира (см. Tournament)
+template <typename Rules>
+class BasicSide {
+public:
+    typedef typename Rules::Bitboard Bitboard;
+    typedef BasicShip<Rules> Ship;
+    typedef BasicShipMask<Rules> ShipMask;
+    typedef BasicShipMaskTable<Rules> ShipMaskTable;
+
+    BasicBoardMasks<Rules> board;
+    BasicBoardMasks<Rules> enemyView;
+    std::vector<Ship> ships;
+
+    BasicSide() {
+        ships.reserve(Rules::NUM_SHIPS);
+    }
+
+    // Пустые поля для новой партии
+    void reset() {
+        board.clear();
+        enemyView.clear();
+        ships.clear();
+    }
+
+    // Корабль нельзя ставить на занятые клетки и вплотную к другим кораблям
+    bool placeShip(int size, int x, int y, bool horizontal) {
+        if (size < 1 || size > Rules::MAX_SHIP_SIZE || x < 0 || x >= Rules::BOARD_SIZE || y < 0 || y >= Rules::BOARD_SIZE) {
+            return false;
+        }
+
+        const ShipMask& mask = ShipMaskTable::get(size, horizontal, x, y);
+        if (!mask.fits) return false;
+        if ((mask.body & board.occupied()).any()) return false;
+        if ((mask.halo & board[SHIP]).any()) return false;
+
+        addShip(size, x, y, horizontal, mask);
+        return true;
+    }
+
+    void addShip(int size, int x, int y, bool horizontal, const ShipMask& mask) {
+        Ship ship{ size, 0, horizontal, x, y, mask.body, mask.halo };
+        ships.push_back(ship);
+        board[SHIP] |= mask.body;
+    }
+
+    // Каждый корабль ставится равновероятно на одну из допустимых позиций.
+    // Допустимые клетки начала считаются сдвигами маски занятых клеток, а
+    // тупиков не бывает (noDeadEnds в GameRules), поэтому случайные попытки с
+    // отказами и перезапуски не нужны. Уже поставленные корабли - начало флота
+    // в порядке Rules::SHIP_SIZES - остаются на месте.
+    void autoPlaceShips() {
+        autoPlaceShips(FastRandom::local());
+    }
+
+    void autoPlaceShips(FastRandom& random) {
+        Bitboard blocked;
+        for (const auto& ship : ships) {
+            blocked |= ship.halo;
+        }
+
+        for (int i = static_cast<int>(ships.size()); i < Rules::NUM_SHIPS; i++) {
+            int size = Rules::SHIP_SIZES[i];
+            Bitboard horizontalStarts = ShipMaskTable::legalStarts(size, true, blocked);
+            Bitboard verticalStarts = size > 1 ? ShipMaskTable::legalStarts(size, false, blocked) : Bitboard();
+            int horizontalCount = horizontalStarts.count();
+            int total = horizontalCount + verticalStarts.count();
+
+            int choice = static_cast<int>(random.below(static_cast<uint32_t>(total)));
+            bool horizontal = choice < horizontalCount;
+            int cell = horizontal ? horizontalStarts.select(choice) : verticalStarts.select(choice - horizontalCount);
+
+            const ShipMask& mask = ShipMaskTable::get(size, horizontal, cell);
+            addShip(size, cell % Rules::BOARD_SIZE, cell / Rules::BOARD_SIZE, horizontal, mask);
+            blocked |= mask.halo;
+        }
+    }
+
+    bool allShipsSunk() {
+        return board[SHIP].none() && board[HIT].none();
+    }
+
+    // Ореол потопленного корабля помечается промахами на обоих полях
+    void markMissesAroundSunkShip(const Ship& ship, BasicSide* opponent) {
+        Bitboard misses = ship.halo & ~ship.body & board.empty();
+        board[MISS] |= misses;
+        opponent->enemyView[MISS] |= misses;
+    }
+
+    // Выстрел этой стороны по полю соперника; координаты уже проверены
+    ShotResult shootAt(BasicSide& opponent, int x, int y) {
+        ShotResult result = SHOT_REPEAT;
+        Bitboard target = Bitboard::cell(x, y);
+        if ((opponent.board[SHIP] & target).any()) {
+            opponent.board[SHIP] ^= target;
+            opponent.board[HIT] |= target;
+            enemyView[HIT] |= target;
+
+            for (auto& ship : opponent.ships) {
+                if ((ship.body & target).none()) continue;
+
+                ship.hits++;
+                if (ship.isSunk()) {
+                    opponent.board[HIT] &= ~ship.body;
+                    opponent.board[SUNK] |= ship.body;
+                    enemyView[HIT] &= ~ship.body;
+                    enemyView[SUNK] |= ship.body;
+
+                    opponent.markMissesAroundSunkShip(ship, this);
+                    result = SHOT_SUNK;
+                }
+                else {
+                    result = SHOT_HIT;
+                }
+                break;
+            }
+        }
+        else if ((opponent.board.empty() & target).any()) {
+            opponent.board[MISS] |= target;
+            enemyView[MISS] |= target;
+            result = SHOT_MISS;
+        }
+        return result;
+    }
+};
+
+typedef BasicSide<ClassicRules> Side;
+
+// Ход переходит к сопернику только после промаха
+inline bool passesTurn(ShotResult result) {
+    return result == SHOT_MISS;
+}
+
+// Новый срок хода дает только засчитанный выстрел. После повтора, как и после
+// неверного ввода, срок продолжает идти от начала хода
+inline bool restartsTurnDeadline(ShotResult result) {
+    return result != SHOT_REPEAT;
+}
+
+// Класс игрока
+class Player : public Side {
+public:
+    SOCKET socket;
+    bool ready;
+    std::string name;
+    bool connected;
+    int playerId;
+    sockaddr_in clientAddr;
+
+    // Сетевое состояние для цикла событий
+    Poller* poller;
+    RingBuffer inBuffer;
+    OutputQueue outBuffer;
+    Game* game;
+    bool closing;
+    bool binaryProtocol;
+    bool negotiated;
+
+    // Накопленный outBuffer отправляется один раз за итерацию цикла событий:
+    // safeSend ставит игрока в flushQueue шарда. Без очереди (игрок вне цикла
+    // событий) данные отправляются сразу. readPaused - ввод не читается, пока
+    // клиент не разберет отправленное (outBuffer выше OUTPUT_HIGH_WATER_BYTES)
+    std::vector<SlotHandle>* flushQueue;
+    bool flushScheduled;
+    bool readPaused;
+
+    // Поля в текстовом виде для текстового протокола (см. BoardText)
+    BoardText boardText;
+    BoardText enemyViewText;
+
+    // Состояние полей, последним отправленное клиенту бинарного протокола
+    BoardMasks sentBoard;
+    BoardMasks sentEnemyView;
+    std::chrono::steady_clock::time_point connectedAt;
+    std::chrono::steady_clock::time_point closeDeadline;
+
+    // Рейтинг сохраняется только для игроков, назвавших себя командой NAME
+    bool rated;
+    MatchTicket ticket;
+
+    // Ссылка на игрока в пуле сервера и таймер текущей стадии
+    // (выбор протокола или ожидание соперника)
+    SlotHandle handle;
+    TimerNode timer;
+
+    // Компьютерный соперник не имеет сокета и стреляет сразу, как только
+    // наступает его ход; wantsComputer - игрок попросил игру с компьютером
+    bool computer;
+    bool wantsComputer;
+
+    // wantsToWatch - клиент попросил смотреть партию watchGameId (0 - главную
+    // партию сервера); spectator - он уже подписан на партию как зритель
+    bool wantsToWatch;
+    bool spectator;
+    uint64_t watchGameId;
+
+    // resumeToken - токен, выданный игроку в начале партии, а у нового соединения
+    // с wantsToResume - токен партии, в которую оно просит вернуться.
+    // suspended - соединение потеряно, место игрока в партии ждет переподключения
+    std::string resumeToken;
+    bool wantsToResume;
+    bool suspended;
+
+    Player(SOCKET sock, const sockaddr_in& addr, int id, Poller* eventPoller = nullptr)
+        : socket(sock), ready(false), connected(true), playerId(id), clientAddr(addr),
+        poller(eventPoller), inBuffer(INPUT_BUFFER_SIZE), game(nullptr), closing(false), binaryProtocol(false), negotiated(false),
+        flushQueue(nullptr), flushScheduled(false), readPaused(false), boardText(true), enemyViewText(false),
+        connectedAt(std::chrono::steady_clock::now()), rated(false), ticket(this), timer(this),
+        computer(false), wantsComputer(false), wantsToWatch(false), spectator(false), watchGameId(0),
+        wantsToResume(false), suspended(false) {
+        name = "Player " + std::to_string(id);
+    }
+
+    ~Player() {
+        disconnect();
+    }
+
+    void disconnect() {
+        if (connected) {
+            connected = false;
+            if (poller && socket != INVALID_SOCKET) {
+                poller->remove(socket);
+            }
+            safeCloseSocket(socket);
+        }
+    }
+
+    // Игрок все еще в партии: подключен или ждет переподключения
+    bool present() const {
+        return connected || suspended;
+    }
+
+    std::string getIPAddress() const {
+        char ipStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, INET_ADDRSTRLEN);
+        return std::string(ipStr);
+    }
+
+    int getPort() const {
+        return ntohs(clientAddr.sin_port);
+    }
+
+    const BoardText& renderBoard() {
+        boardText.update(board);
+        return boardText;
+    }
+
+    const BoardText& renderEnemyView() {
+        enemyViewText.update(enemyView);
+        return enemyViewText;
+    }
+};
+
+// Итог игры для конкретного игрока
+enum GameOutcome {
+    OUTCOME_WIN = 0,
+    OUTCOME_LOSE = 1,
+    OUTCOME_ABORTED = 2
+};
+
+std::string shotResultText(ShotResult result) {
+    switch (result) {
+    case SHOT_MISS: return "MISS\n";
+    case SHOT_REPEAT: return "MISS: Already attacked this position\n";
+    case SHOT_HIT: return "HIT\n";
+    case SHOT_SUNK: return "HIT: Ship sunk!\n";
+    default: return "INVALID: Coordinates out of bounds\n";
+    }
+}
+
+// Формат журнала партий. Журнал - набор сегментов <каталог>/shard<N>-<номер>.nbj;
+// сегмент начинается с SegmentHeader, за которым подряд идут записи партий.
+// Поля little-endian и выровнены по своему размеру, длина каждой записи кратна 8,
+// поэтому читатель может отобразить сегмент в память (mmap) и переходить от записи
+// к записи по полю length без разбора и копирования. Последняя запись сегмента,
+// который еще пишется, может быть неполной: length сверяется с размером файла.
+namespace Journal {
+    const char MAGIC[4] = { 'N', 'B', 'J', '1' };
+    const uint16_t VERSION = 1;
+    const uint8_t NO_WINNER = 0xFF;
+    const size_t MAX_SHOTS = 1024;
+
+    struct SegmentHeader {
+        char magic[4];
+        uint16_t version;
+        uint16_t shard;
+        uint64_t createdUnixMs;
+        uint64_t reserved[2];
+    };
+
+    // Чем закончилась партия
+    enum Ending {
+        ENDING_SUNK = 0,      // потоплен весь флот
+        ENDING_FORFEIT = 1,   // игрок не сделал ход вовремя
+        ENDING_ABORTED = 2    // отключение, срыв расстановки, остановка сервера
+    };
+
+    enum RecordFlags {
+        FLAG_COMPUTER = 1,       // второй игрок - компьютер
+        FLAG_FIRST_RATED = 2,
+        FLAG_SECOND_RATED = 4,
+        FLAG_TRUNCATED = 8       // выстрелов больше MAX_SHOTS, записаны первые
+    };
+
+    // Заголовок записи; за ним идут корабли первого и второго игрока
+    // (shipCounts[0] + shipCounts[1] элементов ShipEntry), затем shotCount
+    // элементов ShotEntry и нулевое выравнивание до length
+    struct RecordHeader {
+        uint32_t length;
+        uint16_t shotCount;
+        uint8_t ending;
+        uint8_t winner;          // индекс игрока (0 или 1) или NO_WINNER
+        uint64_t gameId;
+        uint64_t startUnixMs;
+        uint32_t durationMs;
+        uint32_t playerIds[2];
+        uint8_t shipCounts[2];
+        uint8_t flags;
+        uint8_t reserved;
+    };
+
+    // Корабль: клетка начала (y * BOARD_SIZE + x), размер; старший бит shape - горизонтальный
+    struct ShipEntry {
+        uint8_t cell;
+        uint8_t shape;
+    };
+
+    // Выстрел: клетка, ShotResult в младших битах result и индекс стрелявшего
+    // в старшем; миллисекунды с предыдущего выстрела (с начала партии для первого)
+    struct ShotEntry {
+        uint8_t cell;
+        uint8_t result;
+        uint16_t delayMs;
+    };
+
+    static_assert(sizeof(SegmentHeader) == 32, "journal segment header layout");
+    static_assert(sizeof(RecordHeader) == 40, "journal record header layout");
+    static_assert(sizeof(ShipEntry) == 2 && sizeof(ShotEntry) == 4, "journal entry layout");
+}
+
+// Формат контрольной точки - снимка всех идущих партий, из которого новый
+// процесс сервера продолжает их после перезапуска. Файл - FileHeader и
+// gameCount записей; запись - GameEntry с тем, чего нет в журнале (чей ход,
+// имена, рейтинги, токены возвращения), и следом запись журнала этой партии
+// (Journal::RecordHeader, корабли, выстрелы). Клетки полей не хранятся: они
+// восстанавливаются повторным розыгрышем выстрелов, как при --verify.
+// Длины записей кратны 8, файл читается через отображение в память
+namespace Checkpoint {
+    const char MAGIC[4] = { 'N', 'B', 'C', '1' };
+    const uint16_t VERSION = 1;
+
+    struct FileHeader {
+        char magic[4];
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t gameCount;
+        uint32_t nextPlayerId;   // счетчики номеров продолжаются в новом процессе
+        uint64_t nextGameId;
+        uint64_t createdUnixMs;
+    };
+
+    struct GameEntry {
+        uint32_t length;         // вместе со следующей за ней записью журнала
+        uint8_t currentPlayer;   // индекс игрока (0 или 1), чей ход
+        uint8_t reserved[3];
+        int32_t ratings[2];
+        char names[2][MAX_PLAYER_NAME];          // без завершающего нуля, если имя во всю длину
+        char resumeTokens[2][MAX_RESUME_TOKEN];
+    };
+
+    static_assert(sizeof(FileHeader) == 32, "checkpoint file header layout");
+    static_assert(sizeof(GameEntry) % 8 == 0, "checkpoint entry alignment");
+}
+
+// Фазы игры, через которые ее проводит цикл событий сервера
+enum GamePhase {
+    PHASE_SETUP = 0,
+    PHASE_WAITING_READY = 1,
+    PHASE_TURN = 2,
+    PHASE_GAME_OVER = 3
+};
+
+// Класс игры
+class Game {
+public:
+    Player* player1;
+    Player* player2;
+    bool gameStarted;
+    bool gameOver;
+    Player* currentPlayer;
+    std::atomic<bool> active;
+    GamePhase phase;
+
+    // Ссылка на игру в пуле сервера и список, куда игра заносит себя при
+    // завершении: сервер освобождает ее сразу после обработки текущих событий
+    SlotHandle handle;
+    std::vector<Game*>* retiredGames;
+
+    // Срок расстановки кораблей, затем срок текущего хода
+    TimerNode timer;
+
+    // Для журнала: номер и время начала партии, выстрелы и итог
+    uint64_t id;
+    std::chrono::system_clock::time_point startedAt;
+    std::chrono::steady_clock::time_point startedClock;
+    std::chrono::steady_clock::time_point lastShotAt;
+    std::vector<Journal::ShotEntry> shots;
+    uint8_t ending;
+    uint8_t winner;
+
+    // Зрители партии; ссылки ушедших зрителей удаляются при следующей рассылке
+    std::vector<SlotHandle> spectators;
+
+    Game(Player* p1, Player* p2, std::vector<Game*>* retired = nullptr)
+        : player1(p1), player2(p2), gameStarted(false), gameOver(false),
+        currentPlayer(p1), active(true), phase(PHASE_SETUP), retiredGames(retired), timer(this),
+        id(0), startedAt(std::chrono::system_clock::now()), startedClock(std::chrono::steady_clock::now()),
+        lastShotAt(startedClock), ending(Journal::ENDING_ABORTED), winner(Journal::NO_WINNER) {
+        shots.reserve(BOARD_CELLS);
+    }
+
+    ~Game() {
+        endGame("Game terminated");
+    }
+
+    bool bothReady() {
+        return player1->ready && player2->ready && player1->present() && player2->present();
+    }
+
+    void switchTurn() {
+        currentPlayer = (currentPlayer == player1) ? player2 : player1;
+    }
+
+    Player* getOpponent() {
+        return (currentPlayer == player1) ? player2 : player1;
+    }
+
+    // Выстрел текущего игрока по полю соперника
+    ShotResult fireShot(int x, int y) {
+        Player* opponent = getOpponent();
+
+        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+            return SHOT_INVALID;
+        }
+
+        ShotResult result = currentPlayer->shootAt(*opponent, x, y);
+        if (opponent->allShipsSunk()) {
+            gameOver = true;
+        }
+        return result;
+    }
+
+    std::string processShot(int x, int y) {
+        return shotResultText(fireShot(x, y));
+    }
+
+    // Запоминает выстрел текущего игрока для журнала
+    void recordShot(int x, int y, ShotResult result) {
+        if (shots.size() >= Journal::MAX_SHOTS) return;
+
+        auto now = std::chrono::steady_clock::now();
+        long long delay = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastShotAt).count();
+        lastShotAt = now;
+
+        Journal::ShotEntry entry;
+        entry.cell = static_cast<uint8_t>(y * BOARD_SIZE + x);
+        entry.result = static_cast<uint8_t>(result | (currentPlayer == player1 ? 0 : 0x80));
+        entry.delayMs = static_cast<uint16_t>(std::min(delay, 0xFFFFLL));
+        shots.push_back(entry);
+    }
+
+    // Итог для журнала: индекс победителя и причина окончания
+    void setResult(Journal::Ending gameEnding, const Player* gameWinner) {
+        ending = static_cast<uint8_t>(gameEnding);
+        winner = gameWinner == player1 ? 0 : gameWinner == player2 ? 1 : Journal::NO_WINNER;
+    }
+
+    bool checkConnections() {
+        if (!player1->present() || !player2->present()) {
+            gameOver = true;
+            return false;
+        }
+        return true;
+    }
+
+    // Помечает игру завершенной; возвращает false, если она уже была завершена
+    bool retire() {
+        if (!active.exchange(false)) return false;
+
+        gameOver = true;
+        phase = PHASE_GAME_OVER;
+        if (retiredGames) {
+            retiredGames->push_back(this);
+        }
+        return true;
+    }
+
+    void endGame(const std::string& reason) {
+        if (!retire()) return;
+
+        if (player1->connected) {
+            sendGameOver(player1, OUTCOME_ABORTED, "GAME_OVER: " + reason + "\n");
+        }
+        if (player2->connected) {
+            sendGameOver(player2, OUTCOME_ABORTED, "GAME_OVER: " + reason + "\n");
+        }
+    }
+};
+
+// Журнал партий с отдельным потоком записи. Цикл событий только кодирует
+// завершенную партию в буфер в памяти и передает накопленное потоку записи,
+// когда набирается JOURNAL_FLUSH_BYTES или проходит JOURNAL_FLUSH_INTERVAL_MS;
+// файловые операции в цикл событий не попадают. Буферы ходят по кругу между
+// потоками, поэтому в установившемся режиме запись не выделяет памяти.
+// У каждого шарда свой журнал со своими сегментами.
+class JournalWriter {
+public:
+    JournalWriter()
+        : shard(0), enabled(false), stopping(false), file(nullptr), segmentNumber(0), segmentSize(0),
+        records(0), written(0), lastHandOff(std::chrono::steady_clock::now()) {
+    }
+
+    ~JournalWriter() {
+        close();
+    }
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    // Первый сегмент открывается сразу, чтобы ошибка была видна при запуске
+    bool open(const std::string& journalDirectory, int shardIndex) {
+        directory = journalDirectory;
+        shard = shardIndex;
+        makeDirectory(directory);
+        if (!openSegment()) return false;
+
+        enabled = true;
+        stopping = false;
+        writer = std::thread(&JournalWriter::writerLoop, this);
+        return true;
+    }
+
+    // Дописывает все переданные записи и останавливает поток записи
+    void close() {
+        if (!enabled) return;
+
+        handOff();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+        closeSegment();
+        enabled = false;
+    }
+
+    bool isOpen() const {
+        return enabled;
+    }
+
+    const std::string& path() const {
+        return directory;
+    }
+
+    uint64_t recordCount() const {
+        return records;
+    }
+
+    uint64_t bytesWritten() const {
+        return written;
+    }
+
+    // Вызывается циклом событий для каждой завершенной партии
+    void append(const Game& game) {
+        if (!enabled) return;
+
+        encode(game, pending);
+        records++;
+        if (pending.size() >= JOURNAL_FLUSH_BYTES) {
+            handOff();
+        }
+    }
+
+    // Записи не задерживаются в памяти дольше JOURNAL_FLUSH_INTERVAL_MS
+    void flushIfDue(std::chrono::steady_clock::time_point now) {
+        if (!pending.empty() && now - lastHandOff >= std::chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS)) {
+            handOff();
+        }
+    }
+
+    static void encode(const Game& game, std::vector<char>& out);
+
+private:
+    std::string directory;
+    int shard;
+    bool enabled;
+    bool stopping;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+
+    // pending заполняет цикл событий, queued ждет потока записи
+    std::vector<char> pending;
+    std::vector<char> queued;
+
+    // Текущий сегмент; используется только потоком записи (и open/close)
+    std::FILE* file;
+    int segmentNumber;
+    uint64_t segmentSize;
+
+    std::atomic<uint64_t> records;
+    std::atomic<uint64_t> written;
+    std::chrono::steady_clock::time_point lastHandOff;
+
+    static void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+        _mkdir(path.c_str());
+#else
+        mkdir(path.c_str(), 0755);
+#endif
+    }
+
+    void handOff() {
+        lastHandOff = std::chrono::steady_clock::now();
+        if (pending.empty()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queued.empty()) {
+                queued.swap(pending);
+            }
+            else {
+                queued.insert(queued.end(), pending.begin(), pending.end());
+                pending.clear();
+            }
+        }
+        wakeup.notify_one();
+    }
+
+    void writerLoop() {
+        Trace::nameThread("journal writer");
+        std::vector<char> writing;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this]() { return !queued.empty() || stopping; });
+                if (queued.empty()) return;
+                writing.swap(queued);
+            }
+            {
+                Trace::Span span("journal write");
+                writeRecords(writing);
+            }
+            writing.clear();
+        }
+    }
+
+    // Сегмент переключается только на границе записей
+    void writeRecords(const std::vector<char>& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            size_t end = offset;
+            uint64_t size = segmentSize;
+            while (end < data.size()) {
+                uint32_t length;
+                std::memcpy(&length, data.data() + end, sizeof(length));
+                if (size > sizeof(Journal::SegmentHeader) && size + length > JOURNAL_SEGMENT_BYTES) break;
+                size += length;
+                end += length;
+            }
+
+            if (end > offset) {
+                if (file && std::fwrite(data.data() + offset, 1, end - offset, file) == end - offset) {
+                    written += end - offset;
+                }
+                else {
+                    std::cerr << "Journal write failed, " << (end - offset) << " bytes lost\n";
+                }
+                segmentSize = size;
+                offset = end;
+            }
+
+            if (offset < data.size()) {
+                closeSegment();
+                openSegment();
+            }
+        }
+
+        if (file) {
+            std::fflush(file);
+        }
+    }
+
+    // Новый сегмент получает первый свободный номер: прежние сегменты не перезаписываются
+    bool openSegment() {
+        std::string name;
+        while (true) {
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), "-%06d.nbj", ++segmentNumber);
+            name = directory + "/shard" + std::to_string(shard) + suffix;
+
+            std::FILE* existing = std::fopen(name.c_str(), "rb");
+            if (!existing) break;
+            std::fclose(existing);
+        }
+
+        file = std::fopen(name.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Failed to create journal segment " << name << "\n";
+            return false;
+        }
+
+        Journal::SegmentHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Journal::MAGIC, sizeof(header.magic));
+        header.version = Journal::VERSION;
+        header.shard = static_cast<uint16_t>(shard);
+        header.createdUnixMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+            std::cerr << "Failed to write journal segment header " << name << "\n";
+            closeSegment();
+            return false;
+        }
+
+        segmentSize = sizeof(header);
+        written += sizeof(header);
+        return true;
+    }
+
+    void closeSegment() {
+        if (file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+};
+
+void JournalWriter::encode(const Game& game, std::vector<char>& out) {
+    const Player* players[2] = { game.player1, game.player2 };
+    size_t shipCount = players[0]->ships.size() + players[1]->ships.size();
+    size_t shotCount = game.shots.size();
+    size_t length = sizeof(Journal::RecordHeader) + shipCount * sizeof(Journal::ShipEntry) +
+        shotCount * sizeof(Journal::ShotEntry);
+    length = (length + 7) & ~static_cast<size_t>(7);
+
+    Journal::RecordHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.length = static_cast<uint32_t>(length);
+    header.shotCount = static_cast<uint16_t>(shotCount);
+    header.ending = game.ending;
+    header.winner = game.winner;
+    header.gameId = game.id;
+    header.startUnixMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        game.startedAt.time_since_epoch()).count());
+    header.durationMs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - game.startedClock).count());
+    for (int i = 0; i < 2; i++) {
+        header.playerIds[i] = static_cast<uint32_t>(players[i]->playerId);
+        header.shipCounts[i] = static_cast<uint8_t>(players[i]->ships.size());
+        if (players[i]->computer) header.flags |= Journal::FLAG_COMPUTER;
+        if (players[i]->rated) header.flags |= i == 0 ? Journal::FLAG_FIRST_RATED : Journal::FLAG_SECOND_RATED;
+    }
+    if (shotCount >= Journal::MAX_SHOTS) header.flags |= Journal::FLAG_TRUNCATED;
+
+    size_t offset = out.size();
+    out.resize(offset + length);
+    char* cursor = &out[offset];
+    std::memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+
+    for (const Player* player : players) {
+        for (const auto& ship : player->ships) {
+            Journal::ShipEntry entry;
+            entry.cell = static_cast<uint8_t>(ship.y * BOARD_SIZE + ship.x);
+            entry.shape = static_cast<uint8_t>(ship.size | (ship.horizontal ? 0x80 : 0));
+            std::memcpy(cursor, &entry, sizeof(entry));
+            cursor += sizeof(entry);
+        }
+    }
+
+    if (shotCount > 0) {
+        std::memcpy(cursor, game.shots.data(), shotCount * sizeof(Journal::ShotEntry));
+    }
+}
+
+// Файл, отображенный в память только для чтения
+class MappedFile {
+public:
+    MappedFile() : base(nullptr), length(0) {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = nullptr;
+#endif
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+        base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) return false;
+
+        madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        base = static_cast<const char*>(address);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap(const_cast<char*>(base), length);
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const char* base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+// Запись контрольной точки (см. Checkpoint). Файл пишется целиком через
+// отображение в память во временный файл, сбрасывается на диск и только
+// потом заменяет прежний переименованием; после переименования на диск
+// сбрасывается и каталог. Поэтому ни падение процесса, ни отключение питания
+// не оставляют вместо точки пустой или наполовину записанный файл
+class CheckpointFile {
+public:
+    // GameEntry и следом запись журнала партии
+    static void encodeGame(const Game& game, std::vector<char>& out) {
+        const Player* players[2] = { game.player1, game.player2 };
+        Checkpoint::GameEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.currentPlayer = game.currentPlayer == game.player1 ? 0 : 1;
+        for (int i = 0; i < 2; i++) {
+            entry.ratings[i] = players[i]->ticket.rating;
+            players[i]->name.copy(entry.names[i], MAX_PLAYER_NAME);
+            players[i]->resumeToken.copy(entry.resumeTokens[i], MAX_RESUME_TOKEN);
+        }
+
+        size_t offset = out.size();
+        out.resize(offset + sizeof(entry));
+        JournalWriter::encode(game, out);
+        entry.length = static_cast<uint32_t>(out.size() - offset);
+        std::memcpy(&out[offset], &entry, sizeof(entry));
+    }
+
+    static bool write(const std::string& path, const std::vector<char>& data) {
+        std::string temporary = path + ".tmp";
+        bool written = false;
+#ifdef _WIN32
+        HANDLE file = CreateFileA(temporary.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        uint64_t size = data.size();
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, data.size()) : nullptr;
+        if (view) {
+            std::memcpy(view, data.data(), data.size());
+            written = FlushViewOfFile(view, data.size()) != 0;
+            written = UnmapViewOfFile(view) != 0 && written;
+        }
+        if (mapping) CloseHandle(mapping);
+        written = written && FlushFileBuffers(file) != 0;
+        CloseHandle(file);
+        // MOVEFILE_WRITE_THROUGH возвращает управление, когда переименование уже на диске
+        return written && MoveFileExA(temporary.c_str(), path.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        if (ftruncate(fd, static_cast<off_t>(data.size())) == 0) {
+            void* address = mmap(nullptr, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED) {
+                std::memcpy(address, data.data(), data.size());
+                written = msync(address, data.size(), MS_SYNC) == 0;
+                written = munmap(address, data.size()) == 0 && written;
+            }
+        }
+        written = written && fsync(fd) == 0;
+        ::close(fd);
+        if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) return false;
+
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int directoryFd = ::open(directory.c_str(), O_RDONLY);
+        if (directoryFd < 0) return false;
+        bool synced = fsync(directoryFd) == 0;
+        ::close(directoryFd);
+        return synced;
+#endif
+    }
+};
+
+// Имена сегментов журнала (*.nbj) в каталоге, по возрастанию
+std::vector<std::string> listJournalSegments(const std::string& directory) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE search = FindFirstFileA((directory + "/*.nbj").c_str(), &entry);
+    if (search != INVALID_HANDLE_VALUE) {
+        do {
+            names.push_back(directory + "/" + entry.cFileName);
+        } while (FindNextFileA(search, &entry));
+        FindClose(search);
+    }
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (dir) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".nbj") == 0) {
+                names.push_back(directory + "/" + name);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// Пакетный анализ журнала партий. Сегменты отображаются в память, записи
+// делятся на порции по ANALYSIS_CHUNK_RECORDS, и потоки (по числу ядер)
+// разбирают порции, накапливая каждый свою частичную статистику; в конце
+// частичные результаты складываются. С verify каждая партия заново
+// разыгрывается правилами сервера (Player::placeShip, Game::fireShot),
+// и результаты выстрелов сверяются с записанными.
+class JournalAnalyzer {
+public:
+    static const size_t ANALYSIS_CHUNK_RECORDS = 2048;
+    static const size_t DELAY_BUCKETS = 0x10000;
+
+    // Частичная статистика одного потока
+    struct Stats {
+        uint64_t games;
+        uint64_t shots;
+        uint64_t endings[3];
+        uint64_t humanDecided;
+        uint64_t firstMoverWins;
+        uint64_t computerDecided;
+        uint64_t computerWins;
+        uint64_t truncated;
+        uint64_t replayed;
+        uint64_t mismatches;
+        uint64_t cellShots[BOARD_CELLS];
+        uint64_t cellHits[BOARD_CELLS];
+        std::vector<uint64_t> lengths;  // число партий по числу выстрелов
+        std::vector<uint64_t> delays;   // число ходов людей по задержке в мс
+
+        Stats()
+            : games(0), shots(0), humanDecided(0), firstMoverWins(0), computerDecided(0), computerWins(0),
+            truncated(0), replayed(0), mismatches(0), lengths(Journal::MAX_SHOTS + 1, 0), delays(DELAY_BUCKETS, 0) {
+            for (int i = 0; i < 3; i++) endings[i] = 0;
+            for (int i = 0; i < BOARD_CELLS; i++) cellShots[i] = cellHits[i] = 0;
+        }
+
+        void merge(const Stats& other) {
+            games += other.games;
+            shots += other.shots;
+            for (int i = 0; i < 3; i++) endings[i] += other.endings[i];
+            humanDecided += other.humanDecided;
+            firstMoverWins += other.firstMoverWins;
+            computerDecided += other.computerDecided;
+            computerWins += other.computerWins;
+            truncated += other.truncated;
+            replayed += other.replayed;
+            mismatches += other.mismatches;
+            for (int i = 0; i < BOARD_CELLS; i++) {
+                cellShots[i] += other.cellShots[i];
+                cellHits[i] += other.cellHits[i];
+            }
+            for (size_t i = 0; i < lengths.size(); i++) lengths[i] += other.lengths[i];
+            for (size_t i = 0; i < delays.size(); i++) delays[i] += other.delays[i];
+        }
+    };
+
+    // Разбирает все сегменты каталога и печатает отчет; false, если читать нечего
+    static bool run(const std::string& directory, bool verify) {
+        auto started = std::chrono::steady_clock::now();
+
+        std::vector<std::string> names = listJournalSegments(directory);
+        std::vector<std::unique_ptr<MappedFile>> segments;
+        uint64_t totalBytes = 0;
+        for (const auto& name : names) {
+            std::unique_ptr<MappedFile> segment(new MappedFile());
+            if (!segment->open(name) || !validHeader(*segment)) {
+                std::cerr << "Skipping " << name << ": not a journal segment\n";
+                continue;
+            }
+            totalBytes += segment->size();
+            segments.push_back(std::move(segment));
+        }
+        if (segments.empty()) {
+            std::cout << "No journal segments found in " << directory << "\n";
+            return false;
+        }
+
+        // Порции записей; заголовки читаются последовательно, содержимое - параллельно
+        std::vector<Chunk> chunks;
+        uint64_t damaged = 0;
+        for (const auto& segment : segments) {
+            if (!splitSegment(segment->data(), segment->size(), chunks)) damaged++;
+        }
+
+        unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+        threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, std::max<size_t>(1, chunks.size())));
+        std::vector<Stats> partials(threadCount);
+        std::atomic<size_t> nextChunk(0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threadCount; t++) {
+            workers.emplace_back([&chunks, &partials, &nextChunk, verify, t]() {
+                Replayer replayer;
+                Stats& stats = partials[t];
+                for (size_t i = nextChunk++; i < chunks.size(); i = nextChunk++) {
+                    const Chunk& chunk = chunks[i];
+                    for (const char* record = chunk.begin; record < chunk.end;) {
+                        Journal::RecordHeader header;
+                        std::memcpy(&header, record, sizeof(header));
+                        analyzeRecord(header, record, stats);
+                        if (verify) replayer.replay(header, record, stats);
+                        record += header.length;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        Stats total;
+        for (const auto& partial : partials) total.merge(partial);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        printReport(directory, total, segments.size(), totalBytes, damaged, threadCount, seconds, verify);
+        return true;
+    }
+
+private:
+    struct Chunk {
+        const char* begin;
+        const char* end;
+    };
+
+    // Повторный розыгрыш партий правилами сервера на сторонах без сокетов;
+    // стороны переиспользуются
+    class Replayer {
+    public:
+        void replay(const Journal::RecordHeader& header, const char* record, Stats& stats) {
+            const char* cursor = record + sizeof(header);
+            bool consistent = true;
+            for (int i = 0; i < 2; i++) {
+                sides[i].reset();
+                for (int s = 0; s < header.shipCounts[i]; s++) {
+                    Journal::ShipEntry ship;
+                    std::memcpy(&ship, cursor, sizeof(ship));
+                    cursor += sizeof(ship);
+                    int size = ship.shape & 0x7F;
+                    bool horizontal = (ship.shape & 0x80) != 0;
+                    consistent &= ship.cell < BOARD_CELLS &&
+                        sides[i].placeShip(size, ship.cell % BOARD_SIZE, ship.cell / BOARD_SIZE, horizontal);
+                }
+            }
+
+            for (int s = 0; s < header.shotCount && consistent; s++) {
+                Journal::ShotEntry shot;
+                std::memcpy(&shot, cursor, sizeof(shot));
+                cursor += sizeof(shot);
+                int shooter = shot.result >> 7;
+                consistent = shot.cell < BOARD_CELLS && sides[shooter].shootAt(sides[1 - shooter],
+                    shot.cell % BOARD_SIZE, shot.cell / BOARD_SIZE) == (shot.result & 0x7F);
+            }
+            if (consistent && header.ending == Journal::ENDING_SUNK && header.winner < 2) {
+                consistent = sides[1 - header.winner].allShipsSunk();
+            }
+
+            stats.replayed++;
+            if (!consistent) stats.mismatches++;
+        }
+
+    private:
+        Side sides[2];
+    };
+
+    static bool validHeader(const MappedFile& segment) {
+        if (segment.size() < sizeof(Journal::SegmentHeader)) return false;
+        Journal::SegmentHeader header;
+        std::memcpy(&header, segment.data(), sizeof(header));
+        return std::memcmp(header.magic, Journal::MAGIC, sizeof(header.magic)) == 0 && header.version == Journal::VERSION;
+    }
+
+    // Делит сегмент на порции целых записей; false, если встретилась
+    // поврежденная запись (все записи после нее пропускаются)
+    static bool splitSegment(const char* data, size_t size, std::vector<Chunk>& chunks) {
+        size_t offset = sizeof(Journal::SegmentHeader);
+        Chunk chunk{ data + offset, data + offset };
+        size_t inChunk = 0;
+        bool intact = true;
+        while (size - offset >= sizeof(Journal::RecordHeader)) {
+            Journal::RecordHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            size_t expected = sizeof(header) + (header.shipCounts[0] + header.shipCounts[1]) * sizeof(Journal::ShipEntry) +
+                header.shotCount * sizeof(Journal::ShotEntry);
+            if (header.length % 8 != 0 || header.length < expected || header.length > size - offset) {
+                // Недописанная последняя запись активного сегмента - не повреждение
+                intact = header.length % 8 == 0 && header.length >= expected;
+                break;
+            }
+
+            offset += header.length;
+            chunk.end = data + offset;
+            if (++inChunk == ANALYSIS_CHUNK_RECORDS) {
+                chunks.push_back(chunk);
+                chunk.begin = chunk.end;
+                inChunk = 0;
+            }
+        }
+        if (inChunk > 0) chunks.push_back(chunk);
+        return intact;
+    }
+
+    static void analyzeRecord(const Journal::RecordHeader& header, const char* record, Stats& stats) {
+        stats.games++;
+        stats.shots += header.shotCount;
+        if (header.ending < 3) stats.endings[header.ending]++;
+        stats.lengths[std::min<size_t>(header.shotCount, Journal::MAX_SHOTS)]++;
+        if (header.flags & Journal::FLAG_TRUNCATED) stats.truncated++;
+
+        bool computerGame = (header.flags & Journal::FLAG_COMPUTER) != 0;
+        if (header.winner < 2) {
+            if (computerGame) {
+                stats.computerDecided++;
+                stats.computerWins += header.winner == 1;
+            }
+            else {
+                stats.humanDecided++;
+                stats.firstMoverWins += header.winner == 0;
+            }
+        }
+
+        const char* cursor = record + sizeof(header) +
+            (header.shipCounts[0] + header.shipCounts[1]) * sizeof(Journal::ShipEntry);
+        for (int s = 0; s < header.shotCount; s++) {
+            Journal::ShotEntry shot;
+            std::memcpy(&shot, cursor, sizeof(shot));
+            cursor += sizeof(shot);
+
+            int cell = shot.cell < BOARD_CELLS ? shot.cell : 0;
+            int result = shot.result & 0x7F;
+            stats.cellShots[cell]++;
+            stats.cellHits[cell] += result == SHOT_HIT || result == SHOT_SUNK;
+
+            // Ходы компьютера (второй игрок в играх с компьютером) мгновенны
+            // и в распределение времени хода не входят
+            if (!computerGame || !(shot.result & 0x80)) {
+                stats.delays[shot.delayMs]++;
+            }
+        }
+    }
+
+    static uint64_t percentile(const std::vector<uint64_t>& counts, double p) {
+        uint64_t total = 0;
+        for (uint64_t count : counts) total += count;
+        if (total == 0) return 0;
+
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(total * p / 100.0)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) return i;
+        }
+        return counts.size() - 1;
+    }
+
+    static double share(uint64_t part, uint64_t whole) {
+        return whole ? part * 100.0 / whole : 0.0;
+    }
+
+    static void printReport(const std::string& directory, const Stats& stats, size_t segments, uint64_t bytes,
+        uint64_t damaged, unsigned threads, double seconds, bool verify) {
+        std::cout << "\n=== Journal analysis: " << directory << " ===\n";
+        std::cout << "Segments: " << segments << " (" << bytes / 1024 << " KB)";
+        if (damaged) std::cout << ", " << damaged << " damaged";
+        std::cout << "\n";
+        std::cout << "Games: " << stats.games << ", shots: " << stats.shots << "\n";
+        std::cout << "Processed in " << seconds * 1000 << " ms on " << threads << " threads: "
+            << static_cast<long long>(stats.shots / std::max(seconds, 1e-9)) << " shots/sec\n";
+        std::cout << "Endings: fleet sunk " << stats.endings[Journal::ENDING_SUNK]
+            << ", out of time " << stats.endings[Journal::ENDING_FORFEIT]
+            << ", aborted " << stats.endings[Journal::ENDING_ABORTED] << "\n";
+
+        double mean = stats.games ? static_cast<double>(stats.shots) / stats.games : 0.0;
+        std::cout << "Game length (shots): mean " << mean << ", p50 " << percentile(stats.lengths, 50)
+            << ", p90 " << percentile(stats.lengths, 90) << ", p99 " << percentile(stats.lengths, 99)
+            << ", max " << percentile(stats.lengths, 100) << "\n";
+        std::cout << "First mover wins: " << share(stats.firstMoverWins, stats.humanDecided) << "% of "
+            << stats.humanDecided << " decided games between players\n";
+        std::cout << "Computer wins: " << share(stats.computerWins, stats.computerDecided) << "% of "
+            << stats.computerDecided << " decided games against the computer\n";
+        std::cout << "Time per move (ms): p50 " << percentile(stats.delays, 50)
+            << ", p90 " << percentile(stats.delays, 90) << ", p99 " << percentile(stats.delays, 99) << "\n";
+
+        std::cout << "Hit rate by cell (%):\n";
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            std::cout << "  ";
+            for (int x = 0; x < BOARD_SIZE; x++) {
+                int cell = y * BOARD_SIZE + x;
+                char value[16];
+                std::snprintf(value, sizeof(value), "%5.1f", share(stats.cellHits[cell], stats.cellShots[cell]));
+                std::cout << value;
+            }
+            std::cout << "\n";
+        }
+
+        if (stats.truncated) {
+            std::cout << "Games with truncated shot lists: " << stats.truncated << "\n";
+        }
+        if (verify) {
+            std::cout << "Replay: " << stats.replayed << " games re-simulated, "
+                << stats.mismatches << " disagree with the recorded results\n";
+        }
+        std::cout << "=========================\n\n";
+    }
+};
+
+// Компактный бинарный протокол BIN1. Клиент включает его строкой "PROTO BIN1",
+// сервер подтверждает строкой "PROTO BIN1 OK", после которой все сообщения
+// этому клиенту идут кадрами. Клиенты, не приславшие PROTO, работают по
+// прежнему текстовому протоколу.
+// Кадр: длина нагрузки (uint16, big-endian), код операции (uint8), нагрузка.
+namespace Protocol {
+    const std::string BINARY_HELLO = "PROTO BIN1";
+    const std::string BINARY_ACCEPTED = "PROTO BIN1 OK\n";
+    const std::string NAME_COMMAND = "NAME ";
+    const std::string COMPUTER_COMMAND = "PLAY COMPUTER";
+    const std::string WATCH_COMMAND = "WATCH";
+    const std::string RESUME_COMMAND = "RESUME ";
+    const std::string RESUME_TOKEN_LINE = "RESUME_TOKEN ";
+    const size_t FRAME_HEADER_SIZE = 3;
+    const size_t MAX_FRAME_PAYLOAD = 1024;
+    const size_t PACKED_BOARD_SIZE = BOARD_CELLS / 2;
+
+    enum Opcode {
+        // Сервер -> клиент
+        OP_TEXT = 0x01,       // информационное сообщение (текст)
+        OP_BOARD = 0x02,      // свое поле после расстановки (упакованное)
+        OP_TURN = 0x03,       // флаг "ваш ход"
+        OP_RESULT = 0x04,     // стрелял ли сам игрок, клетка, ShotResult
+        OP_GAME_OVER = 0x05,  // GameOutcome, текст
+        OP_ERROR = 0x06,      // ошибка хода (текст)
+        OP_SNAPSHOT = 0x07,   // свое поле и вид поля соперника целиком (упакованные)
+        OP_DELTA = 0x08,      // изменившиеся клетки: [число, (клетка, CellState)...] для каждого поля
+        OP_RESUME_TOKEN = 0x09,  // токен для возвращения в партию после обрыва (RESUME <токен>)
+        // Клиент -> сервер
+        OP_SHOT = 0x10,       // клетка y * BOARD_SIZE + x
+        OP_SYNC = 0x11        // запрос OP_SNAPSHOT
+    };
+
+    std::string frame(uint8_t opcode, const std::string& payload = std::string()) {
+        std::string result;
+        result.reserve(FRAME_HEADER_SIZE + payload.size());
+        result += static_cast<char>((payload.size() >> 8) & 0xFF);
+        result += static_cast<char>(payload.size() & 0xFF);
+        result += static_cast<char>(opcode);
+        result += payload;
+        return result;
+    }
+
+    // Поле упаковывается по 4 бита (CellState) на клетку
+    void appendPackedBoard(std::string& out, const BoardMasks& board, bool showShips) {
+        for (int i = 0; i < BOARD_CELLS; i += 2) {
+            int low = board.at(i % BOARD_SIZE, i / BOARD_SIZE);
+            int high = board.at((i + 1) % BOARD_SIZE, (i + 1) / BOARD_SIZE);
+            if (!showShips && low == SHIP) low = EMPTY;
+            if (!showShips && high == SHIP) high = EMPTY;
+            out += static_cast<char>(low | (high << 4));
+        }
+    }
+
+    // Клетки, состояние которых отличается в двух версиях поля
+    Bitboard changedCells(const BoardMasks& current, const BoardMasks& previous) {
+        Bitboard changed;
+        for (int state = SHIP; state < CELL_STATE_COUNT; state++) {
+            changed |= current.cells[state] ^ previous.cells[state];
+        }
+        return changed;
+    }
+
+    void appendDelta(std::string& out, const BoardMasks& board, Bitboard changed) {
+        out += static_cast<char>(changed.count());
+        while (changed.any()) {
+            int cell = changed.popLowest();
+            out += static_cast<char>(cell);
+            out += static_cast<char>(board.at(cell % BOARD_SIZE, cell / BOARD_SIZE));
+        }
+    }
+
+    // Проверяет, получен ли в буфере завершенный кадр. Нагрузка читается
+    // прямо из буфера (buffer.at(FRAME_HEADER_SIZE + i)), после чего кадр
+    // отбрасывается через consume(FRAME_HEADER_SIZE + payloadLength).
+    // malformed - заявленная длина превышает допустимую.
+    bool peekFrame(const RingBuffer& buffer, uint8_t& opcode, size_t& payloadLength, bool& malformed) {
+        malformed = false;
+        if (buffer.size() < FRAME_HEADER_SIZE) return false;
+
+        payloadLength = (static_cast<uint8_t>(buffer.at(0)) << 8) | static_cast<uint8_t>(buffer.at(1));
+        if (payloadLength > MAX_FRAME_PAYLOAD) {
+            malformed = true;
+            return false;
+        }
+        if (buffer.size() < FRAME_HEADER_SIZE + payloadLength) return false;
+
+        opcode = static_cast<uint8_t>(buffer.at(2));
+        return true;
+    }
+}
+
+// Безопасные функции для работы с сокетами
+
+// Ставит данные в очередь отправки игрока. Сама отправка - одна на итерацию
+// цикла событий (flushOutput), поэтому несколько сообщений хода уходят одним
+// системным вызовом. Клиент, который не читает свои данные и набрал больше
+// OUTPUT_LIMIT_BYTES неотправленного, отключается.
+bool safeSend(Player* player, const std::string& data) {
+    OutputPart part(data);
+    return safeSend(player, &part, 1);
+}
+
+// Можно ли добавить в очередь игрока еще length байт
+bool reserveOutput(Player* player, size_t length) {
+    if (!player->connected || player->socket == INVALID_SOCKET) return false;
+
+    if (player->outBuffer.size() + length > OUTPUT_LIMIT_BYTES) {
+        Metrics::add(Metrics::DISCONNECT_SLOW_CONSUMER);
+        std::cout << "Player " << player->playerId << " disconnected: not reading its data\n";
+        player->disconnect();
+        return false;
+    }
+    return true;
+}
+
+bool scheduleFlush(Player* player) {
+    if (!player->flushQueue) {
+        return flushOutput(player);
+    }
+    if (!player->flushScheduled) {
+        player->flushScheduled = true;
+        player->flushQueue->push_back(player->handle);
+    }
+    return true;
+}
+
+bool safeSend(Player* player, const OutputPart* parts, int count) {
+    // Компьютерный соперник читает состояние игры напрямую. Игроку, ждущему
+    // переподключения, писать некуда: вернувшись, он получит состояние целиком
+    if (player->computer || player->suspended) return true;
+
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += parts[i].length;
+    }
+    if (!reserveOutput(player, length)) return false;
+    if (length == 0) return true;
+
+    for (int i = 0; i < count; i++) {
+        player->outBuffer.append(parts[i].data, parts[i].length);
+    }
+    return scheduleFlush(player);
+}
+
+// Ставит в очередь ссылку на общее сообщение без копирования
+bool sendShared(Player* player, const SharedMessage& message) {
+    if (!reserveOutput(player, message->size())) return false;
+
+    player->outBuffer.append(message);
+    return scheduleFlush(player);
+}
+
+// Отправляет начало очереди одним вызовом со списком блоков (аналог writev;
+// sendmsg вместо writev - ради MSG_NOSIGNAL). Возвращает число отправленных
+// байт или SOCKET_ERROR
+int sendGathered(SOCKET socket, const OutputQueue& queue) {
+    const char* parts[OutputQueue::MAX_GATHER];
+    size_t lengths[OutputQueue::MAX_GATHER];
+    int count = queue.gather(parts, lengths, OutputQueue::MAX_GATHER);
+#ifdef _WIN32
+    WSABUF buffers[OutputQueue::MAX_GATHER];
+    for (int i = 0; i < count; i++) {
+        buffers[i].buf = const_cast<char*>(parts[i]);
+        buffers[i].len = static_cast<ULONG>(lengths[i]);
+    }
+    DWORD sent = 0;
+    if (WSASend(socket, buffers, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    return static_cast<int>(sent);
+#else
+    iovec vectors[OutputQueue::MAX_GATHER];
+    for (int i = 0; i < count; i++) {
+        vectors[i].iov_base = const_cast<char*>(parts[i]);
+        vectors[i].iov_len = lengths[i];
+    }
+    msghdr message{};
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+    ssize_t sent = sendmsg(socket, &message, SEND_FLAGS);
+    return sent < 0 ? SOCKET_ERROR : static_cast<int>(sent);
+#endif
+}
+
+// Отправляет накопленный outBuffer, пока сокет принимает данные. Остаток
+// дописывается, когда цикл событий сообщит о готовности сокета к записи
+bool flushOutput(Player* player) {
+    if (!player->connected || player->socket == INVALID_SOCKET) return false;
+    Trace::Span span("flush");
+
+    while (!player->outBuffer.empty()) {
+        int sent = sendGathered(player->socket, player->outBuffer);
+        Metrics::add(Metrics::SEND_CALLS);
+        if (sent == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (isInterrupted(error)) {
+                continue;
+            }
+            if (isWouldBlock(error)) {
+                if (player->poller) player->poller->setWriteInterest(player->socket, true);
+                return true;
+            }
+            return false;
+        }
+        player->outBuffer.consume(sent);
+        Metrics::add(Metrics::BYTES_SENT, sent);
+    }
+
+    if (player->poller) player->poller->setWriteInterest(player->socket, false);
+    return true;
+}
+
+// Читает все доступные данные из сокета прямо в inBuffer игрока.
+// Возвращает false, если соединение закрыто, произошла ошибка или клиент
+// прислал больше INPUT_BUFFER_SIZE байт без завершенной строки/кадра.
+bool safeRecv(Player* player) {
+    if (player->socket == INVALID_SOCKET) return false;
+    Trace::Span span("recv");
+
+    while (true) {
+        size_t space;
+        char* span = player->inBuffer.writeSpan(space);
+        if (space == 0) {
+            return false;
+        }
+
+        int bytesReceived = recv(player->socket, span, static_cast<int>(space), 0);
+        Metrics::add(Metrics::RECV_CALLS);
+
+        if (bytesReceived == SOCKET_ERROR) {
             int error = WSAGetLastError();
-            if (error == WSAEWOULDBLOCK) {
-                Sleep(10);
+            if (isInterrupted(error)) {
+                continue;
+            }
+            return isWouldBlock(error);
+        }
+        else if (bytesReceived == 0) {
+            return false;
+        }
+
+        player->inBuffer.commit(bytesReceived);
+        Metrics::add(Metrics::BYTES_RECEIVED, bytesReceived);
+
+        // Неполное чтение значит, что буфер сокета опустел: о новых данных
+        // цикл событий сообщит сам, и лишний recv до EWOULDBLOCK не нужен
+        if (static_cast<size_t>(bytesReceived) < space) {
+            return true;
+        }
+    }
+}
+
+// Длина первой завершенной строки в буфере (без \n) или npos
+size_t peekLine(const RingBuffer& buffer) {
+    return buffer.find('\n');
+}
+
+// Разбирает ход "x y" из первых length байт буфера без копирования.
+// Допускаются пробелы вокруг чисел и \r в конце строки, как у прежнего sscanf("%d %d %c").
+bool parseMove(const RingBuffer& buffer, size_t length, int& x, int& y) {
+    size_t pos = 0;
+    auto skipSpaces = [&]() {
+        while (pos < length && std::isspace(static_cast<unsigned char>(buffer.at(pos)))) pos++;
+    };
+    auto parseInt = [&](int& value) -> bool {
+        bool negative = false;
+        if (pos < length && (buffer.at(pos) == '-' || buffer.at(pos) == '+')) {
+            negative = buffer.at(pos) == '-';
+            pos++;
+        }
+
+        size_t digits = 0;
+        long long result = 0;
+        while (pos < length && std::isdigit(static_cast<unsigned char>(buffer.at(pos)))) {
+            result = std::min(result * 10 + (buffer.at(pos) - '0'), 1LL << 31);
+            pos++;
+            digits++;
+        }
+        value = static_cast<int>(negative ? -result : std::min(result, (1LL << 31) - 1));
+        return digits > 0;
+    };
+
+    skipSpaces();
+    if (!parseInt(x)) return false;
+    skipSpaces();
+    if (!parseInt(y)) return false;
+    skipSpaces();
+    return pos == length;
+}
+
+// Отправка сообщений игроку в выбранном им протоколе
+
+bool sendInfo(Player* player, const std::string& text) {
+    if (player->binaryProtocol) {
+        return safeSend(player, Protocol::frame(Protocol::OP_TEXT, text));
+    }
+    return safeSend(player, text);
+}
+
+bool sendError(Player* player, const std::string& text) {
+    if (player->binaryProtocol) {
+        return safeSend(player, Protocol::frame(Protocol::OP_ERROR, text));
+    }
+    return safeSend(player, text);
+}
+
+// Свое поле после расстановки; для бинарного протокола это начальный снимок
+bool sendOwnBoard(Player* player, const std::string& caption) {
+    if (player->binaryProtocol) {
+        std::string payload;
+        Protocol::appendPackedBoard(payload, player->board, true);
+        player->sentBoard = player->board;
+        player->sentEnemyView = player->enemyView;
+        return safeSend(player, Protocol::frame(Protocol::OP_BOARD, payload));
+    }
+    const BoardText& board = player->renderBoard();
+    const OutputPart parts[] = { caption, OutputPart(board.data(), board.size()), "\n" };
+    return safeSend(player, parts, 3);
+}
+
+bool sendBoardSnapshot(Player* player) {
+    std::string payload;
+    Protocol::appendPackedBoard(payload, player->board, true);
+    Protocol::appendPackedBoard(payload, player->enemyView, false);
+    player->sentBoard = player->board;
+    player->sentEnemyView = player->enemyView;
+    return safeSend(player, Protocol::frame(Protocol::OP_SNAPSHOT, payload));
+}
+
+// Отправляет только клетки, изменившиеся с прошлой отправки
+bool sendBoardDelta(Player* player) {
+    Bitboard ownChanged = Protocol::changedCells(player->board, player->sentBoard);
+    Bitboard enemyChanged = Protocol::changedCells(player->enemyView, player->sentEnemyView);
+    if (ownChanged.none() && enemyChanged.none()) return true;
+
+    std::string payload;
+    Protocol::appendDelta(payload, player->board, ownChanged);
+    Protocol::appendDelta(payload, player->enemyView, enemyChanged);
+    player->sentBoard = player->board;
+    player->sentEnemyView = player->enemyView;
+    return safeSend(player, Protocol::frame(Protocol::OP_DELTA, payload));
+}
+
+bool sendTurn(Player* player, bool yourTurn) {
+    Trace::Span span("render turn");
+    if (player->binaryProtocol) {
+        return sendBoardDelta(player) &&
+            safeSend(player, Protocol::frame(Protocol::OP_TURN, std::string(1, static_cast<char>(yourTurn ? 1 : 0))));
+    }
+
+    // Поля берутся из буферов игрока, сообщение уходит в очередь по частям
+    const BoardText& board = player->renderBoard();
+    const BoardText& enemyView = player->renderEnemyView();
+    const OutputPart parts[] = {
+        yourTurn ? "YOUR_TURN\nYour board:\n" : "OPPONENT_TURN\nYour board:\n",
+        OutputPart(board.data(), board.size()),
+        "\nEnemy view:\n",
+        OutputPart(enemyView.data(), enemyView.size()),
+        yourTurn ? "\nEnter coordinates to shoot (x y): " : "\nWaiting for opponent's move...\n"
+    };
+    return safeSend(player, parts, 5);
+}
+
+bool sendShotResult(Player* player, Player* shooter, int x, int y, ShotResult result) {
+    if (player->binaryProtocol) {
+        std::string payload;
+        payload += static_cast<char>(player == shooter ? 1 : 0);
+        payload += static_cast<char>(y * BOARD_SIZE + x);
+        payload += static_cast<char>(result);
+        return safeSend(player, Protocol::frame(Protocol::OP_RESULT, payload));
+    }
+    return safeSend(player, shooter->name + " shot at (" + std::to_string(x) + "," + std::to_string(y) + ") - " +
+        shotResultText(result));
+}
+
+// Токен, по которому игрок вернется в партию после обрыва соединения
+bool sendResumeToken(Player* player) {
+    if (player->binaryProtocol) {
+        return safeSend(player, Protocol::frame(Protocol::OP_RESUME_TOKEN, player->resumeToken));
+    }
+    return safeSend(player, Protocol::RESUME_TOKEN_LINE + player->resumeToken + "\n");
+}
+
+bool sendGameOver(Player* player, int outcome, const std::string& message) {
+    if (player->binaryProtocol) {
+        return safeSend(player, Protocol::frame(Protocol::OP_GAME_OVER, std::string(1, static_cast<char>(outcome)) + message));
+    }
+    return safeSend(player, message);
+}
+
+// Функция для безопасного закрытия сокета
+void safeCloseSocket(SOCKET& socket) {
+    if (socket != INVALID_SOCKET) {
+        shutdown(socket, SD_BOTH);
+        closesocket(socket);
+        socket = INVALID_SOCKET;
+    }
+}
+
+// Микробенчмарки игрового движка (NavalBattle_server --bench). Это отдельная
+// сборка для замеров: код бенчмарков вместе с эталонной копией прежнего движка
+// попадает в программу только при сборке с -DNAVALBATTLE_BENCH=1, а рабочий
+// сервер их не содержит и не запускает рядом с шардами
+#ifndef NAVALBATTLE_BENCH
+#define NAVALBATTLE_BENCH 0
+#endif
+
+#if NAVALBATTLE_BENCH
+namespace Benchmarks {
+    typedef std::chrono::steady_clock Clock;
+
+    volatile int sink = 0;
+
+    double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    void report(const std::string& name, long long operations, double seconds) {
+        std::cout << "  " << name;
+        for (size_t i = name.size(); i < 40; i++) std::cout << ' ';
+        std::cout << static_cast<long long>(operations / seconds) << " ops/sec ("
+            << (seconds * 1e9 / operations) << " ns/op)\n";
+    }
+
+    // Прежняя отрисовка поля заново в строку на каждый ход - эталон для BoardText
+    std::string legacyBoardString(const BoardMasks& board, bool showShips) {
+        std::string result = "  0 1 2 3 4 5 6 7 8 9\n";
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            result += std::to_string(y) + ' ';
+            for (int x = 0; x < BOARD_SIZE; x++) {
+                CellState state = board.at(x, y);
+                char symbol = '.';
+                if (state == HIT) symbol = 'X';
+                else if (state == MISS) symbol = 'O';
+                else if (state == SUNK) symbol = '#';
+                else if (showShips && state == SHIP) symbol = 'S';
+                result += symbol;
+                result += ' ';
+            }
+            result += '\n';
+        }
+        return result;
+    }
+
+    // Прежнее представление поля (vector<vector<CellState>>) - эталон для сравнения
+    struct LegacyPlayer {
+        std::vector<std::vector<CellState>> board;
+        std::vector<std::vector<CellState>> enemyView;
+        std::vector<Ship> ships;
+
+        LegacyPlayer()
+            : board(BOARD_SIZE, std::vector<CellState>(BOARD_SIZE, EMPTY)),
+            enemyView(BOARD_SIZE, std::vector<CellState>(BOARD_SIZE, EMPTY)) {
+        }
+
+        bool placeShip(int size, int x, int y, bool horizontal) {
+            int dx = horizontal ? 1 : 0;
+            int dy = horizontal ? 0 : 1;
+            if (x + dx * size > BOARD_SIZE || y + dy * size > BOARD_SIZE) return false;
+            for (int i = 0; i < size; i++) {
+                if (board[y + dy * i][x + dx * i] != EMPTY) return false;
+                for (int ny = y + dy * i - 1; ny <= y + dy * i + 1; ny++) {
+                    for (int nx = x + dx * i - 1; nx <= x + dx * i + 1; nx++) {
+                        if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE &&
+                            board[ny][nx] == SHIP) return false;
+                    }
+                }
+            }
+
+            Ship ship{ size, 0, horizontal, x, y, Bitboard(), Bitboard() };
+            ships.push_back(ship);
+            for (int i = 0; i < size; i++) {
+                board[y + dy * i][x + dx * i] = SHIP;
+            }
+            return true;
+        }
+
+        void markMissesAroundSunkShip(const Ship& ship, LegacyPlayer* opponent) {
+            int dx = ship.horizontal ? 1 : 0;
+            int dy = ship.horizontal ? 0 : 1;
+            for (int i = -1; i <= ship.size; i++) {
+                for (int side = -1; side <= 1; side++) {
+                    if (i >= 0 && i < ship.size && side == 0) continue;
+                    int nx = ship.x + dx * i + dy * side;
+                    int ny = ship.y + dy * i + dx * side;
+                    if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE && board[ny][nx] == EMPTY) {
+                        board[ny][nx] = MISS;
+                        opponent->enemyView[ny][nx] = MISS;
+                    }
+                }
+            }
+        }
+
+        bool allShipsSunk() const {
+            for (const auto& ship : ships) {
+                if (!ship.isSunk()) return false;
+            }
+            return true;
+        }
+
+        // Выстрел этого игрока по полю соперника
+        int shootAt(LegacyPlayer& opponent, int x, int y) {
+            int result = shootCell(opponent, x, y);
+            return opponent.allShipsSunk() ? 3 : result;
+        }
+
+        int shootCell(LegacyPlayer& opponent, int x, int y) {
+            if (opponent.board[y][x] == SHIP) {
+                opponent.board[y][x] = HIT;
+                enemyView[y][x] = HIT;
+                for (auto& ship : opponent.ships) {
+                    int dx = ship.horizontal ? 1 : 0;
+                    int dy = ship.horizontal ? 0 : 1;
+                    bool shipHit = false;
+                    for (int i = 0; i < ship.size; i++) {
+                        if (ship.x + dx * i == x && ship.y + dy * i == y) {
+                            ship.hits++;
+                            shipHit = true;
+                            break;
+                        }
+                    }
+                    if (!shipHit) continue;
+                    if (ship.isSunk()) {
+                        for (int i = 0; i < ship.size; i++) {
+                            opponent.board[ship.y + dy * i][ship.x + dx * i] = SUNK;
+                            enemyView[ship.y + dy * i][ship.x + dx * i] = SUNK;
+                        }
+                        opponent.markMissesAroundSunkShip(ship, this);
+                        return 2;
+                    }
+                    return 1;
+                }
+            }
+            else if (opponent.board[y][x] == EMPTY) {
+                opponent.board[y][x] = MISS;
+                enemyView[y][x] = MISS;
+            }
+            return 0;
+        }
+    };
+
+    struct Placement {
+        int x, y;
+        bool horizontal;
+    };
+
+    std::vector<Placement> randomPlacements(size_t count, unsigned seed) {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<> dis(0, BOARD_SIZE - 1);
+        std::vector<Placement> result(count);
+        for (auto& placement : result) {
+            placement.x = dis(gen);
+            placement.y = dis(gen);
+            placement.horizontal = (gen() & 1) != 0;
+        }
+        return result;
+    }
+
+    // Расстановка флота по заранее сгенерированной последовательности попыток;
+    // возвращает число вызовов placeShip
+    template <typename PlayerType, typename ResetFn>
+    long long placeFleets(PlayerType& player, ResetFn reset, const std::vector<Placement>& placements, int fleets) {
+        long long calls = 0;
+        size_t next = 0;
+        for (int fleet = 0; fleet < fleets; fleet++) {
+            reset(player);
+            for (int i = 0; i < NUM_SHIPS; i++) {
+                bool placed = false;
+                for (int attempt = 0; attempt < 100 && !placed; attempt++) {
+                    const Placement& p = placements[next];
+                    next = (next + 1) % placements.size();
+                    placed = player.placeShip(SHIP_SIZES[i], p.x, p.y, p.horizontal);
+                    calls++;
+                }
+                if (!placed) {
+                    reset(player);
+                    i = -1;
+                }
+            }
+        }
+        return calls;
+    }
+
+    // Аппаратные счетчики процессора через perf_event_open (только Linux).
+    // Открываются, если это разрешают ядро и perf_event_paranoid;
+    // иначе бенчмарки выводят только время и число выделений
+    class HardwareCounters {
+    public:
+        static const int COUNT = 4;
+
+        HardwareCounters() : opened(false) {
+            for (int i = 0; i < COUNT; i++) fds[i] = -1;
+#ifdef __linux__
+            static const uint64_t events[COUNT] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+            };
+            opened = true;
+            for (int i = 0; i < COUNT; i++) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = events[i];
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds[i] < 0) opened = false;
+            }
+#endif
+        }
+
+        ~HardwareCounters() {
+#ifdef __linux__
+            for (int i = 0; i < COUNT; i++) {
+                if (fds[i] >= 0) close(fds[i]);
+            }
+#endif
+        }
+
+        HardwareCounters(const HardwareCounters&) = delete;
+        HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+        bool available() const {
+            return opened;
+        }
+
+        void start() {
+#ifdef __linux__
+            if (!opened) return;
+            for (int i = 0; i < COUNT; i++) {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        void stop(uint64_t values[COUNT]) {
+            for (int i = 0; i < COUNT; i++) values[i] = 0;
+#ifdef __linux__
+            if (!opened) return;
+            for (int i = 0; i < COUNT; i++) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+            for (int i = 0; i < COUNT; i++) {
+                uint64_t value = 0;
+                if (read(fds[i], &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+                    values[i] = value;
+                }
+            }
+#endif
+        }
+
+    private:
+        int fds[COUNT];
+        bool opened;
+    };
+
+    // Замер одного сценария: body выполняет все операции и возвращает их число.
+    // Выводятся ns/op, выделения памяти на операцию и, если доступны,
+    // такты, инструкции, промахи кэша и ошибки предсказания переходов на операцию
+    template <typename Body>
+    void measure(const std::string& name, HardwareCounters& counters, Body body) {
+        uint64_t allocationsBefore = Metrics::localValue(Metrics::HEAP_ALLOCATIONS);
+        uint64_t values[HardwareCounters::COUNT];
+
+        counters.start();
+        Clock::time_point start = Clock::now();
+        long long operations = body();
+        double seconds = secondsSince(start);
+        counters.stop(values);
+
+        uint64_t allocations = Metrics::localValue(Metrics::HEAP_ALLOCATIONS) - allocationsBefore;
+        double ops = static_cast<double>(operations);
+        char line[160];
+        int length = std::snprintf(line, sizeof(line), "  %-40s %9.1f %9.2f", name.c_str(),
+            seconds * 1e9 / ops, allocations / ops);
+        if (counters.available() && length > 0 && length < static_cast<int>(sizeof(line))) {
+            std::snprintf(line + length, sizeof(line) - length, " %9.1f %9.1f %9.3f %9.3f",
+                values[0] / ops, values[1] / ops, values[2] / ops, values[3] / ops);
+        }
+        std::cout << line << '\n';
+    }
+
+    // Состояние пары игроков в середине партии: поле цели, ее корабли и
+    // то, что видит стреляющий. Восстанавливается перед каждым прогоном
+    struct Position {
+        BoardMasks board;
+        std::vector<Ship> ships;
+        BoardMasks enemyView;
+    };
+
+    void restore(const Position& position, Player& shooter, Player& target) {
+        target.board = position.board;
+        target.ships = position.ships;
+        shooter.enemyView = position.enemyView;
+    }
+
+    Position capture(const Player& shooter, const Player& target) {
+        Position position;
+        position.board = target.board;
+        position.ships = target.ships;
+        position.enemyView = shooter.enemyView;
+        return position;
+    }
+
+    // Горячие пути движка на входах, как в настоящих партиях: пустое поле
+    // для расстановки, поле в середине игры для выстрелов и отрисовки,
+    // добивающие выстрелы по подбитым кораблям. Это базовая линия для
+    // сравнения при изменениях движка
+    void benchmarkEngine() {
+        std::cout << "Game engine hot paths:\n";
+        HardwareCounters counters;
+        std::cout << "  " << std::string(40, ' ') << "     ns/op allocs/op";
+        if (counters.available()) {
+            std::cout << " cycles/op  instr/op  cmiss/op  bmiss/op";
+        }
+        std::cout << '\n';
+        if (!counters.available()) {
+            std::cout << "  (hardware counters unavailable: perf_event_open is not permitted here)\n";
+        }
+
+        sockaddr_in noAddr{};
+        Player shooter(INVALID_SOCKET, noAddr, 1);
+        Player target(INVALID_SOCKET, noAddr, 2);
+        shooter.connected = false;
+        target.connected = false;
+        Game game(&shooter, &target);
+
+        // Флоты расставлены заранее тем же генератором, что и в игре
+        const int FLEETS = 1024;
+        FastRandom random(2024);
+        std::vector<Position> fresh(FLEETS);
+        for (auto& position : fresh) {
+            target.board.clear();
+            target.ships.clear();
+            target.autoPlaceShips(random);
+            position = capture(shooter, target);
+        }
+
+        // Порядок выстрелов в каждой партии свой
+        std::vector<std::vector<int>> orders(FLEETS, std::vector<int>(BOARD_CELLS));
+        std::mt19937 gen(777);
+        for (auto& order : orders) {
+            for (int i = 0; i < BOARD_CELLS; i++) order[i] = i;
+            std::shuffle(order.begin(), order.end(), gen);
+        }
+
+        // Середина партии: сделана половина выстрелов
+        std::vector<Position> midGame(FLEETS);
+        for (int f = 0; f < FLEETS; f++) {
+            restore(fresh[f], shooter, target);
+            for (int i = 0; i < BOARD_CELLS / 2; i++) {
+                game.fireShot(orders[f][i] % BOARD_SIZE, orders[f][i] / BOARD_SIZE);
+            }
+            midGame[f] = capture(shooter, target);
+        }
+
+        // Все корабли подбиты, кроме последней клетки: каждый следующий выстрел топит корабль
+        std::vector<Position> beforeSinking(FLEETS);
+        std::vector<std::vector<int>> sinkingShots(FLEETS);
+        for (int f = 0; f < FLEETS; f++) {
+            restore(fresh[f], shooter, target);
+            for (const auto& ship : fresh[f].ships) {
+                Bitboard body = ship.body;
+                int last = -1;
+                while (body.any()) {
+                    int cell = body.select(0);
+                    body &= ~Bitboard::cell(cell % BOARD_SIZE, cell / BOARD_SIZE);
+                    if (body.any()) game.fireShot(cell % BOARD_SIZE, cell / BOARD_SIZE);
+                    else last = cell;
+                }
+                sinkingShots[f].push_back(last);
+            }
+            beforeSinking[f] = capture(shooter, target);
+        }
+
+        const int ROUNDS = 20000;
+
+        measure("placeShip, fresh board", counters, [&]() {
+            long long calls = 0;
+            for (int r = 0; r < ROUNDS; r++) {
+                target.board.clear();
+                target.ships.clear();
+                for (const auto& ship : fresh[r % FLEETS].ships) {
+                    sink += target.placeShip(ship.size, ship.x, ship.y, ship.horizontal);
+                    calls++;
+                }
+            }
+            return calls;
+        });
+
+        measure("autoPlaceShips, fresh board", counters, [&]() {
+            for (int r = 0; r < ROUNDS; r++) {
+                target.board.clear();
+                target.ships.clear();
+                target.autoPlaceShips(random);
+            }
+            return static_cast<long long>(ROUNDS);
+        });
+
+        measure("processShot, whole game", counters, [&]() {
+            long long shots = 0;
+            for (int r = 0; r < ROUNDS / 4; r++) {
+                const std::vector<int>& order = orders[r % FLEETS];
+                restore(fresh[r % FLEETS], shooter, target);
+                game.gameOver = false;
+                for (int i = 0; i < BOARD_CELLS && !game.gameOver; i++) {
+                    sink += static_cast<int>(game.processShot(order[i] % BOARD_SIZE, order[i] / BOARD_SIZE).size());
+                    shots++;
+                }
+            }
+            return shots;
+        });
+
+        measure("processShot, mid-game", counters, [&]() {
+            long long shots = 0;
+            for (int r = 0; r < ROUNDS; r++) {
+                const std::vector<int>& order = orders[r % FLEETS];
+                restore(midGame[r % FLEETS], shooter, target);
+                game.gameOver = false;
+                for (int i = BOARD_CELLS / 2; i < BOARD_CELLS / 2 + 10; i++) {
+                    sink += static_cast<int>(game.processShot(order[i] % BOARD_SIZE, order[i] / BOARD_SIZE).size());
+                    shots++;
+                }
+            }
+            return shots;
+        });
+
+        measure("processShot, sinking shot", counters, [&]() {
+            long long shots = 0;
+            for (int r = 0; r < ROUNDS; r++) {
+                restore(beforeSinking[r % FLEETS], shooter, target);
+                game.gameOver = false;
+                for (int cell : sinkingShots[r % FLEETS]) {
+                    sink += static_cast<int>(game.processShot(cell % BOARD_SIZE, cell / BOARD_SIZE).size());
+                    shots++;
+                }
+            }
+            return shots;
+        });
+
+        // Ореолы кораблей своего флота на поле перед их потоплением; как и
+        // у добивающих выстрелов, в замер входит восстановление позиции
+        measure("markMissesAroundSunkShip", counters, [&]() {
+            long long calls = 0;
+            for (int r = 0; r < ROUNDS; r++) {
+                restore(beforeSinking[r % FLEETS], shooter, target);
+                for (const auto& ship : target.ships) {
+                    target.markMissesAroundSunkShip(ship, &shooter);
+                    calls++;
+                }
+            }
+            return calls;
+        });
+
+        measure("legacy board string, mid-game", counters, [&]() {
+            for (int r = 0; r < ROUNDS; r++) {
+                restore(midGame[r % FLEETS], shooter, target);
+                sink += static_cast<int>(legacyBoardString(target.board, true).size());
+            }
+            return static_cast<long long>(ROUNDS);
+        });
+
+        // Соседние позиции - разные партии, поэтому меняется около половины клеток
+        measure("BoardText, mid-game position", counters, [&]() {
+            BoardText text(true);
+            for (int r = 0; r < ROUNDS; r++) {
+                restore(midGame[r % FLEETS], shooter, target);
+                sink += text.update(target.board);
+            }
+            return static_cast<long long>(ROUNDS);
+        });
+
+        // Кадр после каждого выстрела: свое поле цели и вид стреляющего
+        measure("fireShot + 2 BoardText, whole game", counters, [&]() {
+            long long shots = 0;
+            for (int r = 0; r < ROUNDS / 4; r++) {
+                const std::vector<int>& order = orders[r % FLEETS];
+                restore(fresh[r % FLEETS], shooter, target);
+                BoardText own(true);
+                BoardText view(false);
+                own.update(target.board);
+                view.update(shooter.enemyView);
+                game.gameOver = false;
+                for (int i = 0; i < BOARD_CELLS && !game.gameOver; i++) {
+                    game.fireShot(order[i] % BOARD_SIZE, order[i] / BOARD_SIZE);
+                    sink += own.update(target.board) + view.update(shooter.enemyView);
+                    shots++;
+                }
+            }
+            return shots;
+        });
+
+        // Ход компьютерного соперника на всех стадиях партии
+        const int PLANNED_GAMES = ROUNDS / 20;
+        long long plannedShots = 0;
+        measure("ShotPlanner::chooseShot, whole game", counters, [&]() {
+            for (int r = 0; r < PLANNED_GAMES; r++) {
+                restore(fresh[r % FLEETS], shooter, target);
+                game.gameOver = false;
+                while (!game.gameOver) {
+                    int cell = ShotPlanner::chooseShot(shooter.enemyView, random);
+                    game.fireShot(cell % BOARD_SIZE, cell / BOARD_SIZE);
+                    plannedShots++;
+                }
+            }
+            return plannedShots;
+        });
+        std::cout << "    computer needs " << static_cast<double>(plannedShots) / PLANNED_GAMES
+            << " shots per game on average\n";
+
+        // Запись партии в журнал (без файлового ввода-вывода, он в отдельном потоке)
+        restore(fresh[0], shooter, target);
+        game.gameOver = false;
+        game.shots.clear();
+        for (int i = 0; i < BOARD_CELLS && !game.gameOver; i++) {
+            ShotResult result = game.fireShot(orders[0][i] % BOARD_SIZE, orders[0][i] / BOARD_SIZE);
+            game.recordShot(orders[0][i] % BOARD_SIZE, orders[0][i] / BOARD_SIZE, result);
+        }
+        std::vector<char> journalBuffer;
+        journalBuffer.reserve(JOURNAL_FLUSH_BYTES + 4096);
+        measure("JournalWriter::encode, whole game", counters, [&]() {
+            for (int r = 0; r < ROUNDS; r++) {
+                if (journalBuffer.size() >= JOURNAL_FLUSH_BYTES) journalBuffer.clear();
+                JournalWriter::encode(game, journalBuffer);
+            }
+            return static_cast<long long>(ROUNDS);
+        });
+        journalBuffer.clear();
+        JournalWriter::encode(game, journalBuffer);
+        std::cout << "    record of a " << game.shots.size() << "-shot game takes " << journalBuffer.size() << " bytes\n";
+
+        // Цена интервала трассировки; без NAVALBATTLE_TRACE он вырезается целиком
+        measure(Trace::ENABLED ? "Trace::Span" : "Trace::Span (compiled out)", counters, [&]() {
+            for (int r = 0; r < ROUNDS; r++) {
+                Trace::Span span("benchmark span");
+                sink += r;
+            }
+            return static_cast<long long>(ROUNDS);
+        });
+    }
+
+    void benchmarkBoards() {
+        std::cout << "Board representation (bitboard vs vector<vector<CellState>>):\n";
+
+        const int FLEETS = 20000;
+        std::vector<Placement> placements = randomPlacements(1 << 16, 12345);
+
+        sockaddr_in noAddr{};
+        Player player(INVALID_SOCKET, noAddr, 0);
+        player.connected = false;
+        auto resetPlayer = [](Player& p) { p.board.clear(); p.ships.clear(); };
+        Clock::time_point start = Clock::now();
+        long long calls = placeFleets(player, resetPlayer, placements, FLEETS);
+        report("placeShip, bitboard", calls, secondsSince(start));
+
+        LegacyPlayer legacy;
+        auto resetLegacy = [](LegacyPlayer& p) {
+            for (auto& row : p.board) std::fill(row.begin(), row.end(), EMPTY);
+            p.ships.clear();
+        };
+        start = Clock::now();
+        calls = placeFleets(legacy, resetLegacy, placements, FLEETS);
+        report("placeShip, vector<vector>", calls, secondsSince(start));
+
+        // Обе реализации стреляют по одному и тому же флоту в одном порядке
+        std::vector<int> order(BOARD_CELLS);
+        for (int i = 0; i < BOARD_CELLS; i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(777));
+
+        const int GAMES = 20000;
+        Player shooter(INVALID_SOCKET, noAddr, 1);
+        Player target(INVALID_SOCKET, noAddr, 2);
+        shooter.connected = false;
+        target.connected = false;
+        placeFleets(target, resetPlayer, placements, 1);
+        BoardMasks fleetBoard = target.board;
+        std::vector<Ship> fleetShips = target.ships;
+
+        Game game(&shooter, &target);
+        long long shots = 0;
+        start = Clock::now();
+        for (int g = 0; g < GAMES; g++) {
+            target.board = fleetBoard;
+            target.ships = fleetShips;
+            shooter.enemyView.clear();
+            game.gameOver = false;
+            for (int i = 0; i < BOARD_CELLS && !game.gameOver; i++) {
+                sink += game.fireShot(order[i] % BOARD_SIZE, order[i] / BOARD_SIZE);
+                shots++;
+            }
+        }
+        report("fireShot, bitboard", shots, secondsSince(start));
+
+        LegacyPlayer legacyShooter;
+        LegacyPlayer legacyTarget;
+        for (const auto& ship : fleetShips) {
+            legacyTarget.placeShip(ship.size, ship.x, ship.y, ship.horizontal);
+        }
+        std::vector<std::vector<CellState>> legacyBoard = legacyTarget.board;
+        std::vector<Ship> legacyShips = legacyTarget.ships;
+        std::vector<std::vector<CellState>> emptyView = legacyShooter.enemyView;
+
+        shots = 0;
+        start = Clock::now();
+        for (int g = 0; g < GAMES; g++) {
+            legacyTarget.board = legacyBoard;
+            legacyTarget.ships = legacyShips;
+            legacyShooter.enemyView = emptyView;
+            for (int i = 0; i < BOARD_CELLS; i++) {
+                int result = legacyShooter.shootAt(legacyTarget, order[i] % BOARD_SIZE, order[i] / BOARD_SIZE);
+                sink += result;
+                shots++;
+                if (result == 3) break;
+            }
+        }
+        report("fireShot, vector<vector>", shots, secondsSince(start));
+    }
+
+    // Прежний генератор: случайные попытки через placeShip с перезапуском флота
+    void legacyAutoPlaceShips(Player& player) {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<> dis(0, BOARD_SIZE - 1);
+        std::uniform_int_distribution<> dis_bool(0, 1);
+
+        for (int i = 0; i < NUM_SHIPS; i++) {
+            bool placed = false;
+            for (int attempts = 0; !placed && attempts < 100; attempts++) {
+                int x = dis(gen);
+                int y = dis(gen);
+                placed = player.placeShip(SHIP_SIZES[i], x, y, dis_bool(gen) == 1);
+            }
+            if (!placed) {
+                player.board.clear();
+                player.ships.clear();
+                i = -1;
+            }
+        }
+    }
+
+    // Частота занятости каждой клетки кораблем, в процентах
+    template <typename Generator>
+    std::vector<double> occupancy(Player& player, Generator generate, int fleets, double& horizontalShare) {
+        std::vector<long long> counts(BOARD_CELLS, 0);
+        long long horizontal = 0;
+        long long multiCell = 0;
+        for (int fleet = 0; fleet < fleets; fleet++) {
+            player.board.clear();
+            player.ships.clear();
+            generate(player);
+            for (int i = 0; i < BOARD_CELLS; i++) {
+                counts[i] += player.board[SHIP].test(i) ? 1 : 0;
+            }
+            for (const auto& ship : player.ships) {
+                if (ship.size > 1) {
+                    multiCell++;
+                    horizontal += ship.horizontal ? 1 : 0;
+                }
+            }
+        }
+
+        horizontalShare = 100.0 * horizontal / multiCell;
+        std::vector<double> result(BOARD_CELLS);
+        for (int i = 0; i < BOARD_CELLS; i++) {
+            result[i] = 100.0 * counts[i] / fleets;
+        }
+        return result;
+    }
+
+    void printHeatmap(const std::vector<double>& cells) {
+        char line[16];
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            std::cout << "    ";
+            for (int x = 0; x < BOARD_SIZE; x++) {
+                snprintf(line, sizeof(line), "%5.1f", cells[y * BOARD_SIZE + x]);
+                std::cout << line;
+            }
+            std::cout << "\n";
+        }
+    }
+
+    void benchmarkFleetGenerator() {
+        std::cout << "Fleet generation (autoPlaceShips):\n";
+
+        sockaddr_in noAddr{};
+        Player player(INVALID_SOCKET, noAddr, 0);
+        player.connected = false;
+
+        const int FLEETS = 100000;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < FLEETS; i++) {
+            player.board.clear();
+            player.ships.clear();
+            player.autoPlaceShips();
+            sink += static_cast<int>(player.ships.size());
+        }
+        report("fleets, legal-placement sampling", FLEETS, secondsSince(start));
+
+        start = Clock::now();
+        for (int i = 0; i < FLEETS; i++) {
+            player.board.clear();
+            player.ships.clear();
+            legacyAutoPlaceShips(player);
+            sink += static_cast<int>(player.ships.size());
+        }
+        report("fleets, rejection sampling", FLEETS, secondsSince(start));
+
+        // Оба генератора выбирают позицию равновероятно среди допустимых,
+        // поэтому распределения должны совпадать в пределах шума
+        const int SAMPLES = 200000;
+        double fastHorizontal = 0;
+        double legacyHorizontal = 0;
+        std::vector<double> fast = occupancy(player, [](Player& p) { p.autoPlaceShips(); }, SAMPLES, fastHorizontal);
+        std::vector<double> legacy = occupancy(player, legacyAutoPlaceShips, SAMPLES, legacyHorizontal);
+
+        double maxDifference = 0;
+        for (int i = 0; i < BOARD_CELLS; i++) {
+            maxDifference = std::max(maxDifference, std::abs(fast[i] - legacy[i]));
+        }
+
+        std::cout << "  Cell occupancy over " << SAMPLES << " fleets, legal-placement sampling (%):\n";
+        printHeatmap(fast);
+        std::cout << "  Horizontal ships (size > 1): " << fastHorizontal << "% (rejection sampling: "
+            << legacyHorizontal << "%)\n";
+        std::cout << "  Max per-cell occupancy difference vs rejection sampling: " << maxDifference << "%\n";
+    }
+
+    // Рейтинги ожидающих: нормальное распределение вокруг DEFAULT_RATING (сигма ~200)
+    int randomRating(FastRandom& random) {
+        int sum = 0;
+        for (int i = 0; i < 12; i++) {
+            sum += random.below(200);
+        }
+        return DEFAULT_RATING + sum - 1200;
+    }
+
+    // Прежний подход: линейный поиск ближайшего рейтинга по всей очереди
+    size_t closestLinear(const std::vector<int>& queue, int rating) {
+        size_t best = 0;
+        for (size_t i = 1; i < queue.size(); i++) {
+            if (std::abs(queue[i] - rating) < std::abs(queue[best] - rating)) best = i;
+        }
+        return best;
+    }
+
+    // Очередь держится на размере waiting: новый игрок ищет соперника в начальном
+    // окне, а на место каждой найденной пары в очередь встает следующий игрок
+    void benchmarkMatchmaking() {
+        std::cout << "Matchmaking (rating-bucketed queue):\n";
+
+        FastRandom random(42);
+        const size_t SIZES[] = { 1000, 10000, 100000 };
+        for (size_t waiting : SIZES) {
+            std::vector<MatchTicket> tickets(waiting * 2);
+            std::vector<MatchTicket*> freeTickets;
+            RatingQueue queue;
+            auto now = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < tickets.size(); i++) {
+                tickets[i].rating = randomRating(random);
+                if (i < waiting) queue.push(&tickets[i], now);
+                else freeTickets.push_back(&tickets[i]);
+            }
+
+            const long long ARRIVALS = 1000000;
+            long long matches = 0;
+            Clock::time_point start = Clock::now();
+            for (long long i = 0; i < ARRIVALS; i++) {
+                MatchTicket* arrival = freeTickets.back();
+                arrival->rating = randomRating(random);
+
+                MatchTicket* opponent = queue.findOpponent(arrival, MATCH_WINDOW_BUCKETS);
+                if (!opponent) continue;
+
+                // Сыгравший уходит из очереди, вместо него встает новый игрок
+                queue.remove(opponent);
+                freeTickets.pop_back();
+                freeTickets.push_back(opponent);
+                arrival->rating = randomRating(random);
+                queue.push(arrival, now);
+                matches++;
+            }
+            double seconds = secondsSince(start);
+            report("matches, " + std::to_string(waiting) + " waiting", matches, seconds);
+
+            std::vector<int> linear(waiting);
+            for (size_t i = 0; i < waiting; i++) {
+                linear[i] = randomRating(random);
+            }
+            const long long LINEAR_ARRIVALS = std::max<long long>(100, 20000000 / static_cast<long long>(waiting));
+            start = Clock::now();
+            for (long long i = 0; i < LINEAR_ARRIVALS; i++) {
+                size_t best = closestLinear(linear, randomRating(random));
+                linear[best] = randomRating(random);
+            }
+            report("matches, " + std::to_string(waiting) + " waiting, linear scan", LINEAR_ARRIVALS, secondsSince(start));
+        }
+    }
+
+    // Миллион одновременно взведенных таймеров со сроками до минуты вперед:
+    // постановка, перевзвод (как срок хода после каждого выстрела), тики колеса
+    // и отмена. Время колеса задается вручную, без ожидания.
+    void benchmarkTimers() {
+        std::cout << "Timer wheel (1M live timers):\n";
+
+        const int TIMERS = 1000000;
+        const int HORIZON_MS = 60000;
+        Clock::time_point start = Clock::now();
+        TimerWheel wheel(start);
+        std::vector<TimerNode> nodes(TIMERS);
+        FastRandom random(7);
+
+        Clock::time_point begin = Clock::now();
+        for (int i = 0; i < TIMERS; i++) {
+            wheel.schedule(&nodes[i], start + std::chrono::milliseconds(1 + random.below(HORIZON_MS)), 0);
+        }
+        report("schedule", TIMERS, secondsSince(begin));
+
+        begin = Clock::now();
+        for (int i = 0; i < TIMERS; i++) {
+            wheel.schedule(&nodes[i], start + std::chrono::milliseconds(1 + random.below(HORIZON_MS)), 0);
+        }
+        report("reschedule", TIMERS, secondsSince(begin));
+
+        // Каждый сработавший таймер взводится снова, так что живых всегда миллион
+        const int TICKS = 1000;
+        Clock::time_point now = start;
+        long long fired = 0;
+        begin = Clock::now();
+        for (int i = 0; i < TICKS; i++) {
+            now += std::chrono::milliseconds(TimerWheel::TICK_MS);
+            wheel.advance(now, [&](TimerNode* node) {
+                fired++;
+                wheel.schedule(node, now + std::chrono::milliseconds(1 + random.below(HORIZON_MS)), 0);
+            });
+        }
+        double seconds = secondsSince(begin);
+        report("tick (" + std::to_string(TimerWheel::TICK_MS) + " ms of wheel time)", TICKS, seconds);
+        std::cout << "  " << fired << " timers fired and rescheduled over " << TICKS * TimerWheel::TICK_MS / 1000.0
+            << " s of wheel time, CPU " << seconds * 100.0 / (TICKS * TimerWheel::TICK_MS / 1000.0) << "% of one core\n";
+
+        begin = Clock::now();
+        for (int i = 0; i < TIMERS; i++) {
+            wheel.cancel(&nodes[i]);
+        }
+        report("cancel", TIMERS, secondsSince(begin));
+    }
+
+    // Срок хода, пока клиент каждые полсекунды присылает повторный выстрел:
+    // таймер взводится заново только там, где это делает сервер
+    // (restartsTurnDeadline), и должен сработать вовремя
+    void benchmarkTurnDeadline() {
+        const int TURN_TIMEOUT_MS = 1000;
+        const int MOVE_INTERVAL_MS = 500;
+        const int LIMIT_MS = 10 * TURN_TIMEOUT_MS;
+        Clock::time_point start = Clock::now();
+        TimerWheel wheel(start);
+        TimerNode turn;
+        wheel.schedule(&turn, start + std::chrono::milliseconds(TURN_TIMEOUT_MS), 0);
+
+        int elapsed = 0;
+        int firedAt = -1;
+        int moves = 0;
+        while (firedAt < 0 && elapsed < LIMIT_MS) {
+            elapsed += TimerWheel::TICK_MS;
+            Clock::time_point now = start + std::chrono::milliseconds(elapsed);
+            if (elapsed % MOVE_INTERVAL_MS == 0) {
+                moves++;
+                if (restartsTurnDeadline(SHOT_REPEAT)) {
+                    wheel.schedule(&turn, now + std::chrono::milliseconds(TURN_TIMEOUT_MS), 0);
+                }
+            }
+            wheel.advance(now, [&](TimerNode*) {
+                firedAt = elapsed;
+            });
+        }
+
+        std::cout << "Turn deadline (" << TURN_TIMEOUT_MS << " ms, repeated shot every "
+            << MOVE_INTERVAL_MS << " ms):\n";
+        if (firedAt < 0) {
+            wheel.cancel(&turn);
+            std::cout << "  FAILED: no timeout after " << LIMIT_MS << " ms and " << moves << " moves\n";
+        }
+        else {
+            std::cout << "  " << (firedAt <= TURN_TIMEOUT_MS + TimerWheel::TICK_MS ? "OK" : "LATE")
+                << ": timed out after " << firedAt << " ms and " << moves << " moves\n";
+        }
+    }
+
+    void runAll() {
+        std::cout << "\n=== Engine benchmarks ===\n";
+        benchmarkEngine();
+        benchmarkBoards();
+        benchmarkFleetGenerator();
+        benchmarkMatchmaking();
+        benchmarkTimers();
+        benchmarkTurnDeadline();
+        std::cout << "=========================\n\n";
+    }
+}
+#endif
+
+// Турнир ботов внутри процесса: партии без сокетов (Side) на пуле потоков с
+// кражей работы. Каждая пара ботов играет одинаковое число партий, первым
+// стреляет по очереди то один, то другой; партия g пары p всегда получает одно
+// и то же зерно, поэтому результаты не зависят от числа потоков. Один и тот же
+// турнир прогоняется на 1, 2, 4... потоках до числа ядер - так видно
+// масштабирование. Вариант правил Rules - параметр шаблона (см. GameRules).
+template <typename Rules>
+class Tournament {
+public:
+    static const uint32_t BATCH_GAMES = 256;
+    static const uint64_t SEED = 2024;
+
+    typedef typename Rules::Bitboard Bitboard;
+    typedef BasicBoardMasks<Rules> BoardMasks;
+    typedef BasicSide<Rules> Side;
+
+    // Бот выбирает клетку по тому, что знает о поле соперника
+    typedef int (*Strategy)(const BoardMasks& view, FastRandom& random);
+
+    struct Bot {
+        const char* name;
+        Strategy chooseShot;
+    };
+
+    // Итоги одной пары ботов
+    struct PairingStats {
+        uint64_t games;
+        uint64_t wins[2];
+        uint64_t winningShots[2];  // выстрелов победителя в выигранных партиях
+        uint64_t draws;            // бот не закончил партию за 2 * BOARD_CELLS выстрелов
+
+        PairingStats() : games(0), draws(0) {
+            wins[0] = wins[1] = 0;
+            winningShots[0] = winningShots[1] = 0;
+        }
+
+        void merge(const PairingStats& other) {
+            games += other.games;
+            draws += other.draws;
+            for (int i = 0; i < 2; i++) {
+                wins[i] += other.wins[i];
+                winningShots[i] += other.winningShots[i];
+            }
+        }
+
+        bool operator==(const PairingStats& other) const {
+            return games == other.games && draws == other.draws && wins[0] == other.wins[0] &&
+                wins[1] == other.wins[1] && winningShots[0] == other.winningShots[0] &&
+                winningShots[1] == other.winningShots[1];
+        }
+    };
+
+    // Пакет партий одной пары ботов - единица работы пула
+    struct Batch {
+        int pairing;
+        uint64_t firstGame;
+        uint32_t games;
+    };
+
+    struct RunResult {
+        unsigned threads;
+        double seconds;
+        uint64_t stolenBatches;
+        std::vector<PairingStats> stats;
+    };
+
+    // Отчет о турнире; rulesName - название варианта правил, gamesPerPairing -
+    // партий каждой пары ботов
+    static void run(const char* rulesName, uint64_t gamesPerPairing) {
+        std::vector<std::pair<int, int>> pairings;
+        for (int a = 0; a < BOT_COUNT; a++) {
+            for (int b = a; b < BOT_COUNT; b++) {
+                pairings.push_back(std::make_pair(a, b));
+            }
+        }
+
+        std::vector<Batch> batches;
+        for (size_t p = 0; p < pairings.size(); p++) {
+            for (uint64_t game = 0; game < gamesPerPairing; game += BATCH_GAMES) {
+                Batch batch{ static_cast<int>(p), game, static_cast<uint32_t>(std::min<uint64_t>(BATCH_GAMES, gamesPerPairing - game)) };
+                batches.push_back(batch);
+            }
+        }
+
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> threadCounts;
+        for (unsigned threads = 1; threads < cores; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(cores);
+
+        std::cout << "\n=== Tournament ===\n";
+        std::cout << "Rules: " << rulesName << ", " << Rules::BOARD_SIZE << "x" << Rules::BOARD_SIZE << " board, fleet";
+        for (int i = 0; i < Rules::NUM_SHIPS; i++) std::cout << ' ' << Rules::SHIP_SIZES[i];
+        std::cout << "\n";
+        std::cout << "Bots:";
+        for (int i = 0; i < BOT_COUNT; i++) std::cout << ' ' << BOTS[i].name;
+        std::cout << "; " << pairings.size() << " pairings x " << gamesPerPairing << " games, seed " << SEED << "\n";
+        std::cout << "  threads   seconds   games/sec    games/min  speedup  stolen batches\n";
+
+        std::vector<RunResult> results;
+        for (unsigned threads : threadCounts) {
+            results.push_back(play(pairings, batches, threads));
+            const RunResult& result = results.back();
+            uint64_t games = gamesPerPairing * pairings.size();
+            double rate = games / result.seconds;
+            char line[128];
+            std::snprintf(line, sizeof(line), "  %7u %9.3f %11.0f %12.0f %8.2f %15llu", threads, result.seconds, rate,
+                rate * 60, results.front().seconds / result.seconds, static_cast<unsigned long long>(result.stolenBatches));
+            std::cout << line << "\n";
+        }
+
+        bool identical = true;
+        for (const auto& result : results) {
+            for (size_t p = 0; p < pairings.size(); p++) {
+                identical = identical && result.stats[p] == results.front().stats[p];
+            }
+        }
+        std::cout << "Results identical across thread counts: " << (identical ? "yes" : "NO") << "\n";
+
+        printStandings(pairings, results.back().stats);
+        std::cout << "==================\n\n";
+    }
+
+private:
+    // Случайная клетка из candidates
+    static int pick(const Bitboard& candidates, FastRandom& random) {
+        return candidates.select(static_cast<int>(random.below(static_cast<uint32_t>(candidates.count()))));
+    }
+
+    // Случайный выстрел в любую неоткрытую клетку
+    static int randomShot(const BoardMasks& view, FastRandom& random) {
+        return pick(view.empty(), random);
+    }
+
+    // Охота и добивание: после попадания - в клетку рядом с подбитой, иначе
+    // случайная клетка одного цвета шахматной раскраски (ее не минует ни один
+    // корабль длиннее одной клетки)
+    static int huntShot(const BoardMasks& view, FastRandom& random) {
+        static const Bitboard parity = checkerboard();
+        Bitboard open = view.empty();
+        const Bitboard& hits = view[HIT];
+        if (hits.any()) {
+            // Клетки, у которых есть сосед справа
+            const Bitboard& notLastColumn = BasicShipMaskTable<Rules>::starts(2, true);
+            Bitboard next = ((hits & notLastColumn) << 1) | ((hits >> 1) & notLastColumn) |
+                (hits << Rules::BOARD_SIZE) | (hits >> Rules::BOARD_SIZE);
+            next &= open;
+            if (next.any()) return pick(next, random);
+        }
+        Bitboard hunt = open & parity;
+        return pick(hunt.any() ? hunt : open, random);
+    }
+
+    static Bitboard checkerboard() {
+        Bitboard cells;
+        for (int cell = 0; cell < Rules::BOARD_CELLS; cell++) {
+            if ((cell % Rules::BOARD_SIZE + cell / Rules::BOARD_SIZE) % 2 == 0) cells |= Bitboard::bit(cell);
+        }
+        return cells;
+    }
+
+    static const int BOT_COUNT = 3;
+    static const Bot BOTS[BOT_COUNT];
+
+    // Партия двух ботов; first - индекс стреляющего первым. Возвращает индекс
+    // победителя или -1, если партия не закончилась за 2 * BOARD_CELLS выстрелов
+    static int playGame(const Bot* bots[2], int first, Side sides[2], FastRandom& random, int shots[2]) {
+        for (int i = 0; i < 2; i++) {
+            sides[i].reset();
+            sides[i].autoPlaceShips(random);
+            shots[i] = 0;
+        }
+
+        int current = first;
+        while (shots[0] + shots[1] < 2 * Rules::BOARD_CELLS) {
+            int cell = bots[current]->chooseShot(sides[current].enemyView, random);
+            ShotResult result = sides[current].shootAt(sides[1 - current], cell % Rules::BOARD_SIZE, cell / Rules::BOARD_SIZE);
+            shots[current]++;
+            if (sides[1 - current].allShipsSunk()) return current;
+            if (passesTurn(result)) current = 1 - current;
+        }
+        return -1;
+    }
+
+    // Очередь пакетов потока: владелец берет с конца, другие потоки крадут с начала
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Batch> batches;
+        std::vector<PairingStats> stats;
+        uint64_t stolen;
+        Side sides[2];
+
+        Worker() : stolen(0) {}
+
+        bool popBack(Batch& batch) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (batches.empty()) return false;
+            batch = batches.back();
+            batches.pop_back();
+            return true;
+        }
+
+        bool stealFront(Batch& batch) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (batches.empty()) return false;
+            batch = batches.front();
+            batches.pop_front();
+            return true;
+        }
+    };
+
+    static RunResult play(const std::vector<std::pair<int, int>>& pairings, const std::vector<Batch>& batches,
+        unsigned threadCount) {
+        // Пакеты раздаются по кругу, так что у каждого потока есть партии всех пар;
+        // дальше неравномерность (планировщик в десятки раз дороже случайного бота)
+        // выравнивается кражей
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (unsigned t = 0; t < threadCount; t++) {
+            workers.emplace_back(new Worker());
+            workers.back()->stats.resize(pairings.size());
+        }
+        for (size_t i = 0; i < batches.size(); i++) {
+            workers[i % threadCount]->batches.push_back(batches[i]);
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < threadCount; t++) {
+            threads.emplace_back([&workers, &pairings, threadCount, t]() {
+                Worker& self = *workers[t];
+                FastRandom random(SEED);
+                Batch batch;
+                while (true) {
+                    bool found = self.popBack(batch);
+                    for (unsigned k = 1; !found && k < threadCount; k++) {
+                        found = workers[(t + k) % threadCount]->stealFront(batch);
+                        if (found) self.stolen++;
+                    }
+                    if (!found) break;
+                    playBatch(batch, pairings, self, random);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        RunResult result;
+        result.threads = threadCount;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.stolenBatches = 0;
+        result.stats.resize(pairings.size());
+        for (const auto& worker : workers) {
+            result.stolenBatches += worker->stolen;
+            for (size_t p = 0; p < pairings.size(); p++) {
+                result.stats[p].merge(worker->stats[p]);
+            }
+        }
+        return result;
+    }
+
+    static void playBatch(const Batch& batch, const std::vector<std::pair<int, int>>& pairings, Worker& worker,
+        FastRandom& random) {
+        const Bot* bots[2] = { &BOTS[pairings[batch.pairing].first], &BOTS[pairings[batch.pairing].second] };
+        PairingStats& stats = worker.stats[batch.pairing];
+        int shots[2];
+        for (uint64_t game = batch.firstGame; game < batch.firstGame + batch.games; game++) {
+            random.reseed(SEED ^ (static_cast<uint64_t>(batch.pairing) << 40) ^ game);
+            int winner = playGame(bots, static_cast<int>(game % 2), worker.sides, random, shots);
+            stats.games++;
+            if (winner < 0) {
+                stats.draws++;
+            }
+            else {
+                stats.wins[winner]++;
+                stats.winningShots[winner] += shots[winner];
+            }
+        }
+    }
+
+    static void printStandings(const std::vector<std::pair<int, int>>& pairings, const std::vector<PairingStats>& stats) {
+        std::cout << "Pairings:\n";
+        for (size_t p = 0; p < pairings.size(); p++) {
+            const PairingStats& pairing = stats[p];
+            const char* first = BOTS[pairings[p].first].name;
+            const char* second = BOTS[pairings[p].second].name;
+            char line[192];
+            std::snprintf(line, sizeof(line), "  %-8s vs %-8s %6.1f%% / %5.1f%% wins, %5.1f / %5.1f shots to win",
+                first, second, percent(pairing.wins[0], pairing.games), percent(pairing.wins[1], pairing.games),
+                average(pairing.winningShots[0], pairing.wins[0]), average(pairing.winningShots[1], pairing.wins[1]));
+            std::cout << line;
+            if (pairing.draws > 0) std::cout << ", " << pairing.draws << " unfinished";
+            std::cout << "\n";
+        }
+
+        // Сводка по ботам по всем партиям, кроме игр с самим собой
+        std::cout << "Bots (against other bots):\n";
+        for (int bot = 0; bot < BOT_COUNT; bot++) {
+            uint64_t games = 0, wins = 0, winningShots = 0;
+            for (size_t p = 0; p < pairings.size(); p++) {
+                if (pairings[p].first == pairings[p].second) continue;
+                for (int side = 0; side < 2; side++) {
+                    if ((side == 0 ? pairings[p].first : pairings[p].second) != bot) continue;
+                    games += stats[p].games;
+                    wins += stats[p].wins[side];
+                    winningShots += stats[p].winningShots[side];
+                }
+            }
+            char line[128];
+            std::snprintf(line, sizeof(line), "  %-8s %6.1f%% wins, %5.1f shots to win", BOTS[bot].name,
+                percent(wins, games), average(winningShots, wins));
+            std::cout << line << "\n";
+        }
+    }
+
+    static double percent(uint64_t part, uint64_t total) {
+        return total ? 100.0 * part / total : 0.0;
+    }
+
+    static double average(uint64_t sum, uint64_t count) {
+        return count ? static_cast<double>(sum) / count : 0.0;
+    }
+};
+
+template <typename Rules>
+const uint32_t Tournament<Rules>::BATCH_GAMES;
+template <typename Rules>
+const uint64_t Tournament<Rules>::SEED;
+template <typename Rules>
+const typename Tournament<Rules>::Bot Tournament<Rules>::BOTS[Tournament<Rules>::BOT_COUNT] = {
+    { "planner", BasicShotPlanner<Rules>::chooseShot },
+    { "hunt", Tournament<Rules>::huntShot },
+    { "random", Tournament<Rules>::randomShot }
+};
+
+// Турнир по названию варианта правил; false - вариант неизвестен
+bool runTournament(const std::string& rules, uint64_t gamesPerPairing) {
+    if (rules == "classic") Tournament<ClassicRules>::run("classic", gamesPerPairing);
+    else if (rules == "blitz") Tournament<BlitzRules>::run("blitz", gamesPerPairing);
+    else if (rules == "large") Tournament<LargeRules>::run("large", gamesPerPairing);
+    else return false;
+    return true;
+}
+
+// Виды таймеров сервера
+enum TimerKind {
+    TIMER_NEGOTIATION = 0,
+    TIMER_QUEUE_IDLE = 1,
+    TIMER_SETUP = 2,
+    TIMER_TURN = 3,
+    TIMER_RESUME = 4
+};
+
+// Что делать, когда игрок не успел сделать ход
+enum TurnTimeoutAction {
+    TURN_TIMEOUT_FORFEIT = 0,
+    TURN_TIMEOUT_RANDOM_SHOT = 1
+};
+
+// Настройки сервера, задаваемые аргументами командной строки
+struct ServerConfig {
+    int turnTimeoutMs;
+    TurnTimeoutAction turnTimeoutAction;
+    int setupTimeoutMs;
+    int queueTimeoutMs;
+    int resumeGraceMs;             // сколько место в партии ждет потерявшего соединение игрока
+    bool benchmarkOnly;
+    std::string journalDirectory;  // пустая строка - журнал отключен
+    std::string analyzeDirectory;  // анализ журнала вместо запуска сервера
+    std::string checkpointFile;    // пустая строка - контрольные точки отключены
+    int checkpointIntervalMs;
+    bool verifyJournal;
+    int metricsPort;               // 0 - HTTP-эндпоинт метрик отключен
+    int shards;                    // циклов событий; по умолчанию по одному на ядро
+    bool pinCpus;                  // закрепить поток каждого шарда за своим ядром
+    uint64_t tournamentGames;      // турнир ботов вместо запуска сервера; 0 - нет
+    std::string tournamentRules;   // вариант правил турнира: classic, blitz или large
+
+    ServerConfig()
+        : turnTimeoutMs(TURN_TIMEOUT_MS), turnTimeoutAction(TURN_TIMEOUT_FORFEIT),
+        setupTimeoutMs(SETUP_TIMEOUT_MS), queueTimeoutMs(QUEUE_TIMEOUT_MS), resumeGraceMs(RESUME_GRACE_MS), benchmarkOnly(false),
+        journalDirectory(DEFAULT_JOURNAL_DIR), checkpointFile(DEFAULT_CHECKPOINT_FILE),
+        checkpointIntervalMs(CHECKPOINT_INTERVAL_MS), verifyJournal(false), metricsPort(0),
+        shards(std::max(1, static_cast<int>(std::thread::hardware_concurrency()))), pinCpus(false),
+        tournamentGames(0), tournamentRules("classic") {
+    }
+
+    // Аргументы вида --turn-timeout=MS; возвращает false при неизвестном или неверном аргументе
+    bool parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            size_t equals = arg.find('=');
+            std::string key = arg.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+
+            if (arg == "--bench") {
+                benchmarkOnly = true;
+                continue;
+            }
+            if (arg == "--verify") {
+                verifyJournal = true;
+                continue;
+            }
+            if (arg == "--pin-cpus") {
+                pinCpus = true;
+                continue;
+            }
+            if (arg == "--tournament") {
+                tournamentGames = DEFAULT_TOURNAMENT_GAMES;
+                continue;
+            }
+            if (key == "--tournament") {
+                tournamentGames = parseGameCount(value);
+                if (tournamentGames == 0) return false;
+                continue;
+            }
+            if (key == "--rules") {
+                if (!isRulesName(value)) return false;
+                tournamentRules = value;
+                continue;
+            }
+            if (key == "--analyze") {
+                if (value.empty()) return false;
+                analyzeDirectory = value;
+                continue;
+            }
+
+            if (key == "--journal") {
+                if (value.empty()) return false;
+                journalDirectory = value == "off" ? "" : value;
+                continue;
+            }
+            if (key == "--checkpoint") {
+                if (value.empty()) return false;
+                checkpointFile = value == "off" ? "" : value;
+                continue;
+            }
+
+            if (key == "--turn-action") {
+                if (value == "forfeit") turnTimeoutAction = TURN_TIMEOUT_FORFEIT;
+                else if (value == "random") turnTimeoutAction = TURN_TIMEOUT_RANDOM_SHOT;
+                else return false;
+                continue;
+            }
+
+            int* target = key == "--turn-timeout" ? &turnTimeoutMs :
+                key == "--setup-timeout" ? &setupTimeoutMs :
+                key == "--queue-timeout" ? &queueTimeoutMs :
+                key == "--resume-grace" ? &resumeGraceMs :
+                key == "--checkpoint-interval" ? &checkpointIntervalMs :
+                key == "--metrics-port" ? &metricsPort :
+                key == "--shards" ? &shards : nullptr;
+            if (!target) return false;
+
+            try {
+                *target = std::stoi(value);
+            }
+            catch (const std::exception&) {
+                return false;
+            }
+            if (*target <= 0) return false;
+        }
+        shards = std::min(shards, MAX_SHARDS);
+        return true;
+    }
+
+    // Число партий турнира: положительное целое; 0 - ошибка
+    static uint64_t parseGameCount(const std::string& value) {
+        if (value.empty() || value.size() > 12 || !std::all_of(value.begin(), value.end(),
+            [](unsigned char ch) { return std::isdigit(ch) != 0; })) {
+            return 0;
+        }
+        return std::stoull(value);
+    }
+
+    static bool isRulesName(const std::string& value) {
+        return value == "classic" || value == "blitz" || value == "large";
+    }
+
+    static void printUsage() {
+        std::cout << "Usage: NavalBattle_server [options]\n";
+        std::cout << "  --turn-timeout=MS     Time limit for one move (default " << TURN_TIMEOUT_MS << ")\n";
+        std::cout << "  --turn-action=ACTION  On timeout: forfeit (default) or random (random shot)\n";
+        std::cout << "  --setup-timeout=MS    Time limit for ship placement (default " << SETUP_TIMEOUT_MS << ")\n";
+        std::cout << "  --queue-timeout=MS    Time to wait for an opponent (default " << QUEUE_TIMEOUT_MS << ")\n";
+        std::cout << "  --resume-grace=MS     Time to hold the seat of a disconnected player (default " << RESUME_GRACE_MS << ")\n";
+        std::cout << "  --journal=DIR|off     Game journal directory (default " << DEFAULT_JOURNAL_DIR << ")\n";
+        std::cout << "  --checkpoint=FILE|off Checkpoint of live games, restored on start (default " << DEFAULT_CHECKPOINT_FILE << ")\n";
+        std::cout << "  --checkpoint-interval=MS  Time between checkpoints (default " << CHECKPOINT_INTERVAL_MS << ")\n";
+        std::cout << "  --metrics-port=PORT   Serve Prometheus metrics on 127.0.0.1:PORT/metrics\n";
+        std::cout << "  --shards=N            Event loop threads (default: one per CPU core, at most " << MAX_SHARDS << ")\n";
+        std::cout << "  --pin-cpus            Pin each shard thread to its own CPU core\n";
+        std::cout << "  --bench               Run the engine benchmarks and exit (build with -DNAVALBATTLE_BENCH=1)\n";
+        std::cout << "  --analyze=DIR         Analyze a game journal and exit\n";
+        std::cout << "  --verify              With --analyze: replay every game and check the results\n";
+        std::cout << "  --tournament[=GAMES]  Play a bot tournament, GAMES per pairing (default "
+            << DEFAULT_TOURNAMENT_GAMES << "), and exit\n";
+        std::cout << "  --rules=RULES         Tournament rules: classic (10x10, default), blitz (8x8) or large (15x15)\n";
+    }
+};
+
+// Минимальный HTTP-сервер для Prometheus на 127.0.0.1: на GET /metrics отдает
+// текст, который строит render. Работает в своем потоке с блокирующими сокетами;
+// render читает только атомарные счетчики, поэтому цикл событий не ждет опроса.
+class MetricsEndpoint {
+public:
+    MetricsEndpoint() : listener(INVALID_SOCKET), running(false) {
+    }
+
+    ~MetricsEndpoint() {
+        stop();
+    }
+
+    bool start(int port, std::function<std::string()> renderMetrics) {
+        listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == INVALID_SOCKET) return false;
+
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (bind(listener, (SOCKADDR*)&address, sizeof(address)) == SOCKET_ERROR ||
+            listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+            safeCloseSocket(listener);
+            return false;
+        }
+
+        render = renderMetrics;
+        running = true;
+        thread = std::thread(&MetricsEndpoint::serve, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) return;
+        thread.join();
+        safeCloseSocket(listener);
+    }
+
+private:
+    SOCKET listener;
+    std::atomic<bool> running;
+    std::thread thread;
+    std::function<std::string()> render;
+
+    static const int ACCEPT_POLL_MS = 200;
+    static const int REQUEST_TIMEOUT_MS = 1000;
+
+    void serve() {
+        Trace::nameThread("metrics endpoint");
+        while (running) {
+            pollfd entry{};
+            entry.fd = listener;
+            entry.events = POLLIN;
+#ifdef _WIN32
+            int ready = WSAPoll(&entry, 1, ACCEPT_POLL_MS);
+#else
+            int ready = ::poll(&entry, 1, ACCEPT_POLL_MS);
+#endif
+            if (ready <= 0) continue;
+
+            SOCKET client = accept(listener, nullptr, nullptr);
+            if (client == INVALID_SOCKET) continue;
+            respond(client);
+            safeCloseSocket(client);
+        }
+    }
+
+    void respond(SOCKET client) {
+#ifdef _WIN32
+        DWORD timeout = REQUEST_TIMEOUT_MS;
+#else
+        timeval timeout{ REQUEST_TIMEOUT_MS / 1000, (REQUEST_TIMEOUT_MS % 1000) * 1000 };
+#endif
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        // Нужна только строка запроса; остальные заголовки не разбираются
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            int received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0) break;
+            request.append(buffer, received);
+        }
+
+        std::string status = "200 OK";
+        std::string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0) {
+            Trace::Span span("metrics scrape");
+            body = render();
+        }
+        else {
+            status = "404 Not Found";
+            body = "Only /metrics is served here\n";
+        }
+
+        std::string response = "HTTP/1.1 " + status + "\r\n";
+        response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+        response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        response += "Connection: close\r\n\r\n";
+        response += body;
+
+        size_t sent = 0;
+        while (sent < response.size()) {
+            int result = send(client, response.data() + sent, static_cast<int>(response.size() - sent), SEND_FLAGS);
+            if (result <= 0) break;
+            sent += result;
+        }
+    }
+};
+
+// Общая таблица рейтингов всех шардов. К ней обращаются только при
+// представлении игрока и в конце рейтинговой партии, поэтому хватает мьютекса
+class RatingBook {
+public:
+    int lookup(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ratings.emplace(name, DEFAULT_RATING).first->second;
+    }
+
+    void store(const std::string& name, int rating) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ratings[name] = rating;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, int> ratings;
+};
+
+// Идущие партии всех шардов, чтобы зритель из любого шарда нашел нужную.
+// Главная партия - с наибольшей суммой рейтингов игроков (при равенстве - более
+// новая). Обращения бывают только в начале и в конце партии и при подключении
+// зрителя, поэтому хватает мьютекса
+class GameDirectory {
+public:
+    struct Entry {
+        int shard;
+        SlotHandle handle;
+        int rating;
+    };
+
+    void add(uint64_t id, int shard, SlotHandle handle, int rating) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry entry{ shard, handle, rating };
+        games[id] = entry;
+        byRating.insert(std::make_pair(rating, id));
+    }
+
+    void remove(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = games.find(id);
+        if (it == games.end()) return;
+        byRating.erase(std::make_pair(it->second.rating, id));
+        games.erase(it);
+    }
+
+    // Партия id, а при id == 0 - главная партия; id заменяется номером найденной
+    bool find(uint64_t& id, Entry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id == 0) {
+            if (byRating.empty()) return false;
+            id = byRating.rbegin()->second;
+        }
+        auto it = games.find(id);
+        if (it == games.end()) return false;
+        entry = it->second;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> games;
+    std::set<std::pair<int, uint64_t>> byRating;
+};
+
+// Ожидающий игрок, который переходит в другой шард: сокет и все, что нужно,
+// чтобы продолжить ожидание там с тем же рейтингом и временем в очереди
+struct MigratingPlayer {
+    SOCKET socket;
+    sockaddr_in clientAddr;
+    int playerId;
+    std::string name;
+    bool rated;
+    int rating;
+    bool binaryProtocol;
+    std::chrono::steady_clock::time_point connectedAt;
+    std::chrono::steady_clock::time_point queuedAt;
+    std::string input;   // принятые, но еще не разобранные данные
+    std::string output;  // еще не отправленные данные
+    bool spectator;      // зритель переходит в шард партии watchGameId
+    uint64_t watchGameId;
+    bool resuming;       // переподключение к партии по resumeToken
+    std::string resumeToken;
+};
+
+// Шард сервера. Все сокеты шарда обслуживаются одним циклом событий: прием
+// подключений, матчмейкинг, ход игр (как конечных автоматов по GamePhase) и
+// очистка завершенных игр выполняются в одном потоке без блокирующих вызовов.
+// Шарды не делят ни сокетов, ни игр: общие у них только таблица рейтингов и
+// счетчики номеров игроков и партий.
+class ServerShard {
+private:
+    int index;
+    SOCKET serverSocket;
+    bool ownsListener;
+    int port;
+    std::atomic<bool> running;
+    Poller poller;
+    const ServerConfig& config;
+    const std::vector<std::unique_ptr<ServerShard>>& shards;
+    TimerWheel timers;
+    std::vector<Player*> admittedPlayers;
+    size_t negotiatingCount;
+    RatingQueue waitingPlayers;
+    RatingBook& ratings;
+    GameDirectory& directory;
+    SlotMap<Player> players;
+    SlotMap<Game> games;
+    std::vector<Game*> retiredGames;
+    std::vector<Player*> closingPlayers;
+    std::atomic<int>& nextPlayerId;
+    std::atomic<size_t> waitingCount;
+    std::atomic<size_t> queuedCount;
+    std::atomic<size_t> connectionCount;
+    std::atomic<size_t> activeGameCount;
+    std::atomic<uint64_t> finishedGameCount;
+    std::atomic<uint64_t> migratedIn;
+    std::atomic<uint64_t> migratedOut;
+    std::atomic<size_t> poolBytes;
+    std::atomic<size_t> spectatorCount;
+    MpscQueue<std::function<void()>> inbox;
+    EventWaker waker;
+    JournalWriter journal;
+    std::atomic<uint64_t>& nextGameId;
+    std::vector<SlotHandle> flushQueue;    // игроки с неотправленным outBuffer
+    std::vector<SlotHandle> flushing;
+    std::vector<SlotHandle> spectatorFlushQueue;  // зрители с неотправленным outBuffer
+    size_t spectatorFlushHead;
+    std::string threadName;
+
+public:
+    ServerShard(int shardIndex, int serverPort, const ServerConfig& serverConfig,
+        const std::vector<std::unique_ptr<ServerShard>>& allShards, RatingBook& ratingBook,
+        GameDirectory& gameDirectory, std::atomic<int>& playerIds, std::atomic<uint64_t>& gameIds)
+        : index(shardIndex), serverSocket(INVALID_SOCKET), ownsListener(false), port(serverPort), running(false),
+        config(serverConfig), shards(allShards), negotiatingCount(0), ratings(ratingBook), directory(gameDirectory),
+        nextPlayerId(playerIds), waitingCount(0), queuedCount(0), connectionCount(0), activeGameCount(0),
+        finishedGameCount(0), migratedIn(0), migratedOut(0), poolBytes(0), spectatorCount(0), nextGameId(gameIds),
+        spectatorFlushHead(0), threadName("shard " + std::to_string(shardIndex)) {
+    }
+
+    ~ServerShard() {
+        shutdown();
+    }
+
+    // Слушающий сокет шарда. Где есть SO_REUSEPORT, у каждого шарда свой сокет
+    // на общем порту и ядро само распределяет подключения; иначе шарды делят
+    // сокет sharedListener первого шарда и принимают подключения по очереди
+    bool initialize(SOCKET sharedListener) {
+        ownsListener = sharedListener == INVALID_SOCKET;
+        if (ownsListener) {
+            if (!openListener()) return false;
+        }
+        else {
+            serverSocket = sharedListener;
+        }
+
+        if (!poller.open() || !waker.open() ||
+            !poller.add(serverSocket, nullptr, false) || !poller.add(waker.handle(), &waker, false)) {
+            std::cerr << "Failed to set up event loop: " << WSAGetLastError() << "\n";
+            if (ownsListener) safeCloseSocket(serverSocket);
+            serverSocket = INVALID_SOCKET;
+            return false;
+        }
+
+        // Без журнала сервер продолжает работать, партии просто не сохраняются
+        if (!config.journalDirectory.empty() && !journal.open(config.journalDirectory, index)) {
+            std::cerr << "Failed to open game journal in " << config.journalDirectory
+                << ", games of shard " << index << " will not be recorded\n";
+        }
+        running = true;
+        return true;
+    }
+
+    // Поток шарда: цикл событий до остановки
+    void run() {
+        if (config.pinCpus) {
+            pinToCpu();
+        }
+        Trace::nameThread(threadName.c_str());
+        eventLoop();
+    }
+
+    void requestStop() {
+        post([this]() { running = false; });
+    }
+
+    // Передает задачу в поток цикла событий и будит его
+    void post(std::function<void()> task) {
+        inbox.push(std::move(task));
+        waker.wake();
+    }
+
+    SOCKET listener() const { return serverSocket; }
+    size_t waitingPlayerCount() const { return waitingCount; }
+    size_t queuedPlayerCount() const { return queuedCount; }
+    size_t connections() const { return connectionCount; }
+    size_t activeGames() const { return activeGameCount; }
+    uint64_t finishedGames() const { return finishedGameCount; }
+    uint64_t playersMigratedIn() const { return migratedIn; }
+    uint64_t playersMigratedOut() const { return migratedOut; }
+    size_t reservedPoolBytes() const { return poolBytes; }
+    size_t spectators() const { return spectatorCount; }
+    const JournalWriter& gameJournal() const { return journal; }
+
+    // Дописывает идущие партии шарда в контрольную точку и возвращает их число.
+    // Вызывается в потоке шарда или после его завершения
+    uint32_t checkpointGames(std::vector<char>& out) {
+        uint32_t count = 0;
+        for (auto game : games) {
+            if (!restorable(game)) continue;
+            CheckpointFile::encodeGame(*game, out);
+            count++;
+        }
+        return count;
+    }
+
+    // Партия из контрольной точки прежнего процесса. Флоты расставляются и
+    // выстрелы повторяются по записи журнала, затем оба игрока ждут
+    // переподключения по своим токенам, как после обрыва связи.
+    // Вызывается до запуска потока шарда
+    bool restoreGame(const Checkpoint::GameEntry& entry, const char* record) {
+        Journal::RecordHeader header;
+        std::memcpy(&header, record, sizeof(header));
+        const char* cursor = record + sizeof(header);
+
+        Player* seats[2];
+        sockaddr_in noAddr{};
+        for (int i = 0; i < 2; i++) {
+            bool computer = i == 1 && (header.flags & Journal::FLAG_COMPUTER) != 0;
+            SlotHandle handle = players.emplace(INVALID_SOCKET, noAddr,
+                static_cast<int>(header.playerIds[i]), computer ? nullptr : &poller);
+            Player* player = players.get(handle);
+            player->handle = handle;
+            player->computer = computer;
+            player->negotiated = true;
+            player->ready = true;
+            player->name.assign(entry.names[i], strnlen(entry.names[i], MAX_PLAYER_NAME));
+            player->rated = (header.flags & (i == 0 ? Journal::FLAG_FIRST_RATED : Journal::FLAG_SECOND_RATED)) != 0;
+            player->ticket.rating = entry.ratings[i];
+            if (!computer) {
+                player->resumeToken.assign(entry.resumeTokens[i], strnlen(entry.resumeTokens[i], MAX_RESUME_TOKEN));
+                player->flushQueue = &flushQueue;
+                player->connected = false;
+                player->suspended = true;
+            }
+            seats[i] = player;
+        }
+
+        bool consistent = true;
+        for (int i = 0; i < 2; i++) {
+            for (int s = 0; s < header.shipCounts[i]; s++) {
+                Journal::ShipEntry ship;
+                std::memcpy(&ship, cursor, sizeof(ship));
+                cursor += sizeof(ship);
+                consistent &= ship.cell < BOARD_CELLS && seats[i]->placeShip(ship.shape & 0x7F,
+                    ship.cell % BOARD_SIZE, ship.cell / BOARD_SIZE, (ship.shape & 0x80) != 0);
+            }
+        }
+        std::vector<Journal::ShotEntry> shots(header.shotCount);
+        if (!shots.empty()) {
+            std::memcpy(shots.data(), cursor, shots.size() * sizeof(Journal::ShotEntry));
+        }
+        for (size_t s = 0; s < shots.size() && consistent; s++) {
+            int shooter = shots[s].result >> 7;
+            consistent = shots[s].cell < BOARD_CELLS && seats[shooter]->shootAt(*seats[1 - shooter],
+                shots[s].cell % BOARD_SIZE, shots[s].cell / BOARD_SIZE) == (shots[s].result & 0x7F);
+        }
+        if (!consistent || seats[0]->allShipsSunk() || seats[1]->allShipsSunk()) {
+            players.erase(seats[0]->handle);
+            players.erase(seats[1]->handle);
+            return false;
+        }
+
+        SlotHandle handle = games.emplace(seats[0], seats[1], &retiredGames);
+        Game* game = games.get(handle);
+        game->handle = handle;
+        game->id = header.gameId;
+        game->startedAt = std::chrono::system_clock::time_point(std::chrono::milliseconds(header.startUnixMs));
+        game->startedClock = std::chrono::steady_clock::now() - std::chrono::milliseconds(header.durationMs);
+        game->lastShotAt = std::chrono::steady_clock::now();
+        game->shots.swap(shots);
+        game->gameStarted = true;
+        game->phase = PHASE_TURN;
+        game->currentPlayer = seats[entry.currentPlayer == 0 ? 0 : 1];
+        directory.add(game->id, index, handle, seats[0]->ticket.rating + seats[1]->ticket.rating);
+        timers.schedule(&game->timer, config.turnTimeoutMs, TIMER_TURN);
+        for (Player* player : seats) {
+            player->game = game;
+            if (player->rated) {
+                ratings.store(player->name, player->ticket.rating);
+            }
+            if (player->suspended) {
+                timers.schedule(&player->timer, config.resumeGraceMs, TIMER_RESUME);
+            }
+        }
+        connectionCount = players.size();
+        activeGameCount = games.size();
+        return true;
+    }
+
+    // Вызывается после завершения потока шарда. Если партии сохранены в
+    // контрольной точке, они не завершаются: игроки отключаются без GAME_OVER
+    // и продолжат партии в новом процессе
+    void shutdown(bool gamesSaved = false) {
+        running = false;
+
+        // Закрыть все активные игры. Сохраненная партия завершается уже после
+        // записи журнала (в games.clear()) и в журнал этого процесса не попадает
+        for (auto game : games) {
+            if (!gamesSaved || !restorable(game)) {
+                game->endGame("Server shutdown");
+                continue;
+            }
+            for (Player* player : { game->player1, game->player2 }) {
+                if (!player->connected || player->computer) continue;
+                sendInfo(player, "Server is restarting. Your game is saved, reconnect to continue it.\n");
+                flushOutput(player);
+                player->disconnect();
+            }
+        }
+        for (auto game : retiredGames) {
+            journal.append(*game);
+        }
+        journal.close();
+        games.clear();
+        retiredGames.clear();
+
+        // Очистить очередь ожидания
+        while (!waitingPlayers.empty()) {
+            waitingPlayers.remove(waitingPlayers.front());
+        }
+        for (auto player : players) {
+            if (player->connected && !player->closing) {
+                sendInfo(player, "Server is shutting down. Goodbye!\n");
+            }
+            if (player->connected) {
+                flushOutput(player);
+            }
+        }
+        admittedPlayers.clear();
+        negotiatingCount = 0;
+        closingPlayers.clear();
+        players.clear();
+
+        if (serverSocket != INVALID_SOCKET) {
+            poller.remove(waker.handle());
+            waker.close();
+            poller.remove(serverSocket);
+            if (ownsListener) {
+                safeCloseSocket(serverSocket);
+            }
+            serverSocket = INVALID_SOCKET;
+            poller.close();
+        }
+    }
+
+private:
+    bool openListener() {
+        serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (serverSocket == INVALID_SOCKET) {
+            std::cerr << "Error creating socket: " << WSAGetLastError() << "\n";
+            return false;
+        }
+
+        int yes = 1;
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes)) == SOCKET_ERROR) {
+            std::cerr << "Setsockopt failed: " << WSAGetLastError() << "\n";
+            safeCloseSocket(serverSocket);
+            return false;
+        }
+#ifdef SO_REUSEPORT
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&yes, sizeof(yes)) == SOCKET_ERROR) {
+            std::cerr << "Setsockopt SO_REUSEPORT failed: " << WSAGetLastError() << "\n";
+            safeCloseSocket(serverSocket);
+            return false;
+        }
+#endif
+
+        sockaddr_in serverAddr{};
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_addr.s_addr = INADDR_ANY;
+        serverAddr.sin_port = htons(port);
+
+        if (bind(serverSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+            std::cerr << "Bind failed on port " << port << ": " << WSAGetLastError() << "\n";
+            safeCloseSocket(serverSocket);
+            return false;
+        }
+
+        if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR) {
+            std::cerr << "Listen failed: " << WSAGetLastError() << "\n";
+            safeCloseSocket(serverSocket);
+            return false;
+        }
+
+        if (!setNonBlocking(serverSocket)) {
+            std::cerr << "Failed to make listening socket non-blocking: " << WSAGetLastError() << "\n";
+            safeCloseSocket(serverSocket);
+            return false;
+        }
+        return true;
+    }
+
+    // Шард i работает на ядре i (по модулю числа ядер)
+    void pinToCpu() {
+        unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+        unsigned cpu = static_cast<unsigned>(index) % cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        bool pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+        bool pinned = SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#else
+        bool pinned = false;
+#endif
+        if (!pinned) {
+            std::cerr << "Failed to pin shard " << index << " to CPU " << cpu << "\n";
+        }
+    }
+
+private:
+    void eventLoop() {
+        std::vector<Poller::Event> events;
+        events.reserve(MAX_POLL_EVENTS);
+
+        while (running) {
+            int count;
+            {
+                Trace::Span span("poll wait");
+                count = poller.wait(events, nextPollTimeout());
+                Metrics::add(Metrics::POLL_CALLS);
+            }
+            if (count < 0) {
+                if (running) {
+                    std::cerr << "Poll error in event loop: " << WSAGetLastError() << std::endl;
+                }
+                break;
+            }
+
+            for (const auto& ev : events) {
+                if (ev.token == nullptr) {
+                    acceptConnections();
+                }
+                else if (ev.token == &waker) {
+                    waker.drain();
+                    runInboxTasks();
+                }
+                else {
+                    handlePlayerEvent(static_cast<Player*>(ev.token), ev);
+                }
+            }
+
+            // Удаление объектов происходит только здесь, после обработки всех
+            // событий итерации, чтобы в events не оставалось висячих указателей
+            runTimers();
+            admitNegotiatedPlayers();
+            matchmakePlayers();
+            reclaimFinishedGames();
+            flushPendingOutput();
+            flushSpectatorOutput();
+            cleanupClosingPlayers();
+            journal.flushIfDue(std::chrono::steady_clock::now());
+
+            waitingCount = waitingPlayers.size() + negotiatingCount + admittedPlayers.size();
+            queuedCount = waitingPlayers.size();
+            connectionCount = players.size();
+            activeGameCount = games.size();
+            poolBytes = players.reservedBytes() + games.reservedBytes();
+        }
+    }
+
+    // Выполняет задачи, переданные циклу событий из других потоков
+    void runInboxTasks() {
+        std::function<void()> task;
+        while (inbox.pop(task)) {
+            task();
+        }
+    }
+
+    // Цикл спит до ближайшего срабатывания таймера, но не дольше POLL_TIMEOUT_MS
+    int nextPollTimeout() const {
+        if (!flushQueue.empty() || spectatorFlushHead < spectatorFlushQueue.size()) return 0;
+        return timers.millisecondsUntilNext(std::chrono::steady_clock::now(), POLL_TIMEOUT_MS);
+    }
+
+    void runTimers() {
+        timers.advance(std::chrono::steady_clock::now(), [this](TimerNode* timer) {
+            onTimer(timer);
+        });
+    }
+
+    void onTimer(TimerNode* timer) {
+        switch (timer->kind) {
+        case TIMER_NEGOTIATION: {
+            Player* player = static_cast<Player*>(timer->owner);
+            player->negotiated = true;
+            admittedPlayers.push_back(player);
+            break;
+        }
+        case TIMER_QUEUE_IDLE:
+            evictIdlePlayer(static_cast<Player*>(timer->owner));
+            break;
+        case TIMER_SETUP: {
+            Game* game = static_cast<Game*>(timer->owner);
+            Metrics::add(Metrics::DISCONNECT_SETUP_TIMEOUT);
+            game->endGame("Ship placement timed out");
+            break;
+        }
+        case TIMER_TURN:
+            onTurnTimeout(static_cast<Game*>(timer->owner));
+            break;
+        case TIMER_RESUME:
+            expireSession(static_cast<Player*>(timer->owner));
+            break;
+        }
+    }
+
+    void acceptConnections() {
+        Trace::Span span("accept");
+        while (running) {
+            sockaddr_in clientAddr;
+            socklen_t clientAddrSize = sizeof(clientAddr);
+            SOCKET clientSocket = accept(serverSocket, (SOCKADDR*)&clientAddr, &clientAddrSize);
+
+            if (clientSocket == INVALID_SOCKET) {
+                int error = WSAGetLastError();
+                if (isInterrupted(error)) {
+                    continue;
+                }
+                if (!isWouldBlock(error)) {
+                    std::cerr << "Accept error: " << error << std::endl;
+                }
+                return;
+            }
+
+            if (!setNonBlocking(clientSocket)) {
+                std::cerr << "Failed to make client socket non-blocking: " << WSAGetLastError() << std::endl;
+                safeCloseSocket(clientSocket);
                 continue;
             }
-            return false;
+
+            // Ход уходит одной отправкой за итерацию, ждать накопления данных
+            // по алгоритму Нейгла незачем
+            int noDelay = 1;
+            setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof(noDelay));
+
+            char clientIP[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
+
+            std::cout << "New connection from " << clientIP << ":"
+                << ntohs(clientAddr.sin_port) << std::endl;
+
+            SlotHandle handle = players.emplace(clientSocket, clientAddr, nextPlayerId++, &poller);
+            Player* newPlayer = players.get(handle);
+            newPlayer->handle = handle;
+            newPlayer->flushQueue = &flushQueue;
+            if (!poller.add(clientSocket, newPlayer)) {
+                std::cerr << "Failed to register client socket: " << WSAGetLastError() << std::endl;
+                newPlayer->poller = nullptr;
+                players.erase(handle);
+                continue;
+            }
+
+            // Отправляем приветственное сообщение
+            std::string welcomeMsg = "Welcome to Sea Battle Server!\n";
+            welcomeMsg += "You are Player " + std::to_string(newPlayer->playerId) + "\n";
+            welcomeMsg += "Waiting for opponent...\n";
+            safeSend(newPlayer, welcomeMsg);
+
+            // До выбора протокола игрок не участвует в матчмейкинге
+            negotiatingCount++;
+            timers.schedule(&newPlayer->timer, NEGOTIATION_TIMEOUT_MS, TIMER_NEGOTIATION);
         }
-        totalSent += sent;
     }
-    return true;
-}
 
-bool safeRecv(SOCKET socket, std::string& data, int maxSize = BUFFER_SIZE) {
-    if (socket == INVALID_SOCKET) return false;
+    void handlePlayerEvent(Player* player, const Poller::Event& ev) {
+        if (!player->connected) return;
 
-    char buffer[BUFFER_SIZE];
-    int bytesReceived = recv(socket, buffer, maxSize - 1, 0);
+        if (ev.writable && !player->outBuffer.empty()) {
+            if (!flushOutput(player)) {
+                onPlayerDisconnected(player, Metrics::DISCONNECT_SEND_FAILED);
+                return;
+            }
+            if (player->readPaused && player->outBuffer.size() <= OUTPUT_HIGH_WATER_BYTES) {
+                resumeReading(player);
+                return;
+            }
+        }
 
-    if (bytesReceived == SOCKET_ERROR) {
-        int error = WSAGetLastError();
-        return false;
+        // Пока клиент не разберет отправленное, его новые ходы не читаются:
+        // данные ждут в буфере сокета, и TCP сам притормаживает отправителя
+        if (ev.error || (ev.readable && player->outBuffer.size() <= OUTPUT_HIGH_WATER_BYTES)) {
+            readInput(player);
+        }
+        else if (ev.readable) {
+            player->readPaused = true;
+        }
     }
-    else if (bytesReceived == 0) {
-        return false;
+
+    // После паузы сначала разбираются уже принятые ходы, затем читаются данные,
+    // пришедшие за это время: в режиме edge-triggered о них повторно не сообщат
+    void resumeReading(Player* player) {
+        player->readPaused = false;
+        if (player->game && player->game->currentPlayer == player) {
+            advanceGame(player->game);
+            if (player->readPaused || !player->connected) return;
+        }
+        readInput(player);
     }
 
-    buffer[bytesReceived] = '\0';
-    data = std::string(buffer, bytesReceived);
+    void readInput(Player* player) {
+        if (!safeRecv(player)) {
+            // Полный буфер означает, что клиент прислал слишком длинную строку или кадр
+            bool overflow = player->inBuffer.size() == player->inBuffer.capacity();
+            onPlayerDisconnected(player, overflow ? Metrics::DISCONNECT_PROTOCOL_ERROR : Metrics::DISCONNECT_CLOSED);
+            return;
+        }
 
-    data.erase(std::remove(data.begin(), data.end(), '\r'), data.end());
-    data.erase(std::remove(data.begin(), data.end(), '\n'), data.end());
+        if (!player->negotiated) {
+            negotiateProtocol(player);
+            if (player->negotiated) {
+                timers.cancel(&player->timer);
+                admittedPlayers.push_back(player);
+            }
+        }
+        else if (player->spectator) {
+            // Зрителю нечего присылать
+            player->inBuffer.consume(player->inBuffer.size());
+        }
 
-    return true;
-}
+        if (player->game && player->game->currentPlayer == player) {
+            advanceGame(player->game);
+        }
+    }
 
-// Функция для безопасного закрытия сокета
-void safeCloseSocket(SOCKET& socket) {
-    if (socket != INVALID_SOCKET) {
-        shutdown(socket, SD_BOTH);
-        closesocket(socket);
-        socket = INVALID_SOCKET;
+    // Переключает клиента на бинарный протокол, если первой строкой он прислал PROTO BIN1.
+    // Любые другие данные означают текстового клиента.
+    void negotiateProtocol(Player* player) {
+        if (player->negotiated) return;
+
+        const std::string& hello = Protocol::BINARY_HELLO;
+        RingBuffer& buffer = player->inBuffer;
+
+        // До выбора протокола клиент может представиться (NAME <имя>),
+        // попросить игру с компьютером (PLAY COMPUTER) или вернуться в прерванную
+        // партию (RESUME <токен>)
+        while (!buffer.empty() && (buffer.startsWith(Protocol::NAME_COMMAND) ||
+            buffer.startsWith(Protocol::COMPUTER_COMMAND) || buffer.startsWith(Protocol::RESUME_COMMAND))) {
+            size_t length = peekLine(buffer);
+            if (length == RingBuffer::npos) return;
+
+            if (buffer.startsWith(Protocol::NAME_COMMAND)) {
+                applyName(player, buffer, length);
+            }
+            else if (buffer.startsWith(Protocol::RESUME_COMMAND)) {
+                applyResumeToken(player, buffer, length);
+            }
+            else {
+                player->wantsComputer = true;
+            }
+            buffer.consume(length + 1);
+        }
+
+        // WATCH [номер партии] - клиент будет зрителем; зрители получают текст
+        if (buffer.startsWith(Protocol::WATCH_COMMAND)) {
+            size_t length = peekLine(buffer);
+            if (length == RingBuffer::npos) return;
+
+            player->wantsToWatch = true;
+            player->watchGameId = parseGameId(buffer, Protocol::WATCH_COMMAND.size(), length);
+            buffer.consume(length + 1);
+            player->negotiated = true;
+            return;
+        }
+
+        if (buffer.empty()) return;
+        if (!buffer.startsWith(hello)) {
+            player->negotiated = true;
+            return;
+        }
+
+        size_t length = peekLine(buffer);
+        if (length == RingBuffer::npos) return;
+
+        if (length == hello.size() || (length == hello.size() + 1 && buffer.at(hello.size()) == '\r')) {
+            safeSend(player, Protocol::BINARY_ACCEPTED);
+            player->binaryProtocol = true;
+        }
+        buffer.consume(length + 1);
+        player->negotiated = true;
     }
-}
 
-// Класс для управления сервером
-class GameServer {
-private:
-    SOCKET serverSocket;
-    int port;
-    std::atomic<bool> running;
-    std::queue<Player*> waitingPlayers;
-    std::vector<Game*> activeGames;
-    std::vector<std::thread> gameThreads;
-    std::mutex queueMutex;
-    std::mutex gamesMutex;
-    int nextPlayerId;
+    // Номер партии после команды; без номера или с ошибкой в нем - 0 (главная партия)
+    static uint64_t parseGameId(const RingBuffer& buffer, size_t begin, size_t length) {
+        uint64_t id = 0;
+        size_t digits = 0;
+        for (size_t i = begin; i < length; i++) {
+            char ch = buffer.at(i);
+            if (ch >= '0' && ch <= '9' && digits < 18) {
+                id = id * 10 + static_cast<uint64_t>(ch - '0');
+                digits++;
+            }
+            else if (ch != ' ' && ch != '\r') {
+                return 0;
+            }
+        }
+        return id;
+    }
 
-public:
-    GameServer(int serverPort) : port(serverPort), running(false), nextPlayerId(1) {
-        serverSocket = INVALID_SOCKET;
+    // Имя - от 1 до MAX_PLAYER_NAME латинских букв, цифр, '_' или '-'.
+    // Недопустимое имя игнорируется, игрок остается безымянным и без рейтинга.
+    void applyName(Player* player, const RingBuffer& buffer, size_t length) {
+        if (length > 0 && buffer.at(length - 1) == '\r') length--;
+
+        std::string name;
+        for (size_t i = Protocol::NAME_COMMAND.size(); i < length; i++) {
+            char ch = buffer.at(i);
+            if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '_' && ch != '-') return;
+            name += ch;
+        }
+        if (name.empty() || name.size() > static_cast<size_t>(MAX_PLAYER_NAME)) return;
+
+        player->name = name;
+        player->rated = true;
+        player->ticket.rating = ratings.lookup(name);
     }
 
-    ~GameServer() {
-        stop();
+    // Токен - номер партии, '-' и шестнадцатеричный секрет (см. issueResumeToken).
+    // Строка с посторонними символами игнорируется, и клиент становится обычным игроком
+    void applyResumeToken(Player* player, const RingBuffer& buffer, size_t length) {
+        if (length > 0 && buffer.at(length - 1) == '\r') length--;
+
+        std::string token;
+        for (size_t i = Protocol::RESUME_COMMAND.size(); i < length; i++) {
+            char ch = buffer.at(i);
+            if (!std::isxdigit(static_cast<unsigned char>(ch)) && ch != '-') return;
+            token += ch;
+        }
+        if (token.empty() || token.size() > MAX_RESUME_TOKEN) return;
+
+        player->resumeToken = token;
+        player->wantsToResume = true;
     }
 
-    bool initialize() {
-        WSADATA wsaData;
-        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-            std::cerr << "WSAStartup failed\n";
+    // Игроки, выбравшие протокол за эту итерацию, попадают в матчмейкинг.
+    // Старые клиенты ничего не присылают до своего хода, поэтому после
+    // NEGOTIATION_TIMEOUT_MS молчания таймер считает игрока текстовым.
+    void admitNegotiatedPlayers() {
+        auto now = std::chrono::steady_clock::now();
+        for (auto player : admittedPlayers) {
+            negotiatingCount--;
+            if (!player->connected) {
+                players.erase(player->handle);
+            }
+            else if (player->wantsToResume) {
+                resumeSession(player);
+            }
+            else if (player->wantsToWatch) {
+                watchGame(player);
+            }
+            else {
+                enqueuePlayer(player, now);
+            }
+        }
+        admittedPlayers.clear();
+    }
+
+    void onPlayerDisconnected(Player* player, Metrics::Counter reason) {
+        Metrics::add(reason);
+        player->disconnect();
+
+        // Из очереди ожидания игрок убирается сразу, а удаляется после обработки событий
+        if (player->ticket.queued) {
+            waitingPlayers.remove(&player->ticket);
+            timers.cancel(&player->timer);
+            closingPlayers.push_back(player);
+        }
+        else if (player->timer.scheduled() && player->timer.kind == TIMER_NEGOTIATION) {
+            timers.cancel(&player->timer);
+            negotiatingCount--;
+            closingPlayers.push_back(player);
+        }
+        else if (player->spectator && !player->closing) {
+            dropSpectator(player);
+        }
+
+        // Обрыв соединения не прерывает партию сразу: место игрока ждет его
+        // возвращения по токену. Нарушившего протокол ждать незачем
+        Game* game = player->game;
+        if (game && game->active && !player->closing) {
+            bool dropped = reason == Metrics::DISCONNECT_CLOSED || reason == Metrics::DISCONNECT_SEND_FAILED;
+            if (dropped && !player->resumeToken.empty()) {
+                suspendPlayer(player);
+                return;
+            }
+            std::cout << "Player " << player->playerId << " disconnected during game\n";
+            game->endGame("Player disconnected");
+        }
+    }
+
+    // Место игрока остается за ним config.resumeGraceMs. Все это время партия
+    // идет как обычно: соперник ходит, таймер хода не останавливается, а то,
+    // что игроку нужно было отправить, он получит одним снимком при возвращении
+    void suspendPlayer(Player* player) {
+        Game* game = player->game;
+        player->suspended = true;
+        player->readPaused = false;
+        player->inBuffer.consume(player->inBuffer.size());
+        player->outBuffer.clear();
+        timers.schedule(&player->timer, config.resumeGraceMs, TIMER_RESUME);
+        Metrics::add(Metrics::SESSIONS_SUSPENDED);
+        std::cout << "Player " << player->playerId << " lost connection during game " << game->id
+            << ", holding the seat for " << config.resumeGraceMs << " ms\n";
+
+        Player* opponent = player == game->player1 ? game->player2 : game->player1;
+        if (!sendInfo(opponent, "Your opponent lost connection. Waiting up to " +
+            std::to_string((config.resumeGraceMs + 999) / 1000) + " s for them to come back...\n")) {
+            game->endGame("Player disconnected");
+        }
+    }
+
+    // Игрок не вернулся вовремя: партия прерывается, как при обычном отключении
+    void expireSession(Player* player) {
+        Game* game = player->game;
+        if (!player->suspended || !game || !game->active) return;
+
+        Metrics::add(Metrics::SESSIONS_EXPIRED);
+        std::cout << "Player " << player->playerId << " did not come back to game " << game->id << "\n";
+        game->endGame("Player disconnected");
+    }
+
+    // Токен выдается каждому игроку-человеку в начале партии: номер партии,
+    // по которому GameDirectory найдет ее шард, и 64 случайных бита, без которых
+    // чужое место не занять
+    void issueResumeToken(Game* game, Player* player) {
+        std::random_device entropy;
+        uint64_t secret = (static_cast<uint64_t>(entropy()) << 32) | entropy();
+        char text[17];
+        std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(secret));
+        player->resumeToken = std::to_string(game->id) + "-" + text;
+    }
+
+    // Новое соединение с токеном занимает место игрока в его партии. Партия
+    // ищется по номеру из токена; если она идет в другом шарде, соединение
+    // переходит туда, как у зрителя
+    void resumeSession(Player* player) {
+        uint64_t id = 0;
+        size_t digits = 0;
+        while (digits < player->resumeToken.size() && digits < 18 &&
+            std::isdigit(static_cast<unsigned char>(player->resumeToken[digits]))) {
+            id = id * 10 + static_cast<uint64_t>(player->resumeToken[digits++] - '0');
+        }
+
+        GameDirectory::Entry entry;
+        if (id == 0 || !directory.find(id, entry)) {
+            rejectResume(player);
+            return;
+        }
+        if (entry.shard != index) {
+            migratePlayer(player, shards[entry.shard].get());
+            return;
+        }
+
+        Game* game = games.get(entry.handle);
+        Player* seat = nullptr;
+        if (game && game->id == id && game->active) {
+            for (Player* candidate : { game->player1, game->player2 }) {
+                if (!candidate->computer && candidate->resumeToken == player->resumeToken) seat = candidate;
+            }
+        }
+        if (!seat) {
+            rejectResume(player);
+            return;
+        }
+        takeSeat(seat, player);
+    }
+
+    void rejectResume(Player* player) {
+        sendGameOver(player, OUTCOME_ABORTED, "GAME_OVER: The game is over or the resume token is invalid\n");
+        releasePlayer(player);
+    }
+
+    // Сокет нового соединения переходит к игроку в партии, и объект соединения
+    // удаляется. Старое соединение могло еще не заметить обрыва: оно закрывается,
+    // и неотправленное ему отбрасывается. Затем игрок получает оба поля и текущий ход
+    void takeSeat(Player* seat, Player* connection) {
+        Game* game = seat->game;
+        bool wasSuspended = seat->suspended;
+        seat->disconnect();
+        timers.cancel(&seat->timer);
+        seat->outBuffer.clear();
+        seat->inBuffer.consume(seat->inBuffer.size());
+
+        poller.remove(connection->socket);
+        seat->socket = connection->socket;
+        seat->clientAddr = connection->clientAddr;
+        seat->binaryProtocol = connection->binaryProtocol;
+        seat->connected = true;
+        seat->suspended = false;
+        seat->readPaused = false;
+        // Приветствие и ответ на PROTO уходят клиенту раньше снимка
+        seat->outBuffer.append(connection->outBuffer.toString());
+        copyInput(connection->inBuffer, seat->inBuffer);
+
+        connection->socket = INVALID_SOCKET;
+        connection->connected = false;
+        players.erase(connection->handle);
+
+        if (!poller.add(seat->socket, seat)) {
+            std::cerr << "Failed to register resumed player socket: " << WSAGetLastError() << "\n";
+            onPlayerDisconnected(seat, Metrics::DISCONNECT_CLOSED);
+            return;
+        }
+
+        Metrics::add(Metrics::SESSIONS_RESUMED);
+        std::cout << "Player " << seat->playerId << " resumed game " << game->id << "\n";
+
+        bool yourTurn = game->currentPlayer == seat;
+        if (!sendInfo(seat, "Reconnected to game " + std::to_string(game->id) + ".\n") ||
+            (seat->binaryProtocol && !sendBoardSnapshot(seat)) || !sendTurn(seat, yourTurn)) {
+            game->endGame("Failed to send game state");
+            return;
+        }
+        if (wasSuspended) {
+            Player* opponent = seat == game->player1 ? game->player2 : game->player1;
+            sendInfo(opponent, "Your opponent is back.\n");
+        }
+        // Ход может быть за компьютером: после восстановления из контрольной
+        // точки он ждал возвращения соперника
+        advanceGame(game);
+    }
+
+    // Партию можно продолжить в новом процессе: ходы уже идут и все
+    // выстрелы помещаются в запись журнала
+    static bool restorable(const Game* game) {
+        return game->active && game->phase == PHASE_TURN && game->shots.size() < Journal::MAX_SHOTS;
+    }
+
+    // Дописывает непрочитанные данные одного буфера в другой
+    static void copyInput(const RingBuffer& from, RingBuffer& to) {
+        size_t copied = 0;
+        while (copied < from.size()) {
+            size_t space;
+            char* span = to.writeSpan(space);
+            if (space == 0) return;
+            size_t length = std::min(space, from.size() - copied);
+            for (size_t i = 0; i < length; i++) {
+                span[i] = from.at(copied + i);
+            }
+            to.commit(length);
+            copied += length;
+        }
+    }
+
+    // Новый игрок сразу ищет соперника в начальном окне рейтинга,
+    // а если не нашел - встает в очередь
+    void enqueuePlayer(Player* player, std::chrono::steady_clock::time_point now) {
+        if (player->wantsComputer) {
+            startComputerGame(player);
+            return;
+        }
+
+        MatchTicket* opponent = waitingPlayers.findOpponent(&player->ticket, MATCH_WINDOW_BUCKETS);
+        if (opponent) {
+            waitingPlayers.remove(opponent);
+            startGame(static_cast<Player*>(opponent->owner), player);
+            return;
+        }
+
+        waitingPlayers.push(&player->ticket, now);
+        timers.schedule(&player->timer, config.queueTimeoutMs, TIMER_QUEUE_IDLE);
+    }
+
+    // Игрок, так и не дождавшийся соперника, отключается
+    void evictIdlePlayer(Player* player) {
+        Metrics::add(Metrics::DISCONNECT_QUEUE_TIMEOUT);
+        waitingPlayers.remove(&player->ticket);
+        std::cout << "Player " << player->playerId << " left the queue: no opponent found\n";
+        sendGameOver(player, OUTCOME_ABORTED, "GAME_OVER: No opponent found\n");
+        releasePlayer(player);
+    }
+
+    // Окна ожидающих игроков со временем расширяются. За итерацию повторно
+    // проверяются только MATCH_RECHECK_PER_TICK самых давних заявок: у них окна
+    // самые широкие, а стоимость итерации не зависит от длины очереди.
+    void matchmakePlayers() {
+        MatchTicket* ticket = waitingPlayers.front();
+        if (!ticket) return;
+
+        Trace::Span span("matchmaking");
+        auto now = std::chrono::steady_clock::now();
+
+        for (int checked = 0; ticket && checked < MATCH_RECHECK_PER_TICK; checked++) {
+            MatchTicket* next = ticket->ageNext;
+            MatchTicket* opponent = waitingPlayers.findOpponent(ticket, RatingQueue::windowFor(*ticket, now));
+            if (opponent) {
+                if (opponent == next) next = opponent->ageNext;
+                waitingPlayers.remove(ticket);
+                waitingPlayers.remove(opponent);
+                startGame(static_cast<Player*>(ticket->owner), static_cast<Player*>(opponent->owner));
+            }
+            ticket = next;
+        }
+
+        offerLonelyPlayer(now);
+    }
+
+    // Если в шарде нечетное число ожидающих и самый давний из них дольше
+    // MATCH_STEAL_AFTER_MS не нашел пары, он переходит в шард с меньшим номером,
+    // где тоже кто-то ждет. Переходы идут только к меньшим номерам, поэтому два
+    // одиноких игрока не могут поменяться шардами и снова остаться без пары
+    void offerLonelyPlayer(std::chrono::steady_clock::time_point now) {
+        MatchTicket* ticket = waitingPlayers.front();
+        if (index == 0 || !ticket || waitingPlayers.size() % 2 == 0 ||
+            now - ticket->queuedAt < std::chrono::milliseconds(MATCH_STEAL_AFTER_MS)) {
+            return;
+        }
+
+        for (int i = 0; i < index; i++) {
+            if (shards[i]->queuedPlayerCount() > 0) {
+                migratePlayer(static_cast<Player*>(ticket->owner), shards[i].get());
+                return;
+            }
+        }
+    }
+
+    // Сокет и состояние игрока передаются другому шарду через его очередь задач;
+    // здесь объект игрока удаляется, не закрывая соединения
+    void migratePlayer(Player* player, ServerShard* target) {
+        waitingPlayers.remove(&player->ticket);
+        timers.cancel(&player->timer);
+        poller.remove(player->socket);
+
+        MigratingPlayer migrant;
+        migrant.socket = player->socket;
+        migrant.clientAddr = player->clientAddr;
+        migrant.playerId = player->playerId;
+        migrant.name = player->name;
+        migrant.rated = player->rated;
+        migrant.rating = player->ticket.rating;
+        migrant.binaryProtocol = player->binaryProtocol;
+        migrant.connectedAt = player->connectedAt;
+        migrant.queuedAt = player->ticket.queuedAt;
+        for (size_t i = 0; i < player->inBuffer.size(); i++) {
+            migrant.input += player->inBuffer.at(i);
+        }
+        migrant.output = player->outBuffer.toString();
+        migrant.spectator = player->wantsToWatch;
+        migrant.watchGameId = player->watchGameId;
+        migrant.resuming = player->wantsToResume;
+        migrant.resumeToken = player->resumeToken;
+
+        player->socket = INVALID_SOCKET;
+        player->connected = false;
+        players.erase(player->handle);
+        migratedOut++;
+
+        target->post([target, migrant]() { target->adoptPlayer(migrant); });
+    }
+
+    void adoptPlayer(const MigratingPlayer& migrant) {
+        SlotHandle handle = players.emplace(migrant.socket, migrant.clientAddr, migrant.playerId, &poller);
+        Player* player = players.get(handle);
+        player->handle = handle;
+        player->flushQueue = &flushQueue;
+        player->name = migrant.name;
+        player->rated = migrant.rated;
+        player->ticket.rating = migrant.rating;
+        player->binaryProtocol = migrant.binaryProtocol;
+        player->negotiated = true;
+        player->connectedAt = migrant.connectedAt;
+        player->outBuffer.append(migrant.output);
+
+        size_t copied = 0;
+        while (copied < migrant.input.size()) {
+            size_t space;
+            char* span = player->inBuffer.writeSpan(space);
+            size_t length = std::min(space, migrant.input.size() - copied);
+            std::memcpy(span, migrant.input.data() + copied, length);
+            player->inBuffer.commit(length);
+            copied += length;
+        }
+
+        // Готовность сокета, наступившая до регистрации, epoll сообщит сразу после add
+        if (!poller.add(player->socket, player)) {
+            std::cerr << "Failed to register migrated player socket: " << WSAGetLastError() << "\n";
+            player->poller = nullptr;
+            players.erase(handle);
+            return;
+        }
+        if (!player->outBuffer.empty()) {
+            player->flushScheduled = true;
+            flushQueue.push_back(handle);
+        }
+        migratedIn++;
+
+        if (migrant.resuming) {
+            player->wantsToResume = true;
+            player->resumeToken = migrant.resumeToken;
+            resumeSession(player);
+            return;
+        }
+        if (migrant.spectator) {
+            player->wantsToWatch = true;
+            player->watchGameId = migrant.watchGameId;
+            watchGame(player);
+            return;
+        }
+
+        // Время в очереди сохраняется: окно рейтинга и таймаут ожидания продолжают отсчет
+        auto now = std::chrono::steady_clock::now();
+        player->ticket.queuedAt = migrant.queuedAt;
+        MatchTicket* opponent = waitingPlayers.findOpponent(&player->ticket, RatingQueue::windowFor(player->ticket, now));
+        if (opponent) {
+            waitingPlayers.remove(opponent);
+            startGame(static_cast<Player*>(opponent->owner), player);
+            return;
+        }
+
+        long long waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - migrant.queuedAt).count();
+        waitingPlayers.push(&player->ticket, migrant.queuedAt);
+        timers.schedule(&player->timer, static_cast<int>(std::max(1LL, config.queueTimeoutMs - waited)), TIMER_QUEUE_IDLE);
+    }
+
+    // Игра с компьютером начинается сразу, без очереди и без изменения рейтинга
+    void startComputerGame(Player* player) {
+        sockaddr_in noAddr{};
+        SlotHandle handle = players.emplace(INVALID_SOCKET, noAddr, 0);
+        Player* computer = players.get(handle);
+        computer->handle = handle;
+        computer->computer = true;
+        computer->name = "Computer";
+        startGame(player, computer);
+    }
+
+    void startGame(Player* player1, Player* player2) {
+        Trace::Span span("start game");
+        SlotHandle handle = games.emplace(player1, player2, &retiredGames);
+        Game* newGame = games.get(handle);
+        newGame->handle = handle;
+        newGame->id = nextGameId++;
+        directory.add(newGame->id, index, handle, player1->ticket.rating + player2->ticket.rating);
+        player1->game = newGame;
+        player2->game = newGame;
+        timers.cancel(&player1->timer);
+        timers.cancel(&player2->timer);
+        timers.schedule(&newGame->timer, config.setupTimeoutMs, TIMER_SETUP);
+
+        auto now = std::chrono::steady_clock::now();
+        Metrics::add(Metrics::GAMES_STARTED);
+        for (Player* player : { player1, player2 }) {
+            if (!player->computer) {
+                Metrics::record(Metrics::MATCH_WAIT, static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - player->connectedAt).count()));
+            }
+        }
+
+        std::cout << "Started new game " << newGame->id << " between Player " << player1->playerId
+            << " and Player " << player2->playerId << std::endl;
+
+        // Фаза расстановки кораблей
+        newGame->phase = PHASE_SETUP;
+        setupPlayer(*player1);
+        setupPlayer(*player2);
+
+        if (!player1->connected || !player2->connected) {
+            newGame->endGame("Player disconnected during setup");
+            return;
+        }
+
+        // Ждем, пока оба игрока будут готовы
+        newGame->phase = PHASE_WAITING_READY;
+        if (!newGame->bothReady()) {
+            return;
+        }
+
+        for (Player* player : { player1, player2 }) {
+            if (!player->computer) {
+                issueResumeToken(newGame, player);
+                sendResumeToken(player);
+            }
+        }
+
+        const std::string startMsg = "Game started! Player 1 goes first.\n";
+        if (!sendInfo(player1, startMsg) || !sendInfo(player2, startMsg)) {
+            newGame->endGame("Failed to send start message");
+            return;
+        }
+
+        newGame->gameStarted = true;
+        newGame->phase = PHASE_TURN;
+        Metrics::record(Metrics::GAME_SETUP, Metrics::nanosecondsSince(newGame->startedClock));
+        beginTurn(newGame);
+        advanceGame(newGame);
+    }
+
+    bool setupPlayer(Player& player) {
+        const std::string welcome = "Welcome to Sea Battle! Placing ships automatically...\n";
+        if (!sendInfo(&player, welcome)) {
+            player.disconnect();
             return false;
         }
 
-        serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        if (serverSocket == INVALID_SOCKET) {
-            std::cerr << "Error creating socket: " << WSAGetLastError() << "\n";
-            WSACleanup();
+        player.autoPlaceShips();
+
+        if (!sendOwnBoard(&player, "Your ships have been placed automatically:\n")) {
+            player.disconnect();
             return false;
         }
 
-        int yes = 1;
-        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes)) == SOCKET_ERROR) {
-            std::cerr << "Setsockopt failed: " << WSAGetLastError() << "\n";
-            safeCloseSocket(serverSocket);
-            WSACleanup();
+        player.ready = true;
+        const std::string readyMsg = "All ships placed! Waiting for other player...\n";
+        if (!sendInfo(&player, readyMsg)) {
+            player.disconnect();
             return false;
         }
+        return true;
+    }
 
-        sockaddr_in serverAddr{};
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_addr.s_addr = INADDR_ANY;
-        serverAddr.sin_port = htons(port);
+    // Рассылает обоим игрокам состояние перед очередным ходом и заново
+    // отсчитывает срок хода
+    void beginTurn(Game* game) {
+        if (promptTurn(game)) {
+            timers.schedule(&game->timer, config.turnTimeoutMs, TIMER_TURN);
+        }
+    }
 
-        if (bind(serverSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-            std::cerr << "Bind failed on port " << port << ": " << WSAGetLastError() << "\n";
-            safeCloseSocket(serverSocket);
-            WSACleanup();
+    // Повторяет приглашение к ходу после неверного или повторного выстрела.
+    // Ход не начинается заново, поэтому срок хода продолжает идти: иначе
+    // клиент удерживал бы ход сколько угодно, присылая неверные ходы
+    bool promptTurn(Game* game) {
+        if (!sendTurn(game->currentPlayer, true) || !sendTurn(game->getOpponent(), false)) {
+            game->endGame("Failed to send turn message");
             return false;
         }
+        return true;
+    }
+
+    // Обрабатывает все уже полученные ходы текущего игрока; клиент может
+    // прислать несколько ходов одним сегментом, лишние ждут своей очереди в буфере.
+    // Компьютерный соперник ходит здесь же, не дожидаясь событий сокета.
+    void advanceGame(Game* game) {
+        uint8_t opcode;
+        size_t length;
+        bool malformed;
+        while (game->phase == PHASE_TURN && game->active && !game->gameOver && game->checkConnections()) {
+            Player* current = game->currentPlayer;
+            RingBuffer& buffer = current->inBuffer;
+            if (current->outBuffer.size() > OUTPUT_HIGH_WATER_BYTES) {
+                // Ответы на прошлые ходы еще не прочитаны: остальные ходы ждут в буфере
+                current->readPaused = true;
+                break;
+            }
+            if (current->computer) {
+                int cell;
+                {
+                    Trace::Span span("computer move");
+                    cell = ShotPlanner::chooseShot(current->enemyView, FastRandom::local());
+                }
+                handleShot(game, cell % BOARD_SIZE, cell / BOARD_SIZE);
+            }
+            else if (current->binaryProtocol) {
+                if (!Protocol::peekFrame(buffer, opcode, length, malformed)) {
+                    if (malformed) {
+                        onPlayerDisconnected(current, Metrics::DISCONNECT_PROTOCOL_ERROR);
+                    }
+                    break;
+                }
+
+                int cell = length == 1 ? static_cast<uint8_t>(buffer.at(Protocol::FRAME_HEADER_SIZE)) : -1;
+                buffer.consume(Protocol::FRAME_HEADER_SIZE + length);
+
+                if (opcode == Protocol::OP_SHOT && cell >= 0) {
+                    handleShot(game, cell % BOARD_SIZE, cell / BOARD_SIZE);
+                }
+                else if (opcode == Protocol::OP_SYNC) {
+                    if (!sendBoardSnapshot(current) || !sendTurn(current, true)) {
+                        game->endGame("Failed to send board snapshot");
+                    }
+                }
+            }
+            else {
+                length = peekLine(buffer);
+                if (length == RingBuffer::npos) break;
+
+                int x, y;
+                bool valid = parseMove(buffer, length, x, y);
+                buffer.consume(length + 1);
+
+                if (valid) {
+                    handleShot(game, x, y);
+                }
+                else {
+                    const std::string errorMsg = "Invalid input format. Use: x y (numbers 0-9)\n";
+                    sendError(current, errorMsg);
+                    promptTurn(game);
+                }
+            }
+        }
 
-        if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR) {
-            std::cerr << "Listen failed: " << WSAGetLastError() << "\n";
-            safeCloseSocket(serverSocket);
-            WSACleanup();
-            return false;
+        if (game->gameOver && game->active) {
+            finishGame(game);
         }
-
-        std::cout << "Server initialized on port " << port << "\n";
-        return true;
     }
 
-    void start() {
-        running = true;
-        std::cout << "Server started. Waiting for players...\n";
-
-        // Поток для приема новых подключений
-        std::thread acceptorThread(&GameServer::acceptConnections, this);
+    void handleShot(Game* game, int x, int y) {
+        Player* current = game->currentPlayer;
+        Player* opponent = game->getOpponent();
 
-        // Поток для управления играми
-        std::thread matchmakerThread(&GameServer::matchmakingLoop, this);
+        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+            const std::string errorMsg = "Invalid coordinates. Use values between 0 and 9.\n";
+            sendError(current, errorMsg);
+            promptTurn(game);
+            return;
+        }
 
-        // Поток для очистки завершенных игр
-        std::thread cleanupThread(&GameServer::cleanupLoop, this);
+        // Время обработки хода: выстрел, журнал и рассылка результата и следующего хода
+        Trace::Span span("handle shot");
+        auto started = std::chrono::steady_clock::now();
+        ShotResult result;
+        {
+            Trace::Span processSpan("processShot");
+            result = game->fireShot(x, y);
+            game->recordShot(x, y, result);
+        }
+        Metrics::add(Metrics::SHOTS);
 
-        // Основной поток для управления сервером
-        serverManagementLoop();
+        if (!sendShotResult(current, current, x, y, result) || !sendShotResult(opponent, current, x, y, result)) {
+            game->endGame("Failed to send result message");
+            return;
+        }
+        if (!game->spectators.empty()) {
+            broadcastToSpectators(game, spectatorFrame(game, current->name + " shot at (" + std::to_string(x) + "," +
+                std::to_string(y) + ") - " + shotResultText(result)));
+        }
 
-        acceptorThread.join();
-        matchmakerThread.join();
-        cleanupThread.join();
+        if (!game->gameOver) {
+            if (restartsTurnDeadline(result)) {
+                if (passesTurn(result)) {
+                    game->switchTurn();
+                }
+                beginTurn(game);
+            }
+            else {
+                promptTurn(game);
+            }
+        }
+        Metrics::record(Metrics::TURN_PROCESSING, Metrics::nanosecondsSince(started));
     }
 
-    void stop() {
-        running = false;
+    void finishGame(Game* game) {
+        if (game->bothReady()) {
+            std::string winMsg = "Congratulations! You won the game!\n";
+            std::string loseMsg = "Game over! You lost.\n";
+            updateRatings(game->currentPlayer, game->getOpponent(), winMsg, loseMsg);
+            game->setResult(Journal::ENDING_SUNK, game->currentPlayer);
 
-        // Закрыть все активные игры
-        {
-            std::lock_guard<std::mutex> lock(gamesMutex);
-            for (auto game : activeGames) {
-                game->endGame("Server shutdown");
-                delete game;
-            }
-            activeGames.clear();
-        }
+            sendGameOver(game->currentPlayer, OUTCOME_WIN, winMsg);
+            sendGameOver(game->getOpponent(), OUTCOME_LOSE, loseMsg);
 
-        // Очистить очередь ожидания
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            while (!waitingPlayers.empty()) {
-                Player* player = waitingPlayers.front();
-                waitingPlayers.pop();
-                safeSend(player->socket, "Server is shutting down. Goodbye!\n");
-                delete player;
-            }
+            std::cout << "Game finished. Winner: Player " << game->currentPlayer->playerId << std::endl;
         }
+        else {
+            std::string disconnectMsg = "Game ended due to player disconnect.\n";
+            if (game->player1->connected) sendGameOver(game->player1, OUTCOME_ABORTED, disconnectMsg);
+            if (game->player2->connected) sendGameOver(game->player2, OUTCOME_ABORTED, disconnectMsg);
 
-        safeCloseSocket(serverSocket);
-        WSACleanup();
+            std::cout << "Game terminated due to player disconnect" << std::endl;
+        }
 
-        std::cout << "Server stopped.\n";
+        game->retire();
+        finishedGameCount++;
     }
 
-private:
-    void acceptConnections() {
-        fd_set readSet;
-        timeval timeout;
+    // Рейтинг меняется, только если оба игрока представились
+    void updateRatings(Player* winner, Player* loser, std::string& winMsg, std::string& loseMsg) {
+        if (!winner->rated || !loser->rated) return;
 
-        while (running) {
-            FD_ZERO(&readSet);
-            FD_SET(serverSocket, &readSet);
+        int delta = eloDelta(winner->ticket.rating, loser->ticket.rating);
+        winner->ticket.rating += delta;
+        loser->ticket.rating = std::max(0, loser->ticket.rating - delta);
+        ratings.store(winner->name, winner->ticket.rating);
+        ratings.store(loser->name, loser->ticket.rating);
 
-            timeout.tv_sec = 1;
-            timeout.tv_usec = 0;
+        winMsg += "Your rating: " + std::to_string(winner->ticket.rating) + " (+" + std::to_string(delta) + ")\n";
+        loseMsg += "Your rating: " + std::to_string(loser->ticket.rating) + " (-" + std::to_string(delta) + ")\n";
+    }
 
-            int selectResult = select(0, &readSet, nullptr, nullptr, &timeout);
+    // Игрок не сделал ход за отведенное время: в зависимости от настроек
+    // за него стреляют в случайную неоткрытую клетку или ему засчитывается поражение
+    void onTurnTimeout(Game* game) {
+        if (!game->active || game->phase != PHASE_TURN) return;
 
-            if (selectResult > 0 && FD_ISSET(serverSocket, &readSet)) {
-                sockaddr_in clientAddr;
-                int clientAddrSize = sizeof(clientAddr);
-                SOCKET clientSocket = accept(serverSocket, (SOCKADDR*)&clientAddr, &clientAddrSize);
+        Player* current = game->currentPlayer;
+        if (config.turnTimeoutAction == TURN_TIMEOUT_FORFEIT) {
+            forfeitGame(game, current);
+            return;
+        }
 
-                if (clientSocket != INVALID_SOCKET) {
-                    // Устанавливаем таймаут на чтение
-                    DWORD timeoutMs = 30000;
-                    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO,
-                        (char*)&timeoutMs, sizeof(timeoutMs));
+        Bitboard unexplored = current->enemyView.empty();
+        int cell = unexplored.select(static_cast<int>(FastRandom::local().below(unexplored.count())));
+        if (!sendInfo(current, "Time is up! A random shot is fired for you.\n")) {
+            game->endGame("Failed to send timeout message");
+            return;
+        }
 
-                    char clientIP[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
+        handleShot(game, cell % BOARD_SIZE, cell / BOARD_SIZE);
+        advanceGame(game);
+    }
 
-                    std::cout << "New connection from " << clientIP << ":"
-                        << ntohs(clientAddr.sin_port) << std::endl;
+    void forfeitGame(Game* game, Player* loser) {
+        Metrics::add(Metrics::DISCONNECT_TURN_TIMEOUT);
+        Player* winner = loser == game->player1 ? game->player2 : game->player1;
+        std::string winMsg = "Your opponent ran out of time. You won the game!\n";
+        std::string loseMsg = "Time is up! You lost the game.\n";
+        updateRatings(winner, loser, winMsg, loseMsg);
+        game->setResult(Journal::ENDING_FORFEIT, winner);
 
-                    Player* newPlayer = new Player(clientSocket, clientAddr, nextPlayerId++);
+        sendGameOver(winner, OUTCOME_WIN, winMsg);
+        sendGameOver(loser, OUTCOME_LOSE, loseMsg);
+        std::cout << "Player " << loser->playerId << " ran out of time. Winner: Player " << winner->playerId << std::endl;
 
-                    // Отправляем приветственное сообщение
-                    std::string welcomeMsg = "Welcome to Sea Battle Server!\n";
-                    welcomeMsg += "You are Player " + std::to_string(newPlayer->playerId) + "\n";
-                    welcomeMsg += "Waiting for opponent...\n";
-                    safeSend(clientSocket, welcomeMsg);
+        game->retire();
+        finishedGameCount++;
+    }
 
-                    // Добавляем игрока в очередь ожидания
-                    {
-                        std::lock_guard<std::mutex> lock(queueMutex);
-                        waitingPlayers.push(newPlayer);
-                    }
-                }
-            }
-            else if (selectResult == SOCKET_ERROR) {
-                if (running) {
-                    std::cerr << "Select error in accept thread: " << WSAGetLastError() << std::endl;
-                }
-                break;
-            }
+    // Освобождает игры, завершившиеся за эту итерацию: без обхода всех активных игр.
+    // Перед освобождением партия попадает в журнал.
+    void reclaimFinishedGames() {
+        if (retiredGames.empty()) return;
+
+        Trace::Span span("reclaim games");
+        for (auto game : retiredGames) {
+            journal.append(*game);
+            directory.remove(game->id);
+            releaseSpectators(game);
+            releasePlayer(game->player1);
+            releasePlayer(game->player2);
+            games.erase(game->handle);
         }
+        retiredGames.clear();
     }
 
-    void matchmakingLoop() {
-        while (running) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-            // Проверяем, есть ли как минимум 2 игрока в очереди
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (waitingPlayers.size() >= 2) {
-                Player* player1 = waitingPlayers.front();
-                waitingPlayers.pop();
-                Player* player2 = waitingPlayers.front();
-                waitingPlayers.pop();
-
-                // Проверяем, что оба игрока еще подключены
-                if (player1->connected && player2->connected) {
-                    // Создаем новую игру в отдельном потоке
-                    Game* newGame = new Game(player1, player2);
-                    {
-                        std::lock_guard<std::mutex> lock(gamesMutex);
-                        activeGames.push_back(newGame);
-                    }
+    // Игрок завершенной игры удаляется после отправки последних сообщений
+    void releasePlayer(Player* player) {
+        player->game = nullptr;
+        if (player->connected && !player->outBuffer.empty()) {
+            player->closing = true;
+            player->closeDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CLOSE_LINGER_MS);
+            closingPlayers.push_back(player);
+        }
+        else {
+            players.erase(player->handle);
+        }
+    }
 
-                    std::thread gameThread(&GameServer::runGame, this, newGame);
-                    gameThread.detach();
+    // Одна отправка за итерацию на каждого игрока, которому что-то написали.
+    // Отключение при ошибке может породить новые сообщения сопернику - они
+    // попадут в следующую итерацию
+    void flushPendingOutput() {
+        if (flushQueue.empty()) return;
 
-                    std::cout << "Started new game between Player " << player1->playerId
-                        << " and Player " << player2->playerId << std::endl;
-                }
-                else {
-                    // Если кто-то отключился, удаляем обоих
-                    if (player1->connected) {
-                        safeSend(player1->socket, "Opponent disconnected during matchmaking\n");
-                        delete player1;
-                    }
-                    if (player2->connected) {
-                        safeSend(player2->socket, "Opponent disconnected during matchmaking\n");
-                        delete player2;
-                    }
-                }
-            }
+        flushing.swap(flushQueue);
+        for (SlotHandle handle : flushing) {
+            flushScheduledPlayer(handle);
         }
+        flushing.clear();
     }
 
-    void runGame(Game* game) {
-        auto setupPhase = [](Player& player) -> bool {
-            const std::string welcome = "Welcome to Sea Battle! Placing ships automatically...\n";
-            if (!safeSend(player.socket, welcome)) {
-                player.connected = false;
-                return false;
-            }
+    // Зрители получают данные после игроков и не больше SPECTATOR_FLUSHES_PER_TICK
+    // соединений за итерацию: сколько бы их ни было, ходы игроков не ждут рассылки.
+    // Остальные зрители обслуживаются в следующих итерациях по порядку очереди
+    void flushSpectatorOutput() {
+        if (spectatorFlushHead == spectatorFlushQueue.size()) return;
 
-            player.autoPlaceShips();
+        size_t end = std::min(spectatorFlushQueue.size(), spectatorFlushHead + SPECTATOR_FLUSHES_PER_TICK);
+        while (spectatorFlushHead < end) {
+            flushScheduledPlayer(spectatorFlushQueue[spectatorFlushHead++]);
+        }
 
-            std::string boardMsg = "Your ships have been placed automatically:\n";
-            boardMsg += player.getBoardString() + "\n";
-            if (!safeSend(player.socket, boardMsg)) {
-                player.connected = false;
-                return false;
-            }
+        if (spectatorFlushHead == spectatorFlushQueue.size()) {
+            spectatorFlushQueue.clear();
+            spectatorFlushHead = 0;
+        }
+        else if (spectatorFlushHead > spectatorFlushQueue.size() / 2) {
+            spectatorFlushQueue.erase(spectatorFlushQueue.begin(), spectatorFlushQueue.begin() + spectatorFlushHead);
+            spectatorFlushHead = 0;
+        }
+    }
 
-            player.ready = true;
-            const std::string readyMsg = "All ships placed! Waiting for other player...\n";
-            if (!safeSend(player.socket, readyMsg)) {
-                player.connected = false;
-                return false;
-            }
-            return true;
-            };
+    void flushScheduledPlayer(SlotHandle handle) {
+        Player* player = players.get(handle);
+        if (!player) return;
 
-        // Фаза расстановки кораблей
-        std::thread setupThread1(setupPhase, std::ref(*game->player1));
-        std::thread setupThread2(setupPhase, std::ref(*game->player2));
+        player->flushScheduled = false;
+        if (!player->connected) return;
+        if (!flushOutput(player)) {
+            onPlayerDisconnected(player, Metrics::DISCONNECT_SEND_FAILED);
+        }
+        else if (player->readPaused && player->outBuffer.size() <= OUTPUT_HIGH_WATER_BYTES) {
+            resumeReading(player);
+        }
+    }
 
-        setupThread1.join();
-        setupThread2.join();
+    // Зритель подписывается на партию в том шарде, где она идет; если партия
+    // в другом шарде, соединение переходит туда
+    void watchGame(Player* player) {
+        uint64_t id = player->watchGameId;
+        GameDirectory::Entry entry;
+        if (!directory.find(id, entry)) {
+            sendGameOver(player, OUTCOME_ABORTED, "GAME_OVER: No such game\n");
+            releasePlayer(player);
+            return;
+        }
 
-        if (!game->player1->connected || !game->player2->connected) {
-            game->endGame("Player disconnected during setup");
+        player->watchGameId = id;
+        if (entry.shard != index) {
+            migratePlayer(player, shards[entry.shard].get());
             return;
         }
 
-        // Ждем, пока оба игрока будут готовы
-        while (!game->bothReady() && game->active && running) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            if (!game->checkConnections()) {
-                game->endGame("Player disconnected while waiting for readiness");
-                return;
-            }
+        Game* game = games.get(entry.handle);
+        if (!game || game->id != id || !game->active) {
+            sendGameOver(player, OUTCOME_ABORTED, "GAME_OVER: No such game\n");
+            releasePlayer(player);
+            return;
         }
 
-        if (game->bothReady() && game->active && running) {
-            const std::string startMsg = "Game started! Player 1 goes first.\n";
-            if (!safeSend(game->player1->socket, startMsg) || !safeSend(game->player2->socket, startMsg)) {
-                game->endGame("Failed to send start message");
-                return;
-            }
+        player->wantsToWatch = false;
+        player->spectator = true;
+        player->flushQueue = &spectatorFlushQueue;
+        game->spectators.push_back(player->handle);
+        spectatorCount++;
+        std::cout << "Player " << player->playerId << " is watching game " << id << "\n";
+
+        sendShared(player, spectatorFrame(game, "Watching game " + std::to_string(id) + ": " +
+            game->player1->name + " vs " + game->player2->name + "\n"));
+    }
 
-            game->gameStarted = true;
+    // Оба поля глазами игроков: то, что каждый из них знает о поле соперника.
+    // Кадр собирается один раз на событие и рассылается всем зрителям
+    std::shared_ptr<std::string> renderSpectatorFrame(Game* game, const std::string& headline) {
+        std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+        frame->reserve(headline.size() + 2 * (BoardText::LENGTH + 2 * MAX_PLAYER_NAME + 32));
+        *frame += headline;
+        for (Player* player : { game->player1, game->player2 }) {
+            Player* opponent = player == game->player1 ? game->player2 : game->player1;
+            const BoardText& view = player->renderEnemyView();
+            *frame += player->name + "'s shots at " + opponent->name + ":\n";
+            frame->append(view.data(), view.size());
+            *frame += '\n';
         }
-        else {
-            return;
+        return frame;
+    }
+
+    SharedMessage spectatorFrame(Game* game, const std::string& headline) {
+        return renderSpectatorFrame(game, headline);
+    }
+
+    // В очереди зрителей попадает ссылка на одно и то же сообщение. Зритель,
+    // набравший больше OUTPUT_LIMIT_BYTES непрочитанного, отключается
+    void broadcastToSpectators(Game* game, const SharedMessage& message) {
+        size_t kept = 0;
+        for (size_t i = 0; i < game->spectators.size(); i++) {
+            Player* spectator = players.get(game->spectators[i]);
+            if (!spectator || !spectator->spectator) continue;
+            if (!sendShared(spectator, message)) {
+                dropSpectator(spectator);
+                continue;
+            }
+            game->spectators[kept++] = game->spectators[i];
         }
+        game->spectators.resize(kept);
+    }
 
-        // Основной игровой цикл
-        std::string inputBuffer;
-        while (!game->gameOver && game->active && running && game->checkConnections()) {
-            Player* current = game->currentPlayer;
-            Player* opponent = game->getOpponent();
+    // Итог и последние поля партии, после которых зрители отключаются
+    void releaseSpectators(Game* game) {
+        if (game->spectators.empty()) return;
 
-            std::string currentTurnMsg = "YOUR_TURN\n";
-            currentTurnMsg += "Your board:\n" + current->getBoardString() + "\n";
-            currentTurnMsg += "Enemy view:\n" + current->getEnemyViewString() + "\n";
-            currentTurnMsg += "Enter coordinates to shoot (x y): ";
+        std::shared_ptr<std::string> ending = renderSpectatorFrame(game, "Final position:\n");
+        if (game->ending == Journal::ENDING_ABORTED || game->winner >= 2) {
+            *ending += "GAME_OVER: Game aborted\n";
+        }
+        else {
+            *ending += "GAME_OVER: " + (game->winner == 0 ? game->player1 : game->player2)->name +
+                (game->ending == Journal::ENDING_SUNK ? " won the game\n" : " won on time\n");
+        }
+        SharedMessage message = ending;
+        broadcastToSpectators(game, message);
+
+        for (SlotHandle handle : game->spectators) {
+            Player* spectator = players.get(handle);
+            spectator->spectator = false;
+            spectatorCount--;
+            releasePlayer(spectator);
+        }
+        game->spectators.clear();
+    }
 
-            std::string otherTurnMsg = "OPPONENT_TURN\n";
-            otherTurnMsg += "Your board:\n" + opponent->getBoardString() + "\n";
-            otherTurnMsg += "Enemy view:\n" + opponent->getEnemyViewString() + "\n";
-            otherTurnMsg += "Waiting for opponent's move...\n";
+    // Отключившийся зритель удаляется после обработки событий
+    void dropSpectator(Player* spectator) {
+        spectator->spectator = false;
+        spectatorCount--;
+        closingPlayers.push_back(spectator);
+    }
 
-            if (!safeSend(current->socket, currentTurnMsg) || !safeSend(opponent->socket, otherTurnMsg)) {
-                game->endGame("Failed to send turn message");
-                break;
+    void cleanupClosingPlayers() {
+        auto now = std::chrono::steady_clock::now();
+        size_t i = 0;
+        while (i < closingPlayers.size()) {
+            Player* player = closingPlayers[i];
+            if (!player->connected || player->outBuffer.empty() || now > player->closeDeadline) {
+                players.erase(player->handle);
+                closingPlayers[i] = closingPlayers.back();
+                closingPlayers.pop_back();
             }
-
-            if (!safeRecv(current->socket, inputBuffer)) {
-                std::cout << "Player " << current->playerId << " disconnected during game\n";
-                current->connected = false;
-                game->endGame("Player disconnected");
-                break;
+            else {
+                i++;
             }
+        }
+    }
+};
 
-            int x, y;
-            char extra;
-            if (sscanf_s(inputBuffer.c_str(), "%d %d %c", &x, &y, &extra, 1) == 2) {
-                if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
-                    const std::string errorMsg = "Invalid coordinates. Use values between 0 and 9.\n";
-                    safeSend(current->socket, errorMsg);
-                    continue;
-                }
+// Класс для управления сервером: запускает шарды, по одному потоку цикла
+// событий на каждый, и обслуживает команды администратора и метрики
+class GameServer {
+private:
+    int port;
+    std::atomic<bool> running;
+    ServerConfig config;
+    std::vector<std::unique_ptr<ServerShard>> shards;
+    RatingBook ratings;
+    GameDirectory directory;
+    std::atomic<int> nextPlayerId;
+    std::atomic<uint64_t> nextGameId;
+    MetricsEndpoint metricsEndpoint;
+    bool socketsStarted;
+
+    // Периодическая контрольная точка идущих партий (см. Checkpoint).
+    // gamesSaved - при остановке партии сохранены и не завершаются
+    std::thread checkpointThread;
+    std::mutex checkpointMutex;
+    std::condition_variable checkpointWakeup;
+    bool checkpointStopping;
+    std::mutex checkpointWriteMutex;
+    bool gamesSaved;
+    std::atomic<uint32_t> checkpointGames;
+    std::atomic<uint64_t> checkpointsWritten;
+
+public:
+    GameServer(int serverPort, const ServerConfig& serverConfig = ServerConfig())
+        : port(serverPort), running(false), config(serverConfig), nextPlayerId(1), nextGameId(1), socketsStarted(false),
+        checkpointStopping(false), gamesSaved(false), checkpointGames(0), checkpointsWritten(0) {
+    }
 
-                std::string result = game->processShot(x, y);
+    ~GameServer() {
+        stop();
+    }
 
-                std::string resultMsg = current->name + " shot at (" + std::to_string(x) + "," + std::to_string(y) + ") - " + result;
+    bool initialize() {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+            std::cerr << "WSAStartup failed\n";
+            return false;
+        }
+        socketsStarted = true;
+
+        for (int i = 0; i < config.shards; i++) {
+            shards.emplace_back(new ServerShard(i, port, config, shards, ratings, directory, nextPlayerId, nextGameId));
+#ifdef SO_REUSEPORT
+            SOCKET sharedListener = INVALID_SOCKET;
+#else
+            SOCKET sharedListener = i == 0 ? INVALID_SOCKET : shards[0]->listener();
+#endif
+            if (!shards.back()->initialize(sharedListener)) {
+                stop();
+                return false;
+            }
+        }
 
-                if (!safeSend(current->socket, resultMsg) || !safeSend(opponent->socket, resultMsg)) {
-                    game->endGame("Failed to send result message");
-                    break;
-                }
+        restoreCheckpoint();
 
-                if (!game->gameOver && result.find("HIT") == std::string::npos && result.find("Already attacked") == std::string::npos) {
-                    game->switchTurn();
-                }
+        if (config.metricsPort > 0) {
+            if (metricsEndpoint.start(config.metricsPort, [this]() { return renderMetrics(); })) {
+                std::cout << "Metrics available at http://127.0.0.1:" << config.metricsPort << "/metrics\n";
             }
             else {
-                const std::string errorMsg = "Invalid input format. Use: x y (numbers 0-9)\n";
-                safeSend(current->socket, errorMsg);
+                std::cerr << "Failed to open metrics port " << config.metricsPort << ": " << WSAGetLastError() << "\n";
             }
         }
 
-        if (game->gameOver && game->active) {
-            if (game->bothReady()) {
-                std::string winMsg = "Congratulations! You won the game!\n";
-                std::string loseMsg = "Game over! You lost.\n";
+        std::cout << "Server initialized on port " << port << " with " << shards.size() << " shard(s)\n";
+        return true;
+    }
 
-                safeSend(game->currentPlayer->socket, winMsg);
-                safeSend(game->getOpponent()->socket, loseMsg);
+    void start() {
+        running = true;
+        std::cout << "Server started. Waiting for players...\n";
 
-                std::cout << "Game finished. Winner: Player " << game->currentPlayer->playerId << std::endl;
-            }
-            else {
-                std::string disconnectMsg = "Game ended due to player disconnect.\n";
-                if (game->player1->connected) safeSend(game->player1->socket, disconnectMsg);
-                if (game->player2->connected) safeSend(game->player2->socket, disconnectMsg);
+        // Потоки шардов: подключения, матчмейкинг, игры и очистка
+        std::vector<std::thread> shardThreads;
+        for (auto& shard : shards) {
+            shardThreads.emplace_back(&ServerShard::run, shard.get());
+        }
 
-                std::cout << "Game terminated due to player disconnect" << std::endl;
-            }
+        if (!config.checkpointFile.empty()) {
+            checkpointStopping = false;
+            checkpointThread = std::thread(&GameServer::checkpointLoop, this);
         }
 
-        // Удаляем игроков
-        delete game->player1;
-        delete game->player2;
+        // Основной поток для управления сервером
+        serverManagementLoop();
+
+        stopCheckpoints();
+        for (auto& thread : shardThreads) {
+            thread.join();
+        }
 
-        // Помечаем игру для удаления
-        game->active = false;
+        // Последняя точка снимается с остановленных шардов, поэтому в нее
+        // попадают все ходы; после нее партии уже не завершаются
+        if (!config.checkpointFile.empty() && saveCheckpoint(false)) {
+            gamesSaved = true;
+            std::cout << "Checkpoint: " << checkpointGames << " games saved to " << config.checkpointFile << "\n";
+        }
     }
 
-    void cleanupLoop() {
-        while (running) {
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+    void stop() {
+        running = false;
+        metricsEndpoint.stop();
+        stopCheckpoints();
 
-            std::lock_guard<std::mutex> lock(gamesMutex);
-            auto it = activeGames.begin();
-            while (it != activeGames.end()) {
-                if (!(*it)->active) {
-                    delete* it;
-                    it = activeGames.erase(it);
-                }
-                else {
-                    ++it;
-                }
+        // Первый шард закрывается последним: без SO_REUSEPORT остальные делят его сокет
+        for (size_t i = shards.size(); i-- > 0;) {
+            shards[i]->shutdown(gamesSaved);
+        }
+        bool started = !shards.empty();
+        shards.clear();
+
+        if (socketsStarted) {
+            socketsStarted = false;
+            WSACleanup();
+            if (started) {
+                std::cout << "Server stopped.\n";
             }
         }
     }
 
+private:
     void serverManagementLoop() {
+        Trace::nameThread("console");
         std::cout << "\nServer commands:\n";
         std::cout << "  /stats - Show server statistics\n";
-        std::cout << "  /stop - Stop the server\n";
+        std::cout << "  /analyze [verify] - Analyze the game journal\n";
+        std::cout << "  /tournament [GAMES] [RULES] - Play a bot tournament on all cores\n";
+        std::cout << "  /trace [FILE] - Dump trace spans as Chrome trace JSON\n";
+        std::cout << "  /checkpoint - Save live games now\n";
+        std::cout << "  /stop - Stop the server, saving live games\n";
         std::cout << "  /help - Show this help\n\n";
 
         while (running) {
@@ -875,14 +7652,69 @@ private:
             if (command == "/stats") {
                 showStats();
             }
+            else if (command == "/analyze" || command == "/analyze verify") {
+                // Сегменты только читаются, поэтому анализ идет параллельно с игрой;
+                // партии последней секунды могут еще не попасть на диск
+                if (config.journalDirectory.empty()) {
+                    std::cout << "Journal is off\n";
+                }
+                else {
+                    JournalAnalyzer::run(config.journalDirectory, command == "/analyze verify");
+                }
+            }
+            else if (command == "/tournament" || command.compare(0, 12, "/tournament ") == 0) {
+                // Турнир занимает все ядра наравне с шардами; игры сервера продолжаются.
+                // Аргументы в любом порядке: число партий и вариант правил
+                uint64_t games = DEFAULT_TOURNAMENT_GAMES;
+                std::string rules = "classic";
+                bool valid = true;
+                size_t start = command.find_first_not_of(' ', 11);
+                while (start != std::string::npos) {
+                    size_t end = command.find(' ', start);
+                    std::string argument = command.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                    if (ServerConfig::isRulesName(argument)) rules = argument;
+                    else if ((games = ServerConfig::parseGameCount(argument)) == 0) valid = false;
+                    start = end == std::string::npos ? end : command.find_first_not_of(' ', end);
+                }
+                if (!valid) {
+                    std::cout << "Usage: /tournament [GAMES] [classic|blitz|large]\n";
+                }
+                else {
+                    runTournament(rules, games);
+                }
+            }
+            else if (command == "/trace" || command.compare(0, 7, "/trace ") == 0) {
+                dumpTrace(command.size() > 7 ? command.substr(7) : DEFAULT_TRACE_FILE);
+            }
+            else if (command == "/checkpoint") {
+                if (config.checkpointFile.empty()) {
+                    std::cout << "Checkpoints are off\n";
+                }
+                else {
+                    auto started = std::chrono::steady_clock::now();
+                    if (saveCheckpoint(true)) {
+                        std::cout << "Checkpoint: " << checkpointGames << " games saved to " << config.checkpointFile
+                            << " in " << Metrics::nanosecondsSince(started) / 1e6 << " ms\n";
+                    }
+                }
+            }
             else if (command == "/stop") {
                 std::cout << "Stopping server...\n";
                 running = false;
+                stopCheckpoints();
+                for (auto& shard : shards) {
+                    shard->requestStop();
+                }
+                break;
             }
             else if (command == "/help") {
                 std::cout << "Available commands:\n";
                 std::cout << "  /stats - Show server statistics\n";
-                std::cout << "  /stop - Stop the server\n";
+                std::cout << "  /analyze [verify] - Analyze the game journal\n";
+                std::cout << "  /tournament [GAMES] [RULES] - Play a bot tournament on all cores\n";
+                std::cout << "  /trace [FILE] - Dump trace spans as Chrome trace JSON\n";
+                std::cout << "  /checkpoint - Save live games now\n";
+                std::cout << "  /stop - Stop the server, saving live games\n";
                 std::cout << "  /help - Show this help\n";
             }
             else if (!command.empty()) {
@@ -891,27 +7723,315 @@ private:
         }
     }
 
-    void showStats() {
-        std::lock_guard<std::mutex> lock1(queueMutex);
-        std::lock_guard<std::mutex> lock2(gamesMutex);
+    void checkpointLoop() {
+        Trace::nameThread("checkpoint");
+        std::unique_lock<std::mutex> lock(checkpointMutex);
+        while (!checkpointWakeup.wait_for(lock, std::chrono::milliseconds(config.checkpointIntervalMs),
+            [this]() { return checkpointStopping; })) {
+            lock.unlock();
+            saveCheckpoint(true);
+            lock.lock();
+        }
+    }
+
+    void stopCheckpoints() {
+        {
+            std::lock_guard<std::mutex> lock(checkpointMutex);
+            checkpointStopping = true;
+        }
+        checkpointWakeup.notify_all();
+        if (checkpointThread.joinable()) {
+            checkpointThread.join();
+        }
+    }
+
+    // Собирает партии всех шардов в файл контрольной точки. Пока шарды работают,
+    // каждый кодирует свои партии в своем потоке, а этот поток ждет; после
+    // остановки шардов партии читаются напрямую
+    bool saveCheckpoint(bool shardsRunning) {
+        std::lock_guard<std::mutex> lock(checkpointWriteMutex);
+        std::vector<char> data(sizeof(Checkpoint::FileHeader));
+        uint32_t count = 0;
+        for (auto& shard : shards) {
+            if (shardsRunning) {
+                ServerShard* target = shard.get();
+                std::promise<uint32_t> encoded;
+                std::future<uint32_t> result = encoded.get_future();
+                target->post([target, &data, &encoded]() { encoded.set_value(target->checkpointGames(data)); });
+                count += result.get();
+            }
+            else {
+                count += shard->checkpointGames(data);
+            }
+        }
+
+        Checkpoint::FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Checkpoint::MAGIC, sizeof(header.magic));
+        header.version = Checkpoint::VERSION;
+        header.gameCount = count;
+        header.nextPlayerId = static_cast<uint32_t>(nextPlayerId.load());
+        header.nextGameId = nextGameId;
+        header.createdUnixMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        std::memcpy(data.data(), &header, sizeof(header));
+
+        if (!CheckpointFile::write(config.checkpointFile, data)) {
+            std::cerr << "Failed to write checkpoint " << config.checkpointFile << "\n";
+            return false;
+        }
+        checkpointGames = count;
+        checkpointsWritten++;
+        return true;
+    }
+
+    // Продолжает партии, сохраненные прежним процессом. Точка старше
+    // resumeGraceMs не восстанавливается: вернуться в такие партии никто не успеет
+    void restoreCheckpoint() {
+        MappedFile file;
+        if (config.checkpointFile.empty() || !file.open(config.checkpointFile)) return;
+
+        auto started = std::chrono::steady_clock::now();
+        Checkpoint::FileHeader header;
+        if (file.size() < sizeof(header)) {
+            std::cerr << "Checkpoint " << config.checkpointFile << " is damaged, games not restored\n";
+            return;
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, Checkpoint::MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != Checkpoint::VERSION) {
+            std::cerr << config.checkpointFile << " is not a checkpoint of this server version, games not restored\n";
+            return;
+        }
+        uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        if (now > header.createdUnixMs + static_cast<uint64_t>(config.resumeGraceMs)) {
+            std::cout << "Checkpoint " << config.checkpointFile << " is older than the resume grace period, games not restored\n";
+            return;
+        }
+
+        nextPlayerId = std::max(nextPlayerId.load(), static_cast<int>(header.nextPlayerId));
+        nextGameId = std::max(nextGameId.load(), header.nextGameId);
+
+        uint32_t restored = 0;
+        uint32_t skipped = 0;
+        size_t offset = sizeof(header);
+        for (uint32_t i = 0; i < header.gameCount; i++) {
+            Checkpoint::GameEntry entry;
+            Journal::RecordHeader record;
+            if (offset + sizeof(entry) + sizeof(record) > file.size()) break;
+            std::memcpy(&entry, file.data() + offset, sizeof(entry));
+            std::memcpy(&record, file.data() + offset + sizeof(entry), sizeof(record));
+            size_t expected = sizeof(record) + (record.shipCounts[0] + record.shipCounts[1]) * sizeof(Journal::ShipEntry) +
+                record.shotCount * sizeof(Journal::ShotEntry);
+            if (entry.length < sizeof(entry) + expected || offset + entry.length > file.size()) break;
+
+            ServerShard& shard = *shards[record.gameId % shards.size()];
+            if (shard.restoreGame(entry, file.data() + offset + sizeof(entry))) restored++;
+            else skipped++;
+            offset += entry.length;
+        }
+        skipped += header.gameCount - restored - skipped;
+
+        std::cout << "Restored " << restored << " games from " << config.checkpointFile << " in "
+            << Metrics::nanosecondsSince(started) / 1e6 << " ms";
+        if (skipped > 0) {
+            std::cout << ", " << skipped << " damaged games skipped";
+        }
+        std::cout << "\n";
+    }
+
+    void dumpTrace(const std::string& path) {
+        if (!Trace::ENABLED) {
+            std::cout << "Tracing is compiled out; rebuild with -DNAVALBATTLE_TRACE=1\n";
+            return;
+        }
+
+        long long events = Trace::writeChromeTrace(path);
+        if (events < 0) {
+            std::cout << "Failed to write trace to " << path << "\n";
+        }
+        else {
+            std::cout << events << " spans written to " << path << " (open in ui.perfetto.dev or about://tracing)\n";
+        }
+    }
+
+    // Сумма счетчиков всех шардов
+    struct Totals {
+        size_t waiting = 0;
+        size_t activeGames = 0;
+        uint64_t finishedGames = 0;
+        size_t poolBytes = 0;
+        size_t spectators = 0;
+        uint64_t journalGames = 0;
+        uint64_t journalBytes = 0;
+        bool journalOpen = false;
+    };
+
+    Totals totals() const {
+        Totals sum;
+        for (const auto& shard : shards) {
+            sum.waiting += shard->waitingPlayerCount();
+            sum.activeGames += shard->activeGames();
+            sum.finishedGames += shard->finishedGames();
+            sum.poolBytes += shard->reservedPoolBytes();
+            sum.spectators += shard->spectators();
+            sum.journalGames += shard->gameJournal().recordCount();
+            sum.journalBytes += shard->gameJournal().bytesWritten();
+            sum.journalOpen = sum.journalOpen || shard->gameJournal().isOpen();
+        }
+        return sum;
+    }
+
+    // Метрика с одной строкой на шард
+    void appendShardMetric(std::string& out, const char* name, const char* type, const char* help,
+        uint64_t (*value)(const ServerShard&)) {
+        out += std::string("# HELP ") + name + " " + help + "\n";
+        out += std::string("# TYPE ") + name + " " + type + "\n";
+        for (size_t i = 0; i < shards.size(); i++) {
+            out += std::string(name) + "{shard=\"" + std::to_string(i) + "\"} " + std::to_string(value(*shards[i])) + "\n";
+        }
+    }
 
+    // Текст для /metrics. Вызывается из потока эндпоинта, поэтому читает только атомарные значения
+    std::string renderMetrics() {
+        std::string out;
+        out.reserve(16 * 1024);
+        Totals sum = totals();
+        std::unique_ptr<Metrics::Snapshot> snapshot(new Metrics::Snapshot());
+        Metrics::collect(*snapshot);
+        Metrics::appendMetric(out, "navalbattle_waiting_players", "gauge", "Players not yet in a game.", sum.waiting);
+        Metrics::appendMetric(out, "navalbattle_active_games", "gauge", "Games in progress.", sum.activeGames);
+        Metrics::appendMetric(out, "navalbattle_players_served_total", "counter", "Connections accepted.",
+            static_cast<uint64_t>(nextPlayerId - 1));
+        Metrics::appendMetric(out, "navalbattle_games_finished_total", "counter", "Games won by sinking the fleet or by forfeit.",
+            sum.finishedGames);
+        Metrics::appendMetric(out, "navalbattle_heap_allocations_total", "counter", "Heap allocations by the process.",
+            snapshot->counters[Metrics::HEAP_ALLOCATIONS]);
+        Metrics::appendMetric(out, "navalbattle_journal_games_total", "counter", "Games written to the journal.",
+            sum.journalGames);
+
+        appendShardMetric(out, "navalbattle_shard_connections", "gauge", "Open connections per shard.",
+            [](const ServerShard& shard) -> uint64_t { return shard.connections(); });
+        appendShardMetric(out, "navalbattle_shard_active_games", "gauge", "Games in progress per shard.",
+            [](const ServerShard& shard) -> uint64_t { return shard.activeGames(); });
+        appendShardMetric(out, "navalbattle_shard_spectators", "gauge", "Spectators watching games per shard.",
+            [](const ServerShard& shard) -> uint64_t { return shard.spectators(); });
+        appendShardMetric(out, "navalbattle_shard_migrated_in_total", "counter", "Waiting players and spectators taken over from other shards.",
+            [](const ServerShard& shard) { return shard.playersMigratedIn(); });
+        appendShardMetric(out, "navalbattle_shard_migrated_out_total", "counter", "Waiting players and spectators handed to other shards.",
+            [](const ServerShard& shard) { return shard.playersMigratedOut(); });
+
+        Metrics::appendPrometheus(out, *snapshot);
+        return out;
+    }
+
+    void showStats() {
+        Totals sum = totals();
+        // Снимок метрик около 46 КБ - не для стека
+        std::unique_ptr<Metrics::Snapshot> metrics(new Metrics::Snapshot());
+        Metrics::collect(*metrics);
         std::cout << "\n=== Server Statistics ===\n";
-        std::cout << "Waiting players: " << waitingPlayers.size() << "\n";
-        std::cout << "Active games: " << activeGames.size() << "\n";
+        std::cout << "Waiting players: " << sum.waiting << "\n";
+        std::cout << "Active games: " << sum.activeGames << "\n";
         std::cout << "Total players served: " << (nextPlayerId - 1) << "\n";
+        uint64_t finished = sum.finishedGames;
+        std::cout << "Finished games: " << finished << "\n";
+        std::cout << "Spectators: " << sum.spectators << "\n";
+        for (size_t i = 0; i < shards.size(); i++) {
+            const ServerShard& shard = *shards[i];
+            std::cout << "  shard " << i << ": " << shard.connections() << " connections, "
+                << shard.waitingPlayerCount() << " waiting, " << shard.activeGames() << " games, "
+                << shard.finishedGames() << " finished, players moved in/out "
+                << shard.playersMigratedIn() << "/" << shard.playersMigratedOut() << "\n";
+        }
+        std::cout << "Memory per game: " << sizeof(Game) + 2 * (sizeof(Player) + INPUT_BUFFER_SIZE)
+            << " bytes (game and two players with input buffers), pools reserve " << sum.poolBytes << " bytes\n";
+        uint64_t allocations = metrics->counters[Metrics::HEAP_ALLOCATIONS];
+        std::cout << "Heap allocations: " << allocations << " ("
+            << metrics->counters[Metrics::HEAP_BYTES] / 1024 << " KB)";
+        if (finished > 0) {
+            std::cout << ", " << allocations / finished << " per finished game";
+        }
+        std::cout << "\n";
+
+        const HistogramSnapshot& matchWait = metrics->histograms[Metrics::MATCH_WAIT];
+        const HistogramSnapshot& turns = metrics->histograms[Metrics::TURN_PROCESSING];
+        const HistogramSnapshot& setup = metrics->histograms[Metrics::GAME_SETUP];
+        std::cout << "Time to match (ms): p50 " << matchWait.percentile(50) / 1e6
+            << ", p99 " << matchWait.percentile(99) / 1e6 << " (" << matchWait.total << " players)\n";
+        std::cout << "Turn processing (us): p50 " << turns.percentile(50) / 1e3
+            << ", p99 " << turns.percentile(99) / 1e3 << " (" << turns.total << " shots)\n";
+        std::cout << "Game setup (us): p50 " << setup.percentile(50) / 1e3
+            << ", p99 " << setup.percentile(99) / 1e3 << "\n";
+        std::cout << "Traffic: " << metrics->counters[Metrics::BYTES_SENT] / 1024 << " KB sent, "
+            << metrics->counters[Metrics::BYTES_RECEIVED] / 1024 << " KB received\n";
+        if (turns.total > 0) {
+            double shots = static_cast<double>(turns.total);
+            std::cout << "System calls per turn: " << metrics->counters[Metrics::SEND_CALLS] / shots << " send, "
+                << metrics->counters[Metrics::RECV_CALLS] / shots << " recv, "
+                << metrics->counters[Metrics::POLL_CALLS] / shots << " poll\n";
+        }
+        std::cout << "Disconnects:";
+        for (int i = Metrics::DISCONNECT_CLOSED; i <= Metrics::DISCONNECT_SLOW_CONSUMER; i++) {
+            std::cout << " " << Metrics::DISCONNECT_REASONS[i - Metrics::DISCONNECT_CLOSED] << " " << metrics->counters[i];
+        }
+        std::cout << "\n";
+        std::cout << "Lost connections in games: " << metrics->counters[Metrics::SESSIONS_SUSPENDED] << ", resumed "
+            << metrics->counters[Metrics::SESSIONS_RESUMED] << ", expired " << metrics->counters[Metrics::SESSIONS_EXPIRED] << "\n";
+        if (sum.journalOpen) {
+            std::cout << "Journal: " << sum.journalGames << " games, " << sum.journalBytes / 1024 << " KB written to "
+                << config.journalDirectory << " (one segment series per shard)\n";
+        }
+        else {
+            std::cout << "Journal: off\n";
+        }
+        if (!config.checkpointFile.empty()) {
+            std::cout << "Checkpoint: " << checkpointGames << " games in " << config.checkpointFile
+                << ", " << checkpointsWritten << " written\n";
+        }
+        else {
+            std::cout << "Checkpoint: off\n";
+        }
         std::cout << "=========================\n\n";
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     std::cout << "=== Sea Battle Server ===\n\n";
 
+    ServerConfig config;
+    if (!config.parse(argc, argv)) {
+        ServerConfig::printUsage();
+        return 1;
+    }
+
+    // Только бенчмарки, без запуска сервера: удобно для сравнения до и после изменений движка
+    if (config.benchmarkOnly) {
+#if NAVALBATTLE_BENCH
+        Benchmarks::runAll();
+        return 0;
+#else
+        std::cerr << "Benchmarks are compiled out; rebuild with -DNAVALBATTLE_BENCH=1\n";
+        return 1;
+#endif
+    }
+
+    if (!config.analyzeDirectory.empty()) {
+        return JournalAnalyzer::run(config.analyzeDirectory, config.verifyJournal) ? 0 : 1;
+    }
+
+    if (config.tournamentGames > 0) {
+        runTournament(config.tournamentRules, config.tournamentGames);
+        return 0;
+    }
+
     // Получаем порт от пользователя
     int port = InputUtils::getServerPort();
 
     std::cout << "\nInitializing server on port " << port << "...\n";
 
-    GameServer server(port);
+    GameServer server(port, config);
 
     if (!server.initialize()) {
         std::cerr << "Failed to initialize server\n";
@@ -927,4 +8047,4 @@ int main() {
     std::cin.ignore();
 
     return 0;
-}
\ No newline at end of file
+}